@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace utils {
+
+template <class T, std::size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+
+    template <class U>
+    struct rebind {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template <class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+
+    void deallocate(T* ptr, std::size_t) {
+        ::operator delete(ptr, std::align_val_t(Alignment));
+    }
+
+    template <class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const {
+        return true;
+    }
+};
+
+template <class T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+}  // namespace utils
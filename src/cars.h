@@ -2,6 +2,8 @@
 
 #include "graph.h"
 #include "particles.h"
+#include "router.h"
+#include "world.h"
 
 #include <SFML/Window.hpp>
 #include <SFML/Graphics.hpp>
@@ -50,8 +52,12 @@ struct Cars {
     }
 
     void Render(sf::RenderWindow& window, float part) const {
+        const auto view = ViewRect(window);
         for (std::size_t i = 0; i < physics.Size(); ++i) {
             auto rect = physics.shapes[i];
+            if (!view.intersects(rect)) {
+                continue;
+            }
             auto shape = sf::RectangleShape(WindXy(rect.width, rect.height));
             shape.setPosition(rect.left, rect.top);
             shape.move(physics.velocities[i] * part);
@@ -81,14 +87,7 @@ struct Cars {
 
         std::vector<std::size_t> dead;
         for (std::size_t i = 0; i < physics.Size(); ++i) {
-            const auto& rect = physics.shapes[i];
-            const float windX = window.getSize().x;
-            const float windY = window.getSize().y;
-            if (rect.left > windX ||
-                rect.top > windY ||
-                rect.left + rect.width < -windX ||
-                rect.top + rect.height < -windY)
-            {
+            if (!gWorld.bounds.intersects(physics.shapes[i])) {
                 dead.push_back(i);
             }
         }
@@ -124,42 +123,23 @@ public:
             if (vertex < 0) {
                 continue;
             }
-            int minCost = 1;
-            int bestDirection;
-            Graph::Edge* edge = nullptr;
-            for (int dirInd = 0; dirInd < Graph::DIRS.size(); ++dirInd) {
-                auto cur = graph.GetEdge(vertex, dirInd);
-                if (cur && minCost > cur->cost) {
-                    minCost = cur->cost;
-                    edge = cur;
-                    bestDirection = dirInd;
-                }
-            }
-            const auto targetDir = Normed(cars.to[i] - Center(cars.physics.shapes[i]));
-            const WindXy intTargetDir = {std::round(targetDir.x), std::round(targetDir.y)};
-            if (!edge) {
-                int dirInd = std::find(Graph::DIRS.begin(), Graph::DIRS.end(), intTargetDir) -
-                    Graph::DIRS.begin();
-                assert(dirInd < Graph::DIRS.size());
-                edge = graph.AddEdge(vertex, dirInd);
-                bestDirection = dirInd;
-            }
-            if (NORMAL(gen) > 0.5f) {
-                std::array<int, Graph::DIRS.size()> dirInds;
-                std::iota(dirInds.begin(), dirInds.end(), 0);
-                std::sort(dirInds.begin(), dirInds.end(), [&](int lhs, int rhs) {
-                    return Cos(Graph::DIRS[lhs], targetDir) > Cos(Graph::DIRS[rhs], targetDir);
+            const auto& field = router.Field(cars.to[i]);
+            int dirInd = field.Next(vertex);
+            // Without a route, and now and then to explore, a new edge as close to the target direction as possible
+            if (dirInd == FlowField::NONE || NORMAL(gen) > 0.5f) {
+                const auto& heading = field.Heading(vertex);
+                const auto missing = std::find_if(heading.begin(), heading.end(), [&](int dir) {
+                    return !graph.HasEdge(vertex, dir);
                 });
-                for (int dirInd : dirInds) {
-                    if (!graph.HasEdge(vertex, dirInd)) {
-                        edge = graph.AddEdge(vertex, dirInd);
-                        bestDirection = dirInd;
-                        break;
-                    }
+                if (missing != heading.end()) {
+                    dirInd = *missing;
+                    router.AddEdge(vertex, dirInd);
+                } else if (dirInd == FlowField::NONE) {
+                    dirInd = heading[0];
                 }
             }
-            --edge->cost;
-            cars.physics.SetVelocity(i, Cars::SPEED * Graph::DIRS[bestDirection]);
+            router.Travel(vertex, dirInd);
+            cars.physics.SetVelocity(i, Cars::SPEED * Graph::DIRS[dirInd]);
         }
 
         cars.Update(window);
@@ -205,7 +185,8 @@ public:
 
 private:
     Cars cars;
-    Graph graph = Graph((WIDTH / DPIXELS + 1) * (HEIGHT / DPIXELS + 1));
+    Graph graph = Graph(GridColumns() * GridRows());
+    Router router{graph};
     std::vector<WindXy> sources;
 
     struct Period {
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "physics.h"
+#include "world.h"
+
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+/*
+ * ChunkStreamer splits the world into square chunks. Bodies of chunks outside
+ * the active region are removed from the simulation and kept as raw bytes,
+ * they come back unchanged when their chunk becomes active again.
+ */
+template <class TShape>
+class ChunkStreamer {
+public:
+    void Stream(Physics<TShape>& physics, const sf::FloatRect& active) {
+        physics.EraseIf([&](std::size_t i) {
+            const auto chunk = GetChunk(Center(physics.shapes[i]));
+            if (IsActive(chunk, active)) {
+                return false;
+            }
+            Store(chunk, physics, i);
+            return true;
+        });
+
+        for (auto it = stored_.begin(); it != stored_.end();) {
+            if (!IsActive(it->first, active)) {
+                ++it;
+                continue;
+            }
+            Load(it->second, physics);
+            it = stored_.erase(it);
+        }
+    }
+
+    std::size_t StoredBodies() const {
+        std::size_t count = 0;
+        for (const auto& [chunk, bytes] : stored_) {
+            count += bytes.size() / sizeof(Record);
+        }
+        return count;
+    }
+
+private:
+    using Chunk = std::pair<int, int>;
+
+    struct Record {
+        TShape shape;
+        sf::Vector2f velocity;
+        sf::Vector2f acceleration;
+        float mass;
+        unsigned long properties;
+    };
+
+    static_assert(std::is_trivially_copyable_v<Record>);
+
+    static Chunk GetChunk(WindXy pos) {
+        return {
+            static_cast<int>(std::floor(pos.x / gWorld.chunkSize)),
+            static_cast<int>(std::floor(pos.y / gWorld.chunkSize)),
+        };
+    }
+
+    static bool IsActive(Chunk chunk, const sf::FloatRect& active) {
+        const sf::FloatRect rect(
+            chunk.first * gWorld.chunkSize,
+            chunk.second * gWorld.chunkSize,
+            gWorld.chunkSize,
+            gWorld.chunkSize);
+        return rect.intersects(active);
+    }
+
+    void Store(Chunk chunk, const Physics<TShape>& physics, std::size_t i) {
+        const Record record = {
+            physics.shapes[i],
+            physics.velocities[i],
+            physics.accelerations[i],
+            physics.masses[i],
+            physics.properties[i].to_ulong(),
+        };
+        auto& bytes = stored_[chunk];
+        bytes.resize(bytes.size() + sizeof(Record));
+        std::memcpy(bytes.data() + bytes.size() - sizeof(Record), &record, sizeof(Record));
+    }
+
+    static void Load(const std::vector<std::byte>& bytes, Physics<TShape>& physics) {
+        for (std::size_t offset = 0; offset < bytes.size(); offset += sizeof(Record)) {
+            Record record;
+            std::memcpy(&record, bytes.data() + offset, sizeof(Record));
+            physics.PushBack(record.shape, record.velocity, record.acceleration, record.mass);
+            physics.properties.back() = record.properties;
+        }
+    }
+
+    std::map<Chunk, std::vector<std::byte>> stored_;
+};
+
+}  // namespace utils
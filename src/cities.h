@@ -13,7 +13,8 @@ struct Edge {
 };
 
 struct EdgeData {
-    sf::RectangleShape strip;
+    // First of the six road vertices
+    std::size_t firstVertex;
 };
 
 struct VertexData {
@@ -56,13 +57,11 @@ public:
     }
 
     void Render(sf::RenderWindow& window, float part) {
+        roads_.Draw(window);
         for (std::size_t node = 0; node < graph_.size(); ++node) {
             if (vertexData_[node].point) {
                 window.draw(*vertexData_[node].point);
             }
-            for (auto edge : graph_[node]) {
-                window.draw(edgeData_[edge.id].strip);
-            }
         }
     }
 
@@ -93,17 +92,23 @@ private:
             }
         }
         int id = edgeData_.size();
-        auto& data = edgeData_.emplace_back();
         auto direction = vertexData_[to].coords - vertexData_[from].coords;
-        data.strip.setSize({
+        sf::RectangleShape strip({
             NODE_RADIUS,
             std::abs(direction),
         });
-        data.strip.setPosition(vertexData_[from].coords);
-        data.strip.setFillColor(GREY);
-        data.strip.rotate(std::arg(direction) - 90);
-
-        move strip to vertex's center
+        strip.setOrigin(NODE_RADIUS / 2.f, 0);
+        strip.setPosition(vertexData_[from].coords + WindXy(NODE_RADIUS, NODE_RADIUS));
+        strip.rotate(std::arg(direction) - 90);
+
+        const auto& transform = strip.getTransform();
+        std::array<sf::Vertex, 6> quad;
+        for (std::size_t i = 0; i < quad.size(); ++i) {
+            // Two triangles: 0 1 2 and 0 2 3
+            static constexpr std::array<std::size_t, 6> CORNERS = {0, 1, 2, 0, 2, 3};
+            quad[i] = sf::Vertex(transform.transformPoint(strip.getPoint(CORNERS[i])), GREY);
+        }
+        edgeData_.push_back({roads_.Append(quad.data(), quad.size())});
 
         return id;
     }
@@ -127,4 +132,5 @@ private:
     std::vector<std::vector<Edge>> graph_;
     std::vector<VertexData> vertexData_;
     std::vector<EdgeData> edgeData_;
+    utils::RetainedVertices roads_{sf::Triangles};
 };
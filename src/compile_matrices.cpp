@@ -1,28 +1,541 @@
-#include <vector>
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <latch>
+#include <limits>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * Lazy matrix expressions. a + b - 2 * c builds a tree of small nodes and computes nothing;
+ * assigning the tree to a matrix evaluates every element in one pass with no temporaries.
+ * Matrices are row-major and contiguous, so element index of a node is op(At(index)) of its operands
+ * at the same flat index and the evaluation loop vectorizes.
+ * A product a * b * c is one Product node: it multiplies in the cheapest order for the run-time shapes
+ * and computes its last multiplication a block of rows at a time, just before the elementwise part
+ * of the tree writes those rows, so a * b + c and 2 * (a * b) cost no extra pass.
+ * Everything a tree computes before that pass, the other multiplications and operands that are not
+ * leaves, is a graph of tasks run on the shared thread pool, so independent subtrees run concurrently.
+ */
+
+// Extent of a dimension known only at run time
+constexpr std::size_t DYNAMIC = 0;
+// Elements of a row block of products, 32 KB of doubles
+constexpr std::size_t BLOCK_ELEMENTS = 4096;
+// Least multiply-adds or elements of a chunk that runs on its own thread
+constexpr std::size_t PARALLEL_WORK = 1 << 18;
+
+// A row-major operand of a multiplication
+struct Factor {
+    const double* data;
+    std::size_t rows;
+    std::size_t cols;
+};
+
+// Rows [from, to) of lhs * rhs into out, which holds just those rows
+void MultiplyRows(const Factor& lhs, const Factor& rhs, std::size_t from, std::size_t to, double* out) {
+    assert(lhs.cols == rhs.rows);
+    for (std::size_t i = from; i < to; ++i) {
+        double* row = out + (i - from) * rhs.cols;
+        std::fill_n(row, rhs.cols, 0.);
+        for (std::size_t k = 0; k < lhs.cols; ++k) {
+            const double a = lhs.data[i * lhs.cols + k];
+            const double* b = rhs.data + k * rhs.cols;
+            for (std::size_t j = 0; j < rhs.cols; ++j) {
+                row[j] += a * b[j];
+            }
+        }
+    }
+}
+
+/*
+ * Values computed before the final pass over an expression and the tasks that compute them.
+ * A value is a leaf matrix or the output of one task; outputs share buffers by liveness: a task
+ * takes over the buffer of a value whose producer and readers all precede it in the graph, which
+ * reuses memory without ordering tasks that could run concurrently. A task covering much work is
+ * split into row ranges, so a single large product still occupies every thread.
+ */
+class TaskGraph {
+public:
+    // run(graph, out, from, to) writes rows [from, to) of the value to out, which holds all of it
+    using Run = std::function<void(const TaskGraph&, double*, std::size_t, std::size_t)>;
+
+    std::size_t AddLeaf(const double* data, std::size_t rows, std::size_t cols) {
+        values_.push_back({data, NONE, NONE, rows, cols});
+        return values_.size() - 1;
+    }
+
+    // A value computed by run once the values of inputs are; work is its multiply-adds or elements
+    std::size_t AddTask(std::size_t rows, std::size_t cols, std::vector<std::size_t> inputs, std::size_t work, Run run) {
+        const std::size_t parts = std::max<std::size_t>(1, std::min({work / PARALLEL_WORK, utils::NumThreads(), rows}));
+        tasks_.push_back({std::move(run), std::move(inputs), values_.size(), parts});
+        values_.push_back({nullptr, tasks_.size() - 1, NONE, rows, cols});
+        return values_.size() - 1;
+    }
+
+    std::size_t Rows(std::size_t value) const {
+        return values_[value].rows;
+    }
+
+    std::size_t Cols(std::size_t value) const {
+        return values_[value].cols;
+    }
+
+    // Data of a leaf, nullptr for the output of a task
+    const double* Leaf(std::size_t value) const {
+        return values_[value].leaf;
+    }
+
+    // The value once the tasks ran
+    Factor Get(std::size_t value) const {
+        const auto& v = values_[value];
+        return {v.leaf ? v.leaf : buffers_[v.buffer].data(), v.rows, v.cols};
+    }
+
+    /*
+     * Runs every task, the values in live are read afterwards and keep their buffers.
+     * Once a task throws, the tasks not yet started are skipped but still counted as done,
+     * so the wait ends, and the first exception is rethrown.
+     */
+    void RunAll(const std::vector<std::size_t>& live) {
+        Allocate(live);
+        if (tasks_.empty()) {
+            return;
+        }
+        if (utils::gInParallelFor || utils::NumThreads() == 1) {
+            for (auto& task : tasks_) {
+                task.run(*this, Output(task), 0, values_[task.output].rows);
+            }
+            return;
+        }
+
+        std::vector<std::vector<std::size_t>> dependents(tasks_.size());
+        std::vector<std::atomic<std::size_t>> waiting(tasks_.size());
+        std::vector<std::atomic<std::size_t>> parts(tasks_.size());
+        // Found before any task runs: once they do, a dependent reaching zero would be posted twice
+        std::vector<std::size_t> roots;
+        for (std::size_t t = 0; t < tasks_.size(); ++t) {
+            parts[t] = tasks_[t].parts;
+            for (const auto input : tasks_[t].inputs) {
+                if (values_[input].producer != NONE) {
+                    dependents[values_[input].producer].push_back(t);
+                    ++waiting[t];
+                }
+            }
+            if (waiting[t] == 0) {
+                roots.push_back(t);
+            }
+        }
+        std::latch done(static_cast<std::ptrdiff_t>(tasks_.size()));
+        std::mutex errorMutex;
+        std::exception_ptr error;
+        std::atomic<bool> failed = false;
+        std::function<void(std::size_t)> post = [&](std::size_t t) {
+            const auto& task = tasks_[t];
+            const std::size_t rows = values_[task.output].rows;
+            for (std::size_t part = 0; part < task.parts; ++part) {
+                boost::asio::post(utils::ThreadPool(), [&, t, part, rows]() {
+                    const auto& task = tasks_[t];
+                    if (!failed) {
+                        utils::gInParallelFor = true;
+                        try {
+                            task.run(*this, Output(task), part * rows / task.parts, (part + 1) * rows / task.parts);
+                        } catch (...) {
+                            std::lock_guard lock(errorMutex);
+                            if (!error) {
+                                error = std::current_exception();
+                            }
+                            failed = true;
+                        }
+                        utils::gInParallelFor = false;
+                    }
+                    if (--parts[t] == 0) {
+                        for (const auto dependent : dependents[t]) {
+                            if (--waiting[dependent] == 0) {
+                                post(dependent);
+                            }
+                        }
+                        done.count_down();
+                    }
+                });
+            }
+        };
+        for (const auto t : roots) {
+            post(t);
+        }
+        done.wait();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    static constexpr std::size_t NONE = -1;
+
+    struct Value {
+        const double* leaf;
+        std::size_t producer;
+        std::size_t buffer;
+        std::size_t rows;
+        std::size_t cols;
+    };
+
+    struct Task {
+        Run run;
+        std::vector<std::size_t> inputs;
+        std::size_t output;
+        std::size_t parts;
+    };
+
+    double* Output(const Task& task) {
+        return buffers_[values_[task.output].buffer].data();
+    }
+
+    // Tasks are added after the tasks of their inputs, so their order is a valid schedule
+    void Allocate(const std::vector<std::size_t>& live) {
+        const std::size_t n = tasks_.size();
+        std::vector<std::vector<std::size_t>> readers(values_.size());
+        std::vector<std::vector<bool>> before(n, std::vector<bool>(n));
+        for (std::size_t t = 0; t < n; ++t) {
+            for (const auto input : tasks_[t].inputs) {
+                readers[input].push_back(t);
+                const std::size_t producer = values_[input].producer;
+                if (producer != NONE) {
+                    before[t][producer] = true;
+                    for (std::size_t u = 0; u < producer; ++u) {
+                        before[t][u] = before[t][u] || before[producer][u];
+                    }
+                }
+            }
+        }
+        std::vector<bool> keep(values_.size());
+        for (const auto value : live) {
+            keep[value] = true;
+        }
+
+        // Value held by each buffer and the elements it needs
+        std::vector<std::size_t> holder;
+        std::vector<std::size_t> sizes;
+        for (std::size_t t = 0; t < n; ++t) {
+            auto& output = values_[tasks_[t].output];
+            const std::size_t size = output.rows * output.cols;
+            // The smallest free buffer that fits, else the largest free one, which grows
+            const auto better = [&](std::size_t b, std::size_t than) {
+                const bool fits = sizes[b] >= size;
+                if (than == NONE || fits != (sizes[than] >= size)) {
+                    return than == NONE || fits;
+                }
+                return fits ? sizes[b] < sizes[than] : sizes[b] > sizes[than];
+            };
+            std::size_t chosen = NONE;
+            for (std::size_t b = 0; b < holder.size(); ++b) {
+                const std::size_t value = holder[b];
+                const bool dead = !keep[value] && before[t][values_[value].producer]
+                    && std::all_of(readers[value].begin(), readers[value].end(), [&](auto r) { return before[t][r]; });
+                if (dead && better(b, chosen)) {
+                    chosen = b;
+                }
+            }
+            if (chosen == NONE) {
+                chosen = holder.size();
+                holder.push_back(0);
+                sizes.push_back(0);
+            }
+            holder[chosen] = tasks_[t].output;
+            sizes[chosen] = std::max(sizes[chosen], size);
+            output.buffer = chosen;
+        }
+        buffers_.clear();
+        for (const auto size : sizes) {
+            buffers_.emplace_back(size);
+        }
+    }
 
-struct Addition;
+    std::vector<Value> values_;
+    std::vector<Task> tasks_;
+    std::vector<std::vector<double>> buffers_;
+};
+
+/*
+ * Base of matrices and nodes; each has ROWS and COLS, static extents or DYNAMIC, and IS_LEAF.
+ * Nodes also have Schedule(graph, out, live), which adds the tasks the node needs before the final
+ * pass into out and appends the values that pass reads to live, Bind(graph), called after the tasks
+ * ran, and ComputeRows(from, to), called before the elements of those rows are read.
+ * Only products do anything in them.
+ */
+struct ExpressionTag {};
+
+template <class E>
+concept Expression = std::is_base_of_v<ExpressionTag, std::remove_cvref_t<E>>;
+
+template <class L, class R>
+constexpr bool SAME_ROWS = L::ROWS == DYNAMIC || R::ROWS == DYNAMIC || L::ROWS == R::ROWS;
+
+template <class L, class R>
+constexpr bool SAME_COLS = L::COLS == DYNAMIC || R::COLS == DYNAMIC || L::COLS == R::COLS;
+
+// A leaf inside a node: matrices are held by reference, nodes are a few words and are copied
+template <class M>
+struct Ref : ExpressionTag {
+    static constexpr bool IS_LEAF = false;
+    static constexpr std::size_t ROWS = M::ROWS;
+    static constexpr std::size_t COLS = M::COLS;
+
+    explicit Ref(const M& m)
+        : m(m)
+    {
+    }
+
+    std::size_t Rows() const {
+        return m.Rows();
+    }
+
+    std::size_t Cols() const {
+        return m.Cols();
+    }
+
+    double At(std::size_t index) const {
+        return m.At(index);
+    }
+
+    const double* Data() const {
+        return m.Data();
+    }
+
+    void Schedule(TaskGraph&, const double*, std::vector<std::size_t>&) const {
+    }
+
+    void Bind(const TaskGraph&) {
+    }
+
+    void ComputeRows(std::size_t, std::size_t) {
+    }
+
+    const M& m;
+};
+
+// How an operand is kept in a node; a temporary matrix would dangle, so it does not compile
+template <Expression E>
+auto Store(E&& e) {
+    using T = std::remove_cvref_t<E>;
+    if constexpr (T::IS_LEAF) {
+        static_assert(std::is_lvalue_reference_v<E>, "A temporary matrix cannot be an operand of a lazy expression");
+        return Ref<T>(e);
+    } else {
+        return T(std::forward<E>(e));
+    }
+}
+
+template <class E>
+using Stored = decltype(Store(std::declval<E>()));
+
+template <class L, class R, class Op>
+struct Binary : ExpressionTag {
+    static_assert(SAME_ROWS<L, R> && SAME_COLS<L, R>, "Operands of an elementwise operation differ in shape");
+
+    static constexpr bool IS_LEAF = false;
+    static constexpr std::size_t ROWS = L::ROWS == DYNAMIC ? R::ROWS : L::ROWS;
+    static constexpr std::size_t COLS = L::COLS == DYNAMIC ? R::COLS : L::COLS;
+
+    Binary(L lhs, R rhs, Op op)
+        : lhs(std::move(lhs))
+        , rhs(std::move(rhs))
+        , op(std::move(op))
+    {
+        assert(this->lhs.Rows() == this->rhs.Rows() && this->lhs.Cols() == this->rhs.Cols());
+    }
 
-template <class T, class U, class Op>
-struct Node {
     std::size_t Rows() const {
         return lhs.Rows();
     }
 
     std::size_t Cols() const {
-        return rhs.Cols();
+        return lhs.Cols();
+    }
+
+    double At(std::size_t index) const {
+        return op(lhs.At(index), rhs.At(index));
+    }
+
+    void Schedule(TaskGraph& graph, const double* out, std::vector<std::size_t>& live) const {
+        lhs.Schedule(graph, out, live);
+        rhs.Schedule(graph, out, live);
     }
 
-    T lhs;
-    U rhs;
+    void Bind(const TaskGraph& graph) {
+        lhs.Bind(graph);
+        rhs.Bind(graph);
+    }
+
+    void ComputeRows(std::size_t from, std::size_t to) {
+        lhs.ComputeRows(from, to);
+        rhs.ComputeRows(from, to);
+    }
+
+    L lhs;
+    R rhs;
+    [[no_unique_address]] Op op;
 };
 
-struct Matrix {
+template <class E, class Op>
+struct Unary : ExpressionTag {
+    static constexpr bool IS_LEAF = false;
+    static constexpr std::size_t ROWS = E::ROWS;
+    static constexpr std::size_t COLS = E::COLS;
+
+    Unary(E e, Op op)
+        : e(std::move(e))
+        , op(std::move(op))
+    {
+    }
+
+    std::size_t Rows() const {
+        return e.Rows();
+    }
+
+    std::size_t Cols() const {
+        return e.Cols();
+    }
+
+    double At(std::size_t index) const {
+        return op(e.At(index));
+    }
+
+    void Schedule(TaskGraph& graph, const double* out, std::vector<std::size_t>& live) const {
+        e.Schedule(graph, out, live);
+    }
+
+    void Bind(const TaskGraph& graph) {
+        e.Bind(graph);
+    }
+
+    void ComputeRows(std::size_t from, std::size_t to) {
+        e.ComputeRows(from, to);
+    }
+
+    E e;
+    [[no_unique_address]] Op op;
+};
+
+struct Scale {
+    double operator()(double x) const {
+        return factor * x;
+    }
+
+    double factor;
+};
+
+template <Expression L, Expression R>
+auto operator+(L&& lhs, R&& rhs) {
+    return Binary<Stored<L>, Stored<R>, std::plus<>>(Store(std::forward<L>(lhs)), Store(std::forward<R>(rhs)), {});
+}
+
+template <Expression L, Expression R>
+auto operator-(L&& lhs, R&& rhs) {
+    return Binary<Stored<L>, Stored<R>, std::minus<>>(Store(std::forward<L>(lhs)), Store(std::forward<R>(rhs)), {});
+}
+
+template <Expression E>
+auto operator-(E&& e) {
+    return Unary<Stored<E>, std::negate<>>(Store(std::forward<E>(e)), {});
+}
+
+template <Expression E>
+auto operator*(double factor, E&& e) {
+    return Unary<Stored<E>, Scale>(Store(std::forward<E>(e)), Scale{factor});
+}
+
+template <Expression E>
+auto operator*(E&& e, double factor) {
+    return factor * std::forward<E>(e);
+}
+
+// f applied to every element, f(double) -> double
+template <Expression E, class F>
+auto Map(E&& e, F f) {
+    return Unary<Stored<E>, F>(Store(std::forward<E>(e)), std::move(f));
+}
+
+template <Expression E>
+auto Abs(E&& e) {
+    return Map(std::forward<E>(e), [](double x) { return std::abs(x); });
+}
+
+template <Expression E>
+auto Sqrt(E&& e) {
+    return Map(std::forward<E>(e), [](double x) { return std::sqrt(x); });
+}
+
+/*
+ * out[index] = e.At(index) for the elements of rows [from, to), a block of rows at a time so that
+ * products in e are written to out while their rows are in cache.
+ */
+template <class E>
+void EvaluateRows(E& e, std::size_t from, std::size_t to, double* out) {
+    const std::size_t cols = e.Cols();
+    const std::size_t blockRows = std::max<std::size_t>(1, BLOCK_ELEMENTS / std::max<std::size_t>(cols, 1));
+    for (std::size_t begin = from; begin < to; begin += blockRows) {
+        const std::size_t end = std::min(to, begin + blockRows);
+        e.ComputeRows(begin, end);
+#pragma GCC ivdep
+        for (std::size_t index = begin * cols; index < end * cols; ++index) {
+            out[index] = e.At(index);
+        }
+    }
+}
+
+/*
+ * out = e: the task graph of e first, then the final pass in chunks of rows over the shared pool,
+ * each chunk with its own copy of the tree. out may be a leaf of e: each element is read before
+ * it is written, and a product whose rows depend on others copies such a leaf in Schedule.
+ */
+template <class E>
+void Evaluate(const E& e, double* out) {
+    TaskGraph graph;
+    std::vector<std::size_t> live;
+    e.Schedule(graph, out, live);
+    graph.RunAll(live);
+    const std::size_t minRows = std::max<std::size_t>(1, PARALLEL_WORK / std::max<std::size_t>(e.Cols(), 1));
+    utils::ParallelFor(0, e.Rows(), [&](std::size_t from, std::size_t to) {
+        auto chunk = e;
+        chunk.Bind(graph);
+        EvaluateRows(chunk, from, to, out);
+    }, minRows);
+}
+
+struct Matrix : ExpressionTag {
+    static constexpr bool IS_LEAF = true;
+    static constexpr std::size_t ROWS = DYNAMIC;
+    static constexpr std::size_t COLS = DYNAMIC;
+
     Matrix() = default;
 
-    template <class T, class U, class Op>
-    Matrix(Node<T, U, Op> node) : m(node.Rows(), std::vector<double>(node.Cols())) {
-        *this += node;
+    Matrix(std::size_t rows, std::size_t cols, double value = 0)
+        : rows(rows)
+        , cols(cols)
+        , data(rows * cols, value)
+    {
+    }
+
+    template <Expression E>
+        requires (!std::remove_cvref_t<E>::IS_LEAF)
+    Matrix(const E& e)
+        : Matrix(e.Rows(), e.Cols())
+    {
+        Evaluate(e, data.data());
     }
 
     Matrix(const Matrix& rhs) = delete;
@@ -31,60 +544,428 @@ struct Matrix {
     Matrix(Matrix&& rhs) = default;
     Matrix& operator=(Matrix&& rhs) = default;
 
+    // A new shape is evaluated into a new matrix, e may still read this one
+    template <Expression E>
+        requires (!std::remove_cvref_t<E>::IS_LEAF)
+    Matrix& operator=(const E& e) {
+        if (e.Rows() != rows || e.Cols() != cols) {
+            return *this = Matrix(e);
+        }
+        Evaluate(e, data.data());
+        return *this;
+    }
+
+    template <Expression E>
+    Matrix& operator+=(E&& e) {
+        Evaluate(*this + std::forward<E>(e), data.data());
+        return *this;
+    }
+
+    template <Expression E>
+    Matrix& operator-=(E&& e) {
+        Evaluate(*this - std::forward<E>(e), data.data());
+        return *this;
+    }
+
     std::size_t Rows() const {
-        return m.size();
+        return rows;
     }
 
     std::size_t Cols() const {
-        if (m.empty()) {
-            return 0;
+        return cols;
+    }
+
+    double At(std::size_t index) const {
+        return data[index];
+    }
+
+    const double* Data() const {
+        return data.data();
+    }
+
+    double& operator()(std::size_t i, std::size_t j) {
+        return data[i * cols + j];
+    }
+
+    double operator()(std::size_t i, std::size_t j) const {
+        return data[i * cols + j];
+    }
+
+    std::size_t rows = 0;
+    std::size_t cols = 0;
+    std::vector<double> data;
+};
+
+// Shape fixed at compile time, assigning an expression of another static shape does not compile
+template <std::size_t R, std::size_t C>
+struct StaticMatrix : ExpressionTag {
+    static_assert(R != DYNAMIC && C != DYNAMIC);
+
+    static constexpr bool IS_LEAF = true;
+    static constexpr std::size_t ROWS = R;
+    static constexpr std::size_t COLS = C;
+
+    StaticMatrix() = default;
+
+    template <Expression E>
+        requires (!std::remove_cvref_t<E>::IS_LEAF)
+    StaticMatrix(const E& e) {
+        *this = e;
+    }
+
+    template <Expression E>
+        requires (!std::remove_cvref_t<E>::IS_LEAF)
+    StaticMatrix& operator=(const E& e) {
+        static_assert(SAME_ROWS<StaticMatrix, E> && SAME_COLS<StaticMatrix, E>, "Expression has another shape");
+        assert(e.Rows() == R && e.Cols() == C);
+        Evaluate(e, data.data());
+        return *this;
+    }
+
+    std::size_t Rows() const {
+        return R;
+    }
+
+    std::size_t Cols() const {
+        return C;
+    }
+
+    double At(std::size_t index) const {
+        return data[index];
+    }
+
+    const double* Data() const {
+        return data.data();
+    }
+
+    double& operator()(std::size_t i, std::size_t j) {
+        return data[i * C + j];
+    }
+
+    double operator()(std::size_t i, std::size_t j) const {
+        return data[i * C + j];
+    }
+
+    std::array<double, R * C> data{};
+};
+
+void MultiplyTo(const Matrix& lhs, const Matrix& rhs, Matrix& out) {
+    out = Matrix(lhs.Rows(), rhs.Cols());
+    MultiplyRows({lhs.Data(), lhs.Rows(), lhs.Cols()}, {rhs.Data(), rhs.Rows(), rhs.Cols()}, 0, lhs.Rows(),
+        out.data.data());
+}
+
+/*
+ * Cheapest parenthesization of a chain of n matrices, factor i being dims[i] x dims[i + 1]:
+ * the classic O(n^3) dynamic program over the multiply-adds of every sub-chain.
+ */
+struct ChainOrder {
+    explicit ChainOrder(const std::vector<std::size_t>& dims)
+        : n(dims.size() - 1)
+        , split(n * n)
+    {
+        std::vector<double> cost(n * n);
+        for (std::size_t length = 2; length <= n; ++length) {
+            for (std::size_t i = 0; i + length <= n; ++i) {
+                const std::size_t j = i + length - 1;
+                cost[i * n + j] = std::numeric_limits<double>::infinity();
+                for (std::size_t k = i; k < j; ++k) {
+                    const double c = cost[i * n + k] + cost[(k + 1) * n + j]
+                        + static_cast<double>(dims[i]) * dims[k + 1] * dims[j + 1];
+                    if (c < cost[i * n + j]) {
+                        cost[i * n + j] = c;
+                        split[i * n + j] = k;
+                    }
+                }
+            }
         }
-        return m[0].size();
+        multiplyAdds = cost[n - 1];
+    }
+
+    // Factors [i, k] and [k + 1, j] are multiplied last in the sub-chain [i, j]
+    std::size_t Split(std::size_t i, std::size_t j) const {
+        return split[i * n + j];
     }
 
-    std::vector<std::vector<double>> m;
+    std::size_t n;
+    std::vector<std::size_t> split;
+    double multiplyAdds = 0;
 };
 
-Matrix& operator+=(Matrix& lhs, const Matrix& rhs) {
-    for (std::size_t i = 0; i < lhs.m.size(); ++i) {
-        for (std::size_t j = 0; j < lhs.m[0].size(); ++j) {
-            lhs.m[i][j] += rhs.m[i][j];
+// Multiply-adds of multiplying from left to right
+double LeftToRightMultiplyAdds(const std::vector<std::size_t>& dims) {
+    double result = 0;
+    for (std::size_t k = 2; k < dims.size(); ++k) {
+        result += static_cast<double>(dims[0]) * dims[k - 1] * dims[k];
+    }
+    return result;
+}
+
+template <class... F>
+constexpr bool ChainMatches() {
+    constexpr std::array<std::size_t, sizeof...(F)> rows{F::ROWS...};
+    constexpr std::array<std::size_t, sizeof...(F)> cols{F::COLS...};
+    for (std::size_t i = 1; i < sizeof...(F); ++i) {
+        if (rows[i] != DYNAMIC && cols[i - 1] != DYNAMIC && rows[i] != cols[i - 1]) {
+            return false;
         }
     }
-    return lhs;
+    return true;
 }
 
-template <class T, class U>
-void MultiplyTo(const Matrix& lhs, const Matrix& rhs, Matrix& out) {
-    out.m = std::vector<std::vector<double>>(lhs.Rows(), std::vector<double>(rhs.Cols()));
-    for (int i = 0; i < out.Rows(); ++i) {
-        for (int j = 0; j < out.Cols(); ++j) {
-            for (int k = 0; k < lhs.Cols(); ++k) {
-                out.m[i][j] += k;
-            }
+template <class E>
+struct IsRef : std::false_type {};
+
+template <class M>
+struct IsRef<Ref<M>> : std::true_type {};
+
+/*
+ * f0 * f1 * ... * fn. Schedule() adds a task for every product of the cheapest order but the last
+ * and for every factor that is not a leaf; ComputeRows() computes rows of the last product into
+ * a block that At() reads.
+ */
+template <class... F>
+struct Product : ExpressionTag {
+    static_assert(sizeof...(F) >= 2);
+    static_assert(ChainMatches<F...>(), "Inner dimensions of a product differ");
+
+    static constexpr bool IS_LEAF = false;
+    static constexpr std::size_t ROWS = std::tuple_element_t<0, std::tuple<F...>>::ROWS;
+    static constexpr std::size_t COLS = std::tuple_element_t<sizeof...(F) - 1, std::tuple<F...>>::COLS;
+
+    explicit Product(std::tuple<F...> factors)
+        : factors(std::move(factors))
+    {
+        [[maybe_unused]] std::size_t inner = Rows();
+        std::apply([&](const auto&... f) { ((assert(f.Rows() == inner), inner = f.Cols()), ...); }, this->factors);
+    }
+
+    std::size_t Rows() const {
+        return std::get<0>(factors).Rows();
+    }
+
+    std::size_t Cols() const {
+        return std::get<sizeof...(F) - 1>(factors).Cols();
+    }
+
+    // Rows of every factor and cols of the last one
+    std::vector<std::size_t> Dims() const {
+        std::vector<std::size_t> dims;
+        std::apply([&](const auto&... f) { (dims.push_back(f.Rows()), ...); }, factors);
+        dims.push_back(Cols());
+        return dims;
+    }
+
+    double At(std::size_t index) const {
+        return block[index - offset];
+    }
+
+    void Schedule(TaskGraph& graph, const double* out, std::vector<std::size_t>& live) const {
+        std::vector<std::size_t> leaves;
+        std::apply([&](const auto&... f) { (leaves.push_back(ScheduleFactor(graph, f)), ...); }, factors);
+        const ChainOrder order(Dims());
+        const std::size_t k = order.Split(0, sizeof...(F) - 1);
+        lhsValue = ScheduleChain(graph, order, leaves, 0, k);
+        rhsValue = ScheduleChain(graph, order, leaves, k + 1, sizeof...(F) - 1);
+        // Every row of out needs all of rhs, which out must not overwrite
+        if (out && graph.Leaf(rhsValue) == out) {
+            const std::size_t rows = graph.Rows(rhsValue);
+            const std::size_t cols = graph.Cols(rhsValue);
+            rhsValue = graph.AddTask(rows, cols, {rhsValue}, rows * cols,
+                [value = rhsValue](const TaskGraph& graph, double* out, std::size_t from, std::size_t to) {
+                    const Factor source = graph.Get(value);
+                    std::copy(source.data + from * source.cols, source.data + to * source.cols, out + from * source.cols);
+                });
+        }
+        live.push_back(lhsValue);
+        live.push_back(rhsValue);
+    }
+
+    void Bind(const TaskGraph& graph) {
+        lhs = graph.Get(lhsValue);
+        rhs = graph.Get(rhsValue);
+    }
+
+    void ComputeRows(std::size_t from, std::size_t to) {
+        block.resize((to - from) * rhs.cols);
+        MultiplyRows(lhs, rhs, from, to, block.data());
+        offset = from * rhs.cols;
+    }
+
+    std::tuple<F...> factors;
+
+    mutable std::size_t lhsValue = 0;
+    mutable std::size_t rhsValue = 0;
+    Factor lhs{};
+    Factor rhs{};
+    std::vector<double> block;
+    std::size_t offset = 0;
+
+private:
+    // Leaves are used in place, other operands are evaluated into a value first
+    template <class E>
+    static std::size_t ScheduleFactor(TaskGraph& graph, const E& e) {
+        if constexpr (IsRef<E>::value) {
+            return graph.AddLeaf(e.Data(), e.Rows(), e.Cols());
+        } else {
+            std::vector<std::size_t> inputs;
+            e.Schedule(graph, nullptr, inputs);
+            return graph.AddTask(e.Rows(), e.Cols(), std::move(inputs), e.Rows() * e.Cols(),
+                [e](const TaskGraph& graph, double* out, std::size_t from, std::size_t to) {
+                    auto rows = e;
+                    rows.Bind(graph);
+                    EvaluateRows(rows, from, to, out);
+                });
+        }
+    }
+
+    static std::size_t ScheduleChain(TaskGraph& graph, const ChainOrder& order, const std::vector<std::size_t>& leaves,
+        std::size_t i, std::size_t j)
+    {
+        if (i == j) {
+            return leaves[i];
         }
+        const std::size_t k = order.Split(i, j);
+        const std::size_t left = ScheduleChain(graph, order, leaves, i, k);
+        const std::size_t right = ScheduleChain(graph, order, leaves, k + 1, j);
+        const std::size_t rows = graph.Rows(left);
+        const std::size_t cols = graph.Cols(right);
+        return graph.AddTask(rows, cols, {left, right}, rows * graph.Cols(left) * cols,
+            [left, right](const TaskGraph& graph, double* out, std::size_t from, std::size_t to) {
+                const Factor r = graph.Get(right);
+                MultiplyRows(graph.Get(left), r, from, to, out + from * r.cols);
+            });
     }
+};
+
+// Factors of an operand, the factors of a product are spliced into the chain
+template <Expression E>
+auto Factors(E&& e) {
+    using T = std::remove_cvref_t<E>;
+    if constexpr (requires { std::get<0>(e.factors); }) {
+        return T(std::forward<E>(e)).factors;
+    } else {
+        return std::tuple<Stored<E>>(Store(std::forward<E>(e)));
+    }
+}
+
+template <class... F>
+auto MakeProduct(std::tuple<F...> factors) {
+    return Product<F...>(std::move(factors));
+}
+
+template <Expression L, Expression R>
+auto operator*(L&& lhs, R&& rhs) {
+    return MakeProduct(std::tuple_cat(Factors(std::forward<L>(lhs)), Factors(std::forward<R>(rhs))));
 }
 
-template <class T, class U, class Op>
-Matrix& operator+=(Matrix& lhs, const Node<T, U, Op>& rhs) {
-    if constexpr (std::is_same_v<Op, Addition>) {
-        lhs += rhs.lhs;
-        lhs += rhs.rhs;
-    } else if constexpr (std::is_same_v<Op, Multiplication>) {
-        // not necessary
-//        MultiplyTo(lhs, )
+// Small integers, so products are exact in any order
+Matrix Integers(std::size_t rows, std::size_t cols, std::size_t seed) {
+    Matrix m(rows, cols);
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t j = 0; j < cols; ++j) {
+            m(i, j) = static_cast<double>((i * 7 + j * 3 + seed) % 5) - 2;
+        }
     }
-    return lhs;
+    return m;
 }
 
-template <class T, class U>
-auto operator+(T&& lhs, U&& rhs) {
-    return Node<T, U, Addition>{lhs, rhs};
+template <class F>
+double Milliseconds(F&& f) {
+    const auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
 }
 
 int main() {
-    Matrix a, b, c;
-    Matrix d = a + b + c;
-    std::cout << d.m.size() << std::endl;
+    Matrix a(2, 3, 1);
+    Matrix b(2, 3, 2);
+    Matrix c(2, 3, 3);
+    a(1, 2) = -4;
+    Matrix d = a + b - 2 * c;
+    d += Abs(-a);
+    assert(d(0, 0) == 1 + 2 - 6 + 1);
+    assert(d(1, 2) == -4 + 2 - 6 + 4);
+
+    StaticMatrix<2, 2> s;
+    s(0, 1) = 4;
+    StaticMatrix<2, 2> t = Sqrt(s) + s * 0.5;
+    assert(t(0, 1) == 4);
+    // StaticMatrix<2, 3> u = s + t; does not compile
+
+    const auto p = Integers(3, 5, 1);
+    const auto q = Integers(5, 4, 2);
+    const auto r = Integers(4, 2, 3);
+    Matrix pq;
+    Matrix pqr;
+    MultiplyTo(p, q, pq);
+    MultiplyTo(pq, r, pqr);
+    const auto e = Integers(3, 2, 4);
+    Matrix chain = p * (q * r) - 2 * e;
+    Matrix expected = pqr - 2 * e;
+    assert(chain.data == expected.data);
+    // The product is computed block by block into q, which it reads whole
+    auto square = Integers(5, 5, 5);
+    Matrix squared;
+    MultiplyTo(square, square, squared);
+    square = square * square;
+    assert(square.data == squared.data);
+
+    // One pass of the fused tree against one pass and one temporary per operation
+    const std::size_t size = 2048;
+    Matrix x(size, size, 1);
+    Matrix y(size, size, 2);
+    Matrix z(size, size, 3);
+    Matrix fused;
+    Matrix eager;
+    const double fusedMs = Milliseconds([&]() { fused = x + y - 2 * z + 0.5 * x; });
+    const double eagerMs = Milliseconds([&]() {
+        Matrix sum = x + y;
+        Matrix scaled = 2 * z;
+        Matrix difference = sum - scaled;
+        Matrix half = 0.5 * x;
+        eager = difference + half;
+    });
+    assert(fused.data == eager.data);
+    std::cout << size << "x" << size << ": fused " << fusedMs << " ms, one pass per operation " << eagerMs << " ms"
+        << std::endl;
+
+    // Independent products and an operand that is not a leaf are tasks of one graph
+    Matrix qr;
+    MultiplyTo(q, r, qr);
+    Matrix pe = p + 2 * p;
+    Matrix peqr;
+    MultiplyTo(pe, qr, peqr);
+    Matrix sum = (p + 2 * p) * q * r + p * (q * r);
+    expected = peqr + pqr;
+    assert(sum.data == expected.data);
+
+    const auto f = Integers(1024, 1024, 1);
+    const auto g = Integers(1024, 1024, 2);
+    const auto h = Integers(1024, 1024, 3);
+    Matrix products;
+    const double productsMs = Milliseconds([&]() { products = f * g * h + h * g * f; });
+    std::cout << "f * g * h + h * g * f, 1024x1024 on " << utils::NumThreads() << " threads: " << productsMs << " ms"
+        << std::endl;
+
+    // A rectangular chain: left to right builds a 2000 x 2000 intermediate, the best order a 20 x 20 one
+    const auto u = Integers(2000, 20, 1);
+    const auto v = Integers(20, 2000, 2);
+    const auto w = Integers(2000, 20, 3);
+    const auto bias = Integers(2000, 20, 4);
+    Matrix ordered;
+    Matrix leftToRight;
+    const double orderedMs = Milliseconds([&]() { ordered = 2 * (u * v * w) + bias; });
+    const double leftToRightMs = Milliseconds([&]() {
+        Matrix uv;
+        Matrix uvw;
+        MultiplyTo(u, v, uv);
+        MultiplyTo(uv, w, uvw);
+        leftToRight = 2 * uvw + bias;
+    });
+    assert(ordered.data == leftToRight.data);
+    const std::vector<std::size_t> dims{2000, 20, 2000, 20};
+    std::cout << "2 * (u * v * w) + bias: " << ChainOrder(dims).multiplyAdds << " multiply-adds, " << orderedMs
+        << " ms, left to right " << LeftToRightMultiplyAdds(dims) << " multiply-adds, " << leftToRightMs << " ms"
+        << std::endl;
 }
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "aligned.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <utility>
+
+namespace utils {
+
+/*
+ * Field is a 2D grid stored row-major in one 64-byte aligned buffer.
+ * Rows are padded to whole cache lines, so every row starts aligned.
+ */
+template <class T>
+class Field {
+public:
+    Field() = default;
+
+    Field(std::size_t rows, std::size_t cols, T value = T())
+        : rows_(rows)
+        , cols_(cols)
+        , stride_(Padded(cols))
+        , data_(rows * stride_, value)
+    {}
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    std::size_t Stride() const {
+        return stride_;
+    }
+
+    T* Row(std::size_t i) {
+        return data_.data() + i * stride_;
+    }
+
+    const T* Row(std::size_t i) const {
+        return data_.data() + i * stride_;
+    }
+
+    T& operator()(std::size_t i, std::size_t j) {
+        return data_[i * stride_ + j];
+    }
+
+    const T& operator()(std::size_t i, std::size_t j) const {
+        return data_[i * stride_ + j];
+    }
+
+    void Fill(T value) {
+        std::fill(data_.begin(), data_.end(), value);
+    }
+
+    T Sum() const {
+        T sum = T();
+        for (std::size_t i = 0; i < rows_; ++i) {
+            const auto row = Row(i);
+            for (std::size_t j = 0; j < cols_; ++j) {
+                sum += row[j];
+            }
+        }
+        return sum;
+    }
+
+    friend void swap(Field& lhs, Field& rhs) noexcept {
+        std::swap(lhs.rows_, rhs.rows_);
+        std::swap(lhs.cols_, rhs.cols_);
+        std::swap(lhs.stride_, rhs.stride_);
+        lhs.data_.swap(rhs.data_);
+    }
+
+private:
+    static std::size_t Padded(std::size_t cols) {
+        constexpr std::size_t lanes = std::max<std::size_t>(1, 64 / sizeof(T));
+        return (cols + lanes - 1) / lanes * lanes;
+    }
+
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::size_t stride_ = 0;
+    AlignedVector<T> data_;
+};
+
+// Bilinear interpolation, (x, y) is in cells: column and row
+template <class TField>
+float Sample(const TField& field, float x, float y) {
+    x = std::clamp(x, 0.f, field.Cols() - 1.f);
+    y = std::clamp(y, 0.f, field.Rows() - 1.f);
+    const std::size_t x0 = std::min<std::size_t>(x, field.Cols() - 2);
+    const std::size_t y0 = std::min<std::size_t>(y, field.Rows() - 2);
+    const float wx = x - x0;
+    const float wy = y - y0;
+    return (1 - wy) * ((1 - wx) * field(y0, x0) + wx * field(y0, x0 + 1))
+        + wy * ((1 - wx) * field(y0 + 1, x0) + wx * field(y0 + 1, x0 + 1));
+}
+
+}  // namespace utils
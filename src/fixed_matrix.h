@@ -0,0 +1,232 @@
+#pragma once
+
+#include "aligned.h"
+#include "matrix_view.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <ostream>
+
+/*
+ * A small matrix with the shape in the type: the elements live inline and every loop has constant bounds,
+ * so products are fully unrolled and vectorized along the rows of the result.
+ */
+template <std::size_t RowsCount, std::size_t ColsCount>
+class FixedMatrix {
+public:
+    static constexpr std::size_t ROWS = RowsCount;
+    static constexpr std::size_t COLS = ColsCount;
+
+    constexpr FixedMatrix() = default;
+
+    constexpr FixedMatrix(std::initializer_list<std::initializer_list<float>> list) {
+        assert(list.size() == ROWS);
+        std::size_t i = 0;
+        for (const auto& row : list) {
+            assert(row.size() == COLS);
+            std::size_t j = 0;
+            for (float value : row) {
+                (*this)(i, j++) = value;
+            }
+            ++i;
+        }
+    }
+
+    static constexpr FixedMatrix Identity() {
+        static_assert(ROWS == COLS);
+        FixedMatrix m;
+        for (std::size_t i = 0; i < ROWS; ++i) {
+            m(i, i) = 1;
+        }
+        return m;
+    }
+
+    static constexpr std::size_t Rows() {
+        return ROWS;
+    }
+
+    static constexpr std::size_t Cols() {
+        return COLS;
+    }
+
+    MatrixView<float> View() {
+        return {data_.data(), ROWS, COLS, COLS};
+    }
+
+    MatrixView<const float> View() const {
+        return {data_.data(), ROWS, COLS, COLS};
+    }
+
+    constexpr FixedMatrix<COLS, ROWS> Transposed() const {
+        FixedMatrix<COLS, ROWS> out;
+        for (std::size_t i = 0; i < ROWS; ++i) {
+            for (std::size_t j = 0; j < COLS; ++j) {
+                out(j, i) = (*this)(i, j);
+            }
+        }
+        return out;
+    }
+
+    // Row i of the result is the sum of the rows of other weighted by row i of this
+    template <std::size_t OtherCols>
+    constexpr FixedMatrix<ROWS, OtherCols> operator*(const FixedMatrix<COLS, OtherCols>& other) const {
+        FixedMatrix<ROWS, OtherCols> out;
+#pragma GCC unroll 16
+        for (std::size_t i = 0; i < ROWS; ++i) {
+#pragma GCC unroll 16
+            for (std::size_t k = 0; k < COLS; ++k) {
+                const float a = (*this)(i, k);
+#pragma GCC unroll 16
+                for (std::size_t j = 0; j < OtherCols; ++j) {
+                    out(i, j) += a * other(k, j);
+                }
+            }
+        }
+        return out;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const FixedMatrix& m) {
+        for (std::size_t i = 0; i < ROWS; ++i) {
+            for (std::size_t j = 0; j + 1 < COLS; ++j) {
+                os << m(i, j) << ' ';
+            }
+            os << m(i, COLS - 1) << '\n';
+        }
+        return os;
+    }
+
+    bool operator==(const FixedMatrix& rhs) const {
+        return Near(View(), rhs.View());
+    }
+
+    constexpr float& operator()(std::size_t i, std::size_t j) {
+        return data_[i * COLS + j];
+    }
+
+    constexpr float operator()(std::size_t i, std::size_t j) const {
+        return data_[i * COLS + j];
+    }
+
+private:
+    alignas(16) std::array<float, ROWS * COLS> data_{};
+};
+
+/*
+ * Many matrices of one shape, interleaved so that one matrix sits in each SIMD lane. Matrices are grouped
+ * in blocks of LANES; inside a block element (i, j) of all of them is contiguous, block after block
+ * (an array of structs of arrays). A product then streams one block at a time, instead of
+ * ROWS * COLS separate arrays, and keeps its accumulators in registers.
+ */
+template <std::size_t RowsCount, std::size_t ColsCount>
+class MatrixBatch {
+public:
+    static constexpr std::size_t ROWS = RowsCount;
+    static constexpr std::size_t COLS = ColsCount;
+    // Matrices per block, a cache line of floats
+    static constexpr std::size_t LANES = 64 / sizeof(float);
+    static constexpr std::size_t BLOCK = ROWS * COLS * LANES;
+
+    explicit MatrixBatch(std::size_t size = 0)
+        : size_(size)
+        , data_((size + LANES - 1) / LANES * BLOCK)
+    {
+    }
+
+    std::size_t Size() const {
+        return size_;
+    }
+
+    // Blocks of LANES matrices, the last one is zero padded
+    std::size_t Blocks() const {
+        return data_.size() / BLOCK;
+    }
+
+    FixedMatrix<ROWS, COLS> Get(std::size_t index) const {
+        FixedMatrix<ROWS, COLS> m;
+        for (std::size_t i = 0; i < ROWS; ++i) {
+            for (std::size_t j = 0; j < COLS; ++j) {
+                m(i, j) = (*this)(index, i, j);
+            }
+        }
+        return m;
+    }
+
+    void Set(std::size_t index, const FixedMatrix<ROWS, COLS>& m) {
+        for (std::size_t i = 0; i < ROWS; ++i) {
+            for (std::size_t j = 0; j < COLS; ++j) {
+                (*this)(index, i, j) = m(i, j);
+            }
+        }
+    }
+
+    // The LANES values of element (i, j) in a block
+    float* Lanes(std::size_t block, std::size_t i, std::size_t j) {
+        return data_.data() + block * BLOCK + (i * COLS + j) * LANES;
+    }
+
+    const float* Lanes(std::size_t block, std::size_t i, std::size_t j) const {
+        return data_.data() + block * BLOCK + (i * COLS + j) * LANES;
+    }
+
+    float& operator()(std::size_t index, std::size_t i, std::size_t j) {
+        return Lanes(index / LANES, i, j)[index % LANES];
+    }
+
+    float operator()(std::size_t index, std::size_t i, std::size_t j) const {
+        return Lanes(index / LANES, i, j)[index % LANES];
+    }
+
+private:
+    std::size_t size_;
+    utils::AlignedVector<float> data_;
+};
+
+// Columns [From, From + 4) of row i of a result block, then the next ones
+template <std::size_t From, std::size_t Rows, std::size_t Depth, std::size_t Cols>
+void MultiplyBatchColumns(const MatrixBatch<Rows, Depth>& lhs, const MatrixBatch<Depth, Cols>& rhs, MatrixBatch<Rows, Cols>& out,
+    std::size_t block, std::size_t i)
+{
+    constexpr std::size_t LANES = MatrixBatch<Rows, Cols>::LANES;
+    // 4 x 16 accumulators fill 16 xmm, 8 ymm or 4 zmm registers
+    constexpr std::size_t COUNT = Cols - From < 4 ? Cols - From : 4;
+    float acc[COUNT][LANES] = {};
+#pragma GCC unroll 16
+    for (std::size_t k = 0; k < Depth; ++k) {
+        const float* a = lhs.Lanes(block, i, k);
+#pragma GCC unroll 4
+        for (std::size_t j = 0; j < COUNT; ++j) {
+            const float* b = rhs.Lanes(block, k, From + j);
+#pragma GCC unroll 16
+            for (std::size_t lane = 0; lane < LANES; ++lane) {
+                acc[j][lane] += a[lane] * b[lane];
+            }
+        }
+    }
+#pragma GCC unroll 4
+    for (std::size_t j = 0; j < COUNT; ++j) {
+        float* c = out.Lanes(block, i, From + j);
+#pragma GCC unroll 16
+        for (std::size_t lane = 0; lane < LANES; ++lane) {
+            c[lane] = acc[j][lane];
+        }
+    }
+    if constexpr (From + COUNT < Cols) {
+        MultiplyBatchColumns<From + COUNT>(lhs, rhs, out, block, i);
+    }
+}
+
+/*
+ * out[b] = lhs[b] * rhs[b] for every matrix of the batches, LANES products at a time.
+ * A few columns of a result row stay in registers while the depth is summed.
+ */
+template <std::size_t Rows, std::size_t Depth, std::size_t Cols>
+void Multiply(const MatrixBatch<Rows, Depth>& lhs, const MatrixBatch<Depth, Cols>& rhs, MatrixBatch<Rows, Cols>& out) {
+    assert(lhs.Size() == rhs.Size() && lhs.Size() == out.Size());
+    for (std::size_t block = 0; block < out.Blocks(); ++block) {
+        for (std::size_t i = 0; i < Rows; ++i) {
+            MultiplyBatchColumns<0>(lhs, rhs, out, block, i);
+        }
+    }
+}
@@ -0,0 +1,225 @@
+#include "flip.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace fluid {
+
+namespace {
+
+// Chunk of particles per task
+constexpr std::size_t CHUNK = 1024;
+// Band of grid rows per task
+constexpr std::size_t ROWS_CHUNK = 8;
+// Particles stay this part of a cell away from the walls
+constexpr float WALL_MARGIN = 0.25;
+// Fastest particle crosses one cell per step
+constexpr float MAX_COURANT = 1;
+// Part of the excess volume an overfull cell pushes out per step, FLIP slowly loses volume without it
+constexpr float DRIFT_CORRECTION = 0.1;
+
+}  // namespace
+
+FlipSolver::FlipSolver(float cellSize, sf::FloatRect bounds)
+    : ds_(cellSize)
+    , bounds_(bounds)
+{
+    const std::size_t rows = std::max(2.f, std::floor(bounds.height / ds_));
+    const std::size_t cols = std::max(2.f, std::floor(bounds.width / ds_));
+    bounds_.width = cols * ds_;
+    bounds_.height = rows * ds_;
+
+    u_ = Field<float>(rows, cols + 1);
+    v_ = Field<float>(rows + 1, cols);
+    uOld_ = u_;
+    vOld_ = v_;
+    pressure_ = Field<float>(rows, cols);
+    divergence_ = Field<float>(rows, cols);
+    fluid_ = Field<std::uint8_t>(rows, cols);
+    solver_ = PoissonSolver(rows, cols);
+}
+
+void FlipSolver::Step() {
+    const auto count = particles.Size();
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            particles.vy[i] += gravity;
+        }
+    }, CHUNK);
+
+    if (step_++ % SORT_INTERVAL == 0) {
+        SortParticles();
+    }
+    cells_.Build(particles.x.data(), particles.y.data(), count, ds_, bounds_);
+    if (restDensity_ == 0) {
+        std::size_t fluidCells = 0;
+        for (std::size_t i = 0; i < cells_.Rows(); ++i) {
+            for (std::size_t j = 0; j < cells_.Cols(); ++j) {
+                fluidCells += !cells_.Cell(i, j).empty();
+            }
+        }
+        restDensity_ = static_cast<float>(count) / std::max<std::size_t>(fluidCells, 1);
+    }
+    ParticlesToGrid();
+    Project();
+    GridToParticles();
+    Advect();
+}
+
+// Neighbouring particles become neighbours in memory, which keeps the transfers cache friendly
+void FlipSolver::SortParticles() {
+    const auto count = particles.Size();
+    cells_.Build(particles.x.data(), particles.y.data(), count, ds_, bounds_);
+    const auto order = cells_.Indices();
+    sorted_.x.resize(count);
+    sorted_.y.resize(count);
+    sorted_.vx.resize(count);
+    sorted_.vy.resize(count);
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t k = from; k < to; ++k) {
+            const auto i = order[k];
+            sorted_.x[k] = particles.x[i];
+            sorted_.y[k] = particles.y[i];
+            sorted_.vx[k] = particles.vx[i];
+            sorted_.vy[k] = particles.vy[i];
+        }
+    }, CHUNK);
+    std::swap(particles, sorted_);
+}
+
+float FlipSolver::Gather(float x, float y, const std::vector<float>& velocities) const {
+    // Cells overlapping (x - 1, x + 1) x (y - 1, y + 1)
+    const int colBegin = std::max(0, static_cast<int>(std::floor(x - 1)));
+    const int colEnd = std::min<int>(cells_.Cols(), std::ceil(x + 1));
+    const int rowBegin = std::max(0, static_cast<int>(std::floor(y - 1)));
+    const int rowEnd = std::min<int>(cells_.Rows(), std::ceil(y + 1));
+    const float invDs = 1 / ds_;
+
+    float sum = 0;
+    float weights = 0;
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        for (int col = colBegin; col < colEnd; ++col) {
+            for (auto i : cells_.Cell(row, col)) {
+                const float dx = std::abs((particles.x[i] - bounds_.left) * invDs - x);
+                const float dy = std::abs((particles.y[i] - bounds_.top) * invDs - y);
+                const float weight = std::max(0.f, 1 - dx) * std::max(0.f, 1 - dy);
+                sum += weight * velocities[i];
+                weights += weight;
+            }
+        }
+    }
+    return weights > 0 ? sum / weights : 0;
+}
+
+// Every face gathers from the particles around it, faces on the walls stay zero
+void FlipSolver::ParticlesToGrid() {
+    const std::size_t rows = pressure_.Rows();
+    const std::size_t cols = pressure_.Cols();
+    utils::ParallelFor(0, rows + 1, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            if (i < rows) {
+                for (std::size_t j = 1; j < cols; ++j) {
+                    u_(i, j) = Gather(j, i + 0.5f, particles.vx);
+                }
+                for (std::size_t j = 0; j < cols; ++j) {
+                    fluid_(i, j) = !cells_.Cell(i, j).empty();
+                }
+            }
+            if (i > 0 && i < rows) {
+                for (std::size_t j = 0; j < cols; ++j) {
+                    v_(i, j) = Gather(j + 0.5f, i, particles.vy);
+                }
+            }
+        }
+    }, ROWS_CHUNK);
+    uOld_ = u_;
+    vOld_ = v_;
+}
+
+/*
+ * Same discretization as WaterBottle, but the velocities live on the faces, so the projection is exact.
+ * Cells holding more particles than at rest get an outflow target proportional to the excess.
+ */
+void FlipSolver::Project() {
+    const std::size_t rows = pressure_.Rows();
+    const std::size_t cols = pressure_.Cols();
+    utils::ParallelFor(0, rows, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            for (std::size_t j = 0; j < cols; ++j) {
+                const float excess = std::max(cells_.Cell(i, j).size() / restDensity_ - 1, 0.f);
+                const float outflow = DRIFT_CORRECTION * ds_ * excess;
+                // A p = -ds^2 * div(v) / dt with dt = 1 update
+                divergence_(i, j) = -ds_ * (u_(i, j + 1) - u_(i, j) + v_(i + 1, j) - v_(i, j) - outflow);
+            }
+        }
+    }, ROWS_CHUNK);
+    solver_.Solve(pressure_, divergence_, &fluid_);
+
+    const float invDs = 1 / ds_;
+    utils::ParallelFor(0, rows + 1, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            if (i < rows) {
+                for (std::size_t j = 1; j < cols; ++j) {
+                    if (fluid_(i, j - 1) || fluid_(i, j)) {
+                        u_(i, j) -= (pressure_(i, j) - pressure_(i, j - 1)) * invDs;
+                    }
+                }
+            }
+            if (i > 0 && i < rows) {
+                for (std::size_t j = 0; j < cols; ++j) {
+                    if (fluid_(i - 1, j) || fluid_(i, j)) {
+                        v_(i, j) -= (pressure_(i, j) - pressure_(i - 1, j)) * invDs;
+                    }
+                }
+            }
+        }
+    }, ROWS_CHUNK);
+}
+
+void FlipSolver::GridToParticles() {
+    const float invDs = 1 / ds_;
+    utils::ParallelFor(0, particles.Size(), [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            const float x = (particles.x[i] - bounds_.left) * invDs;
+            const float y = (particles.y[i] - bounds_.top) * invDs;
+            const float u = utils::Sample(u_, x, y - 0.5f);
+            const float v = utils::Sample(v_, x - 0.5f, y);
+            const float flipU = particles.vx[i] + u - utils::Sample(uOld_, x, y - 0.5f);
+            const float flipV = particles.vy[i] + v - utils::Sample(vOld_, x - 0.5f, y);
+            particles.vx[i] = flipRatio * flipU + (1 - flipRatio) * u;
+            particles.vy[i] = flipRatio * flipV + (1 - flipRatio) * v;
+        }
+    }, CHUNK);
+}
+
+// A particle stopped by a wall loses the velocity towards it, the grid alone never removes it
+void FlipSolver::Advect() {
+    const float maxSpeed = MAX_COURANT * ds_;
+    const float margin = WALL_MARGIN * ds_;
+    const float left = bounds_.left + margin;
+    const float right = bounds_.left + bounds_.width - margin;
+    const float top = bounds_.top + margin;
+    const float bottom = bounds_.top + bounds_.height - margin;
+    utils::ParallelFor(0, particles.Size(), [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            auto& vx = particles.vx[i];
+            auto& vy = particles.vy[i];
+            vx = std::clamp(vx, -maxSpeed, maxSpeed);
+            vy = std::clamp(vy, -maxSpeed, maxSpeed);
+            const float x = particles.x[i] + vx;
+            const float y = particles.y[i] + vy;
+            if (x < left || x > right) {
+                vx = 0;
+            }
+            if (y < top || y > bottom) {
+                vy = 0;
+            }
+            particles.x[i] = std::clamp(x, left, right);
+            particles.y[i] = std::clamp(y, top, bottom);
+        }
+    }, CHUNK);
+}
+
+}  // namespace fluid
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "field.h"
+#include "fluid.h"
+#include "grid_collision.h"
+#include "poisson.h"
+
+#include <SFML/Graphics/Rect.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace fluid {
+
+/*
+ * FlipSolver is a PIC/FLIP hybrid: particles carry the fluid, a staggered grid enforces incompressibility.
+ * Particle velocities are transferred to the cell faces, the grid is projected with PoissonSolver
+ * (cells without particles are air) and every particle takes the change of the grid velocity (FLIP)
+ * blended with the grid velocity itself (PIC).
+ * Both transfers are gathers over bands of grid rows or over particles sorted by cell,
+ * so they run in parallel without atomics and read memory mostly in order.
+ */
+class FlipSolver {
+public:
+    FlipSolver(float cellSize, sf::FloatRect bounds);
+
+    void Step();
+
+    const SolveStats& LastStats() const {
+        return solver_.LastStats();
+    }
+
+    ParticleArrays particles;
+    float gravity = 0.5;
+    // 1 is pure FLIP, 0 is pure PIC
+    float flipRatio = 0.95;
+
+private:
+    // Particles are reordered by cell every SORT_INTERVAL steps
+    static constexpr std::size_t SORT_INTERVAL = 8;
+
+    void SortParticles();
+    void ParticlesToGrid();
+    void Project();
+    void GridToParticles();
+    void Advect();
+
+    // Average of the velocities of the particles around (x, y) weighted by the bilinear kernel, x and y are in cells
+    float Gather(float x, float y, const std::vector<float>& velocities) const;
+
+    float ds_;
+    sf::FloatRect bounds_;
+    std::size_t step_ = 0;
+    // Particles per fluid cell, taken from the initial state
+    float restDensity_ = 0;
+
+    // u on the vertical faces: rows x (cols + 1), v on the horizontal faces: (rows + 1) x cols
+    Field<float> u_;
+    Field<float> v_;
+    // Face velocities before the projection
+    Field<float> uOld_;
+    Field<float> vOld_;
+    Field<float> pressure_;
+    Field<float> divergence_;
+    Field<std::uint8_t> fluid_;
+    PoissonSolver solver_;
+
+    grid::CellGrid cells_;
+    ParticleArrays sorted_;
+};
+
+}  // namespace fluid
@@ -0,0 +1,240 @@
+#include "fluid.h"
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <numbers>
+
+namespace fluid {
+
+namespace {
+
+// Chunk of particles per task
+constexpr std::size_t CHUNK = 1024;
+// Relative to the gradient norm at rest, softens the constraint.
+// Jacobi iterations overshoot in a dense block without it
+constexpr float RELAXATION = 100;
+// Artificial pressure against clustering at the surface
+constexpr float CORRECTION_K = 0.001;
+constexpr float CORRECTION_DISTANCE = 0.2;
+// Fraction of the spacing a particle may move in one step
+constexpr float MAX_COURANT = 0.5;
+// XSPH viscosity
+constexpr float VISCOSITY = 0.01;
+
+}  // namespace
+
+ParticleFluid::ParticleFluid(float spacing, sf::FloatRect bounds)
+    : h_(2 * spacing)
+    , maxSpeed_(MAX_COURANT * spacing)
+    , bounds_(bounds.left + spacing / 2, bounds.top + spacing / 2, bounds.width - spacing, bounds.height - spacing)
+{
+    // Rest state is a square lattice with the given spacing
+    const int reach = std::ceil(h_ / spacing);
+    restDensity_ = 0;
+    float gradientSquares = 0;
+    for (int dx = -reach; dx <= reach; ++dx) {
+        for (int dy = -reach; dy <= reach; ++dy) {
+            const float distance = std::hypot(dx * spacing, dy * spacing);
+            restDensity_ += Poly6(distance * distance);
+            gradientSquares += SpikyGradient(distance) * SpikyGradient(distance);
+        }
+    }
+    relaxation_ = RELAXATION * gradientSquares / (restDensity_ * restDensity_);
+    correctionNorm_ = Poly6(CORRECTION_DISTANCE * CORRECTION_DISTANCE * h_ * h_);
+}
+
+float ParticleFluid::Poly6(float squareDistance) const {
+    const float h2 = h_ * h_;
+    if (squareDistance >= h2) {
+        return 0;
+    }
+    const float diff = h2 - squareDistance;
+    return 4 / (std::numbers::pi_v<float> * std::pow(h_, 8.f)) * diff * diff * diff;
+}
+
+float ParticleFluid::SpikyGradient(float distance) const {
+    if (distance >= h_ || distance <= 0) {
+        return 0;
+    }
+    const float diff = h_ - distance;
+    return -30 / (std::numbers::pi_v<float> * std::pow(h_, 5.f)) * diff * diff;
+}
+
+void ParticleFluid::Step() {
+    const auto count = particles.Size();
+    predictedX_.resize(count);
+    predictedY_.resize(count);
+    lambda_.resize(count);
+    deltaX_.resize(count);
+    deltaY_.resize(count);
+    neighbors_.resize(count * MAX_NEIGHBORS);
+    neighborCount_.resize(count);
+
+    Predict();
+    FindNeighbors();
+    for (int iteration = 0; iteration < iterations; ++iteration) {
+        SolveDensity();
+    }
+    UpdateVelocities();
+}
+
+void ParticleFluid::Predict() {
+    utils::ParallelFor(0, particles.Size(), [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            particles.vy[i] += gravity;
+            predictedX_[i] = std::clamp(particles.x[i] + particles.vx[i], bounds_.left, bounds_.left + bounds_.width);
+            predictedY_[i] = std::clamp(particles.y[i] + particles.vy[i], bounds_.top, bounds_.top + bounds_.height);
+        }
+    }, CHUNK);
+}
+
+void ParticleFluid::FindNeighbors() {
+    grid_.Build(predictedX_.data(), predictedY_.data(), particles.Size(), h_, bounds_);
+    const float h2 = h_ * h_;
+    std::atomic<std::size_t> truncated = 0;
+    utils::ParallelFor(0, particles.Size(), [&](std::size_t from, std::size_t to) {
+        std::array<float, MAX_NEIGHBORS> distances;
+        std::size_t chunkTruncated = 0;
+        for (std::size_t i = from; i < to; ++i) {
+            auto* neighbors = neighbors_.data() + i * MAX_NEIGHBORS;
+            std::uint32_t count = 0;
+            bool full = false;
+            grid_.ForEachNeighbor(predictedX_[i], predictedY_[i], [&](std::uint32_t j) {
+                if (j == i) {
+                    return;
+                }
+                const float dx = predictedX_[i] - predictedX_[j];
+                const float dy = predictedY_[i] - predictedY_[j];
+                const float d2 = dx * dx + dy * dy;
+                if (d2 >= h2) {
+                    return;
+                }
+                if (count < MAX_NEIGHBORS) {
+                    distances[count] = d2;
+                    neighbors[count++] = j;
+                    return;
+                }
+                // Full: the farthest one makes room, so the list holds the nearest and is not biased to a side
+                full = true;
+                const auto farthest = std::max_element(distances.begin(), distances.end()) - distances.begin();
+                if (d2 < distances[farthest]) {
+                    distances[farthest] = d2;
+                    neighbors[farthest] = j;
+                }
+            });
+            neighborCount_[i] = count;
+            chunkTruncated += full;
+        }
+        truncated += chunkTruncated;
+    }, CHUNK);
+    truncatedNeighbors_ = truncated;
+}
+
+void ParticleFluid::SolveDensity() {
+    const auto count = particles.Size();
+
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            const auto* neighbors = neighbors_.data() + i * MAX_NEIGHBORS;
+            float density = Poly6(0);
+            float gradientX = 0;
+            float gradientY = 0;
+            float gradientSquares = 0;
+            for (std::uint32_t k = 0; k < neighborCount_[i]; ++k) {
+                const auto j = neighbors[k];
+                const float dx = predictedX_[i] - predictedX_[j];
+                const float dy = predictedY_[i] - predictedY_[j];
+                const float distance = std::sqrt(dx * dx + dy * dy);
+                density += Poly6(distance * distance);
+                if (distance > 0) {
+                    const float gradient = SpikyGradient(distance) / (restDensity_ * distance);
+                    gradientX += gradient * dx;
+                    gradientY += gradient * dy;
+                    gradientSquares += gradient * gradient * distance * distance;
+                }
+            }
+            // Only compression is corrected, a surface particle is not pulled into the fluid
+            const float constraint = std::max(density / restDensity_ - 1, 0.f);
+            gradientSquares += gradientX * gradientX + gradientY * gradientY;
+            lambda_[i] = -constraint / (gradientSquares + relaxation_);
+        }
+    }, CHUNK);
+
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            const auto* neighbors = neighbors_.data() + i * MAX_NEIGHBORS;
+            float deltaX = 0;
+            float deltaY = 0;
+            for (std::uint32_t k = 0; k < neighborCount_[i]; ++k) {
+                const auto j = neighbors[k];
+                const float dx = predictedX_[i] - predictedX_[j];
+                const float dy = predictedY_[i] - predictedY_[j];
+                const float distance = std::sqrt(dx * dx + dy * dy);
+                if (distance <= 0) {
+                    continue;
+                }
+                const float ratio = Poly6(distance * distance) / correctionNorm_;
+                const float correction = -CORRECTION_K * ratio * ratio * ratio * ratio;
+                const float gradient = SpikyGradient(distance) / distance;
+                const float scale = (lambda_[i] + lambda_[j] + correction) * gradient / restDensity_;
+                deltaX += scale * dx;
+                deltaY += scale * dy;
+            }
+            deltaX_[i] = deltaX;
+            deltaY_[i] = deltaY;
+        }
+    }, CHUNK);
+
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            predictedX_[i] = std::clamp(predictedX_[i] + deltaX_[i], bounds_.left, bounds_.left + bounds_.width);
+            predictedY_[i] = std::clamp(predictedY_[i] + deltaY_[i], bounds_.top, bounds_.top + bounds_.height);
+        }
+    }, CHUNK);
+}
+
+void ParticleFluid::UpdateVelocities() {
+    const auto count = particles.Size();
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            // The capped displacement stays between the old and the predicted position, inside the bounds
+            particles.vx[i] = std::clamp(predictedX_[i] - particles.x[i], -maxSpeed_, maxSpeed_);
+            particles.vy[i] = std::clamp(predictedY_[i] - particles.y[i], -maxSpeed_, maxSpeed_);
+            predictedX_[i] = particles.x[i] + particles.vx[i];
+            predictedY_[i] = particles.y[i] + particles.vy[i];
+        }
+    }, CHUNK);
+
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            const auto* neighbors = neighbors_.data() + i * MAX_NEIGHBORS;
+            float deltaX = 0;
+            float deltaY = 0;
+            for (std::uint32_t k = 0; k < neighborCount_[i]; ++k) {
+                const auto j = neighbors[k];
+                const float dx = predictedX_[i] - predictedX_[j];
+                const float dy = predictedY_[i] - predictedY_[j];
+                const float weight = Poly6(dx * dx + dy * dy) / restDensity_;
+                deltaX += (particles.vx[j] - particles.vx[i]) * weight;
+                deltaY += (particles.vy[j] - particles.vy[i]) * weight;
+            }
+            deltaX_[i] = VISCOSITY * deltaX;
+            deltaY_[i] = VISCOSITY * deltaY;
+        }
+    }, CHUNK);
+
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            particles.vx[i] += deltaX_[i];
+            particles.vy[i] += deltaY_[i];
+            particles.x[i] = predictedX_[i];
+            particles.y[i] = predictedY_[i];
+        }
+    }, CHUNK);
+}
+
+}  // namespace fluid
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "grid_collision.h"
+
+#include <SFML/Graphics/Rect.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace fluid {
+
+// Centers and velocities of particles, one flat array per coordinate
+struct ParticleArrays {
+    void PushBack(float px, float py, float pvx, float pvy) {
+        x.push_back(px);
+        y.push_back(py);
+        vx.push_back(pvx);
+        vy.push_back(pvy);
+    }
+
+    std::size_t Size() const {
+        return x.size();
+    }
+
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> vx;
+    std::vector<float> vy;
+};
+
+/*
+ * ParticleFluid is a position based fluid (Macklin, Mueller 2013).
+ * Every update predicts positions, then a fixed number of Jacobi iterations
+ * moves particles towards the rest density and velocities are taken from the displacement.
+ * All passes run in parallel over the flat particle arrays.
+ */
+class ParticleFluid {
+public:
+    // spacing is the distance between particles at rest
+    ParticleFluid(float spacing, sf::FloatRect bounds);
+
+    void Step();
+
+    // Particles of the last step with more than MAX_NEIGHBORS neighbours, they kept the nearest
+    std::size_t TruncatedNeighbors() const {
+        return truncatedNeighbors_;
+    }
+
+    ParticleArrays particles;
+    int iterations = 3;
+    float gravity = 0.5;
+
+private:
+    // About 8 times the 4 pi particles of a kernel disc at rest density; the softened constraint lets a dam break
+    // compress to 70 neighbours
+    static constexpr std::size_t MAX_NEIGHBORS = 96;
+
+    float Poly6(float squareDistance) const;
+    // Magnitude of the spiky kernel gradient, the direction is along the distance
+    float SpikyGradient(float distance) const;
+
+    void Predict();
+    void FindNeighbors();
+    void SolveDensity();
+    void UpdateVelocities();
+
+    float h_;
+    float maxSpeed_;
+    float restDensity_ = 1;
+    float relaxation_ = 1;
+    float correctionNorm_ = 1;
+    sf::FloatRect bounds_;
+
+    std::vector<float> predictedX_;
+    std::vector<float> predictedY_;
+    std::vector<float> lambda_;
+    std::vector<float> deltaX_;
+    std::vector<float> deltaY_;
+    // MAX_NEIGHBORS slots per particle
+    std::vector<std::uint32_t> neighbors_;
+    std::vector<std::uint32_t> neighborCount_;
+    std::size_t truncatedNeighbors_ = 0;
+    grid::CellGrid grid_;
+};
+
+}  // namespace fluid
@@ -0,0 +1,403 @@
+#include "gemm.h"
+
+#include "aligned.h"
+#include "gemm_kernels.h"
+
+#include <algorithm>
+#include <barrier>
+#include <cassert>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace gemm {
+
+namespace {
+
+// A KC x 16 panel of rhs (16 KB) and a 6 x KC panel of lhs stay in L1, twice that with AVX-512
+constexpr std::size_t KC = 256;
+// An MC x KC block of lhs (144 KB) stays in L2, MC is a multiple of every kernel's rows
+constexpr std::size_t MC = 144;
+// A KC x NC block of rhs (4 MB) stays in L3, NC is a multiple of every kernel's columns
+constexpr std::size_t NC = 4096;
+// Tiles of out per worker for every rhs block
+constexpr std::size_t TILES_PER_WORKER = 4;
+
+// Per thread packing buffers, grown on demand
+float* Buffer(utils::AlignedVector<float>& buffer, std::size_t count) {
+    if (buffer.size() < count) {
+        buffer.resize(count);
+    }
+    return buffer.data();
+}
+
+/*
+ * Rows [0, rows) x columns [0, depth) of lhs go to strips of mr rows, each stored column by column:
+ * strip[k * mr + r] = lhs(r, k). Rows past the end are zero.
+ */
+void PackLhs(MatrixView<const float> lhs, std::size_t mr, float* packed) {
+    for (std::size_t row = 0; row < lhs.Rows(); row += mr) {
+        const std::size_t rows = std::min(mr, lhs.Rows() - row);
+        for (std::size_t k = 0; k < lhs.Cols(); ++k) {
+            std::size_t r = 0;
+            for (; r < rows; ++r) {
+                packed[r] = lhs(row + r, k);
+            }
+            for (; r < mr; ++r) {
+                packed[r] = 0;
+            }
+            packed += mr;
+        }
+    }
+}
+
+// Strips of nr columns, each stored row by row: strip[k * nr + c] = rhs(k, c). Columns past the end are zero.
+void PackRhs(MatrixView<const float> rhs, std::size_t nr, float* packed) {
+    for (std::size_t col = 0; col < rhs.Cols(); col += nr) {
+        const std::size_t cols = std::min(nr, rhs.Cols() - col);
+        for (std::size_t k = 0; k < rhs.Rows(); ++k) {
+            std::size_t c = 0;
+            if (rhs.RowMajor()) {
+                const float* row = &rhs(k, col);
+                for (; c < cols; ++c) {
+                    packed[c] = row[c];
+                }
+            } else {
+                for (; c < cols; ++c) {
+                    packed[c] = rhs(k, col + c);
+                }
+            }
+            for (; c < nr; ++c) {
+                packed[c] = 0;
+            }
+            packed += nr;
+        }
+    }
+}
+
+/*
+ * out (+)= packed lhs block * packed rhs block. Whole tiles of a row-major out are written in place,
+ * the others go through a local tile and only their valid part is copied.
+ */
+void MultiplyBlock(
+    const Kernel& kernel,
+    const float* lhs,
+    const float* rhs,
+    std::size_t depth,
+    MatrixView<float> out,
+    bool accumulate)
+{
+    const std::size_t mr = kernel.rows;
+    const std::size_t nr = kernel.cols;
+    alignas(64) float tile[MAX_TILE];
+    for (std::size_t col = 0; col < out.Cols(); col += nr) {
+        const std::size_t cols = std::min(nr, out.Cols() - col);
+        const float* rhsStrip = rhs + col * depth;
+        for (std::size_t row = 0; row < out.Rows(); row += mr) {
+            const std::size_t rows = std::min(mr, out.Rows() - row);
+            const float* lhsStrip = lhs + row * depth;
+            if (rows == mr && cols == nr && out.RowMajor()) {
+                kernel.multiply(depth, lhsStrip, rhsStrip, &out(row, col), out.RowStride(), accumulate);
+                continue;
+            }
+            kernel.multiply(depth, lhsStrip, rhsStrip, tile, nr, false);
+            for (std::size_t r = 0; r < rows; ++r) {
+                for (std::size_t c = 0; c < cols; ++c) {
+                    float& value = out(row + r, col + c);
+                    value = accumulate ? value + tile[r * nr + c] : tile[r * nr + c];
+                }
+            }
+        }
+    }
+}
+
+// Set on the threads of a Team, a multiply started there runs on that thread alone
+thread_local bool gInTeam = false;
+
+/*
+ * Fixed set of worker threads, optionally pinned to cpus. Run calls job(worker) on every worker
+ * and returns when all are done.
+ */
+class Team {
+public:
+    Team(std::size_t threads, std::vector<int> affinity)
+        : affinity_(std::move(affinity))
+    {
+        for (std::size_t worker = 0; worker < threads; ++worker) {
+            threads_.emplace_back([this, worker]() {
+                Loop(worker);
+            });
+        }
+    }
+
+    ~Team() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    std::size_t Size() const {
+        return threads_.size();
+    }
+
+    const std::vector<int>& Affinity() const {
+        return affinity_;
+    }
+
+    void Run(const std::function<void(std::size_t)>& job) {
+        std::unique_lock lock(mutex_);
+        job_ = &job;
+        running_ = threads_.size();
+        ++generation_;
+        wake_.notify_all();
+        done_.wait(lock, [this]() {
+            return running_ == 0;
+        });
+        job_ = nullptr;
+    }
+
+    // The rhs block shared by the workers
+    utils::AlignedVector<float> packedRhs;
+
+private:
+    void Loop(std::size_t worker) {
+        gInTeam = true;
+#ifdef __linux__
+        if (!affinity_.empty()) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(affinity_[worker % affinity_.size()], &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#endif
+        std::size_t generation = 0;
+        while (true) {
+            const std::function<void(std::size_t)>* job;
+            {
+                std::unique_lock lock(mutex_);
+                wake_.wait(lock, [&]() {
+                    return stop_ || generation_ != generation;
+                });
+                if (stop_) {
+                    return;
+                }
+                generation = generation_;
+                job = job_;
+            }
+            (*job)(worker);
+            std::lock_guard lock(mutex_);
+            if (--running_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    std::vector<int> affinity_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t)>* job_ = nullptr;
+    std::size_t generation_ = 0;
+    std::size_t running_ = 0;
+    bool stop_ = false;
+};
+
+// One team at a time, rebuilt when the options change; parallel multiplications run one after another
+std::mutex gTeamMutex;
+std::unique_ptr<Team> gTeam;
+
+/*
+ * The usual five loops around the micro-kernel: columns of out by NC, depth by KC, rows by MC,
+ * then the micro-tiles of the block. Every rhs block is packed once, its strips split among the workers.
+ * The block of out is cut into tiles of MC rows and a multiple of the kernel's columns, and every worker
+ * takes a contiguous range of them in row order, so it repacks its lhs block only when the row block changes.
+ */
+void Work(
+    const Kernel& kernel,
+    MatrixView<const float> lhs,
+    MatrixView<const float> rhs,
+    MatrixView<float> out,
+    float* packedRhs,
+    std::size_t worker,
+    std::size_t workers,
+    std::barrier<>* barrier)
+{
+    const std::size_t rows = out.Rows();
+    const std::size_t cols = out.Cols();
+    const std::size_t depth = lhs.Cols();
+    const std::size_t rowBlocks = (rows + MC - 1) / MC;
+    const std::size_t nr = kernel.cols;
+    thread_local utils::AlignedVector<float> lhsBuffer;
+    float* packedLhs = Buffer(lhsBuffer, MC * KC);
+    for (std::size_t col = 0; col < cols; col += NC) {
+        const std::size_t blockCols = std::min(NC, cols - col);
+        const std::size_t strips = (blockCols + nr - 1) / nr;
+        // At least TILES_PER_WORKER tiles per worker keep the last ones from idling
+        const std::size_t colTiles = std::min(strips, (TILES_PER_WORKER * workers + rowBlocks - 1) / rowBlocks);
+        const std::size_t tileCols = (strips + colTiles - 1) / colTiles * nr;
+        const std::size_t rowTiles = (blockCols + tileCols - 1) / tileCols;
+        const std::size_t tiles = rowBlocks * rowTiles;
+        for (std::size_t k = 0; k < depth; k += KC) {
+            const std::size_t blockDepth = std::min(KC, depth - k);
+            const std::size_t stripsFrom = strips * worker / workers;
+            const std::size_t stripsTo = strips * (worker + 1) / workers;
+            if (stripsFrom < stripsTo) {
+                const std::size_t from = stripsFrom * nr;
+                const std::size_t to = std::min(blockCols, stripsTo * nr);
+                PackRhs(rhs.Block(k, col + from, blockDepth, to - from), nr, packedRhs + from * blockDepth);
+            }
+            if (barrier) {
+                barrier->arrive_and_wait();
+            }
+
+            std::size_t packedRow = rows;
+            for (std::size_t tile = tiles * worker / workers; tile < tiles * (worker + 1) / workers; ++tile) {
+                const std::size_t row = tile / rowTiles * MC;
+                const std::size_t tileCol = tile % rowTiles * tileCols;
+                const std::size_t blockRows = std::min(MC, rows - row);
+                if (packedRow != row) {
+                    PackLhs(lhs.Block(row, k, blockRows, blockDepth), kernel.rows, packedLhs);
+                    packedRow = row;
+                }
+                MultiplyBlock(
+                    kernel,
+                    packedLhs,
+                    packedRhs + tileCol * blockDepth,
+                    blockDepth,
+                    out.Block(row, col + tileCol, blockRows, std::min(tileCols, blockCols - tileCol)),
+                    k > 0);
+            }
+            if (barrier) {
+                barrier->arrive_and_wait();
+            }
+        }
+    }
+}
+
+const Kernel& GetKernel(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar:
+        return ScalarKernel();
+    case Isa::Sse42:
+        return Sse42Kernel();
+    case Isa::Avx2:
+        return Avx2Kernel();
+    case Isa::Avx512:
+        return Avx512Kernel();
+    }
+    return ScalarKernel();
+}
+
+}  // namespace
+
+const char* IsaName(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar:
+        return "scalar";
+    case Isa::Sse42:
+        return "sse4.2";
+    case Isa::Avx2:
+        return "avx2";
+    case Isa::Avx512:
+        return "avx512";
+    }
+    return "unknown";
+}
+
+bool Supported(Isa isa) {
+    switch (isa) {
+    case Isa::Scalar:
+        return true;
+    case Isa::Sse42:
+        return __builtin_cpu_supports("sse4.2");
+    case Isa::Avx2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case Isa::Avx512:
+        return __builtin_cpu_supports("avx512f");
+    }
+    return false;
+}
+
+Isa DefaultIsa() {
+    static const Isa isa = []() {
+        if (const char* name = std::getenv("MATRIX_ISA")) {
+            for (auto isa : {Isa::Scalar, Isa::Sse42, Isa::Avx2, Isa::Avx512}) {
+                if (name == std::string(IsaName(isa))) {
+                    return isa;
+                }
+            }
+            throw std::invalid_argument(std::string("Unknown MATRIX_ISA: ") + name);
+        }
+        for (auto isa : {Isa::Avx512, Isa::Avx2, Isa::Sse42}) {
+            if (Supported(isa)) {
+                return isa;
+            }
+        }
+        return Isa::Scalar;
+    }();
+    return isa;
+}
+
+void Multiply(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out, const Options& options) {
+    assert(lhs.Cols() == rhs.Rows() && out.Rows() == lhs.Rows() && out.Cols() == rhs.Cols());
+    const std::size_t rows = out.Rows();
+    const std::size_t cols = out.Cols();
+    const std::size_t depth = lhs.Cols();
+    if (depth == 0) {
+        for (std::size_t i = 0; i < rows; ++i) {
+            for (std::size_t j = 0; j < cols; ++j) {
+                out(i, j) = 0;
+            }
+        }
+        return;
+    }
+
+    const Isa isa = options.isa.value_or(DefaultIsa());
+    if (!Supported(isa)) {
+        throw std::invalid_argument(std::string("This cpu does not support ") + IsaName(isa));
+    }
+    const Kernel& kernel = GetKernel(isa);
+    const std::size_t mr = kernel.rows;
+    const std::size_t nr = kernel.cols;
+    const std::size_t rhsSize = KC * ((std::min(NC, cols) + nr - 1) / nr * nr);
+    std::size_t threads = options.threads > 0 ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    // Every thread needs a few tiles of work
+    threads = std::min(threads, (rows + mr - 1) / mr * ((cols + nr - 1) / nr));
+    // A team worker waiting for the team would never finish
+    if (threads <= 1 || gInTeam) {
+        thread_local utils::AlignedVector<float> rhsBuffer;
+        Work(kernel, lhs, rhs, out, Buffer(rhsBuffer, rhsSize), 0, 1, nullptr);
+        return;
+    }
+
+    std::lock_guard lock(gTeamMutex);
+    if (!gTeam || gTeam->Size() != threads || gTeam->Affinity() != options.affinity) {
+        gTeam.reset();
+        gTeam = std::make_unique<Team>(threads, options.affinity);
+    }
+    float* packedRhs = Buffer(gTeam->packedRhs, rhsSize);
+    std::barrier barrier(threads);
+    const std::function<void(std::size_t)> job = [&](std::size_t worker) {
+        Work(kernel, lhs, rhs, out, packedRhs, worker, threads, &barrier);
+    };
+    gTeam->Run(job);
+}
+
+}  // namespace gemm
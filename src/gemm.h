@@ -0,0 +1,48 @@
+#pragma once
+
+#include "matrix_view.h"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+namespace gemm {
+
+// Instruction sets with a micro-kernel, each compiled in its own file
+enum class Isa {
+    Scalar,
+    Sse42,
+    Avx2,
+    Avx512,
+};
+
+// "scalar", "sse4.2", "avx2" or "avx512"
+const char* IsaName(Isa isa);
+
+bool Supported(Isa isa);
+
+// The widest supported instruction set, or the one named by the MATRIX_ISA environment variable
+Isa DefaultIsa();
+
+struct Options {
+    /*
+     * Worker threads, 0 uses all hardware threads. Multiplies with more than one thread share a single
+     * team of workers and run one at a time, whatever thread starts them; a multiply started on a team
+     * worker runs single-threaded on it.
+     */
+    std::size_t threads = 1;
+    // Worker i runs on cpu affinity[i % affinity.size()], empty leaves the threads unpinned
+    std::vector<int> affinity;
+    // Forces a kernel, otherwise DefaultIsa() is used
+    std::optional<Isa> isa;
+};
+
+/*
+ * out = lhs * rhs for views of any shape and strides.
+ * Blocks of both operands are packed into contiguous panels and multiplied by a register tiled
+ * micro-kernel (6 x 16 with AVX2 and FMA, 12 x 32 with AVX-512); partial tiles at the edges are zero padded.
+ * With more than one thread the tiles of out are shared by a persistent team of workers.
+ */
+void Multiply(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out, const Options& options = {});
+
+}  // namespace gemm
@@ -0,0 +1,51 @@
+#include "gemm_kernels.h"
+
+#include <immintrin.h>
+
+namespace gemm {
+
+namespace {
+
+// 6 rows x 2 vectors of 8 floats use 12 of the 16 ymm registers
+constexpr std::size_t MR = 6;
+constexpr std::size_t NR = 16;
+
+void MultiplyTile(std::size_t depth, const float* lhs, const float* rhs, float* out, std::size_t stride, bool accumulate) {
+    __m256 acc[MR][2];
+#pragma GCC unroll 6
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for (std::size_t k = 0; k < depth; ++k) {
+        const __m256 b0 = _mm256_load_ps(rhs);
+        const __m256 b1 = _mm256_load_ps(rhs + 8);
+#pragma GCC unroll 6
+        for (std::size_t r = 0; r < MR; ++r) {
+            const __m256 a = _mm256_broadcast_ss(lhs + r);
+            acc[r][0] = _mm256_fmadd_ps(a, b0, acc[r][0]);
+            acc[r][1] = _mm256_fmadd_ps(a, b1, acc[r][1]);
+        }
+        lhs += MR;
+        rhs += NR;
+    }
+#pragma GCC unroll 6
+    for (std::size_t r = 0; r < MR; ++r) {
+        float* row = out + r * stride;
+        if (accumulate) {
+            acc[r][0] = _mm256_add_ps(acc[r][0], _mm256_loadu_ps(row));
+            acc[r][1] = _mm256_add_ps(acc[r][1], _mm256_loadu_ps(row + 8));
+        }
+        _mm256_storeu_ps(row, acc[r][0]);
+        _mm256_storeu_ps(row + 8, acc[r][1]);
+    }
+}
+
+}  // namespace
+
+const Kernel& Avx2Kernel() {
+    static constexpr Kernel kernel{MR, NR, &MultiplyTile};
+    return kernel;
+}
+
+}  // namespace gemm
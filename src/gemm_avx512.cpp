@@ -0,0 +1,51 @@
+#include "gemm_kernels.h"
+
+#include <immintrin.h>
+
+namespace gemm {
+
+namespace {
+
+// 12 rows x 2 vectors of 16 floats use 24 of the 32 zmm registers
+constexpr std::size_t MR = 12;
+constexpr std::size_t NR = 32;
+
+void MultiplyTile(std::size_t depth, const float* lhs, const float* rhs, float* out, std::size_t stride, bool accumulate) {
+    __m512 acc[MR][2];
+#pragma GCC unroll 12
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+    for (std::size_t k = 0; k < depth; ++k) {
+        const __m512 b0 = _mm512_load_ps(rhs);
+        const __m512 b1 = _mm512_load_ps(rhs + 16);
+#pragma GCC unroll 12
+        for (std::size_t r = 0; r < MR; ++r) {
+            const __m512 a = _mm512_set1_ps(lhs[r]);
+            acc[r][0] = _mm512_fmadd_ps(a, b0, acc[r][0]);
+            acc[r][1] = _mm512_fmadd_ps(a, b1, acc[r][1]);
+        }
+        lhs += MR;
+        rhs += NR;
+    }
+#pragma GCC unroll 12
+    for (std::size_t r = 0; r < MR; ++r) {
+        float* row = out + r * stride;
+        if (accumulate) {
+            acc[r][0] = _mm512_add_ps(acc[r][0], _mm512_loadu_ps(row));
+            acc[r][1] = _mm512_add_ps(acc[r][1], _mm512_loadu_ps(row + 16));
+        }
+        _mm512_storeu_ps(row, acc[r][0]);
+        _mm512_storeu_ps(row + 16, acc[r][1]);
+    }
+}
+
+}  // namespace
+
+const Kernel& Avx512Kernel() {
+    static constexpr Kernel kernel{MR, NR, &MultiplyTile};
+    return kernel;
+}
+
+}  // namespace gemm
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+
+/*
+ * Micro-kernels of gemm::Multiply, one file per instruction set compiled with its own flags.
+ * The kernel files include nothing but this header and the intrinsics: an inline function from a common
+ * header compiled there could be picked by the linker for every caller and crash cpus without the extension.
+ */
+namespace gemm {
+
+// out[rows x cols] (+)= lhs strip * rhs strip over depth, the strips are packed and aligned, out rows are stride floats apart
+using KernelFunction = void (*)(
+    std::size_t depth, const float* lhs, const float* rhs, float* out, std::size_t stride, bool accumulate);
+
+struct Kernel {
+    std::size_t rows;
+    std::size_t cols;
+    KernelFunction multiply;
+};
+
+// Largest rows * cols of the kernels
+constexpr std::size_t MAX_TILE = 12 * 32;
+
+const Kernel& ScalarKernel();
+const Kernel& Sse42Kernel();
+const Kernel& Avx2Kernel();
+const Kernel& Avx512Kernel();
+
+}  // namespace gemm
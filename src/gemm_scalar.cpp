@@ -0,0 +1,35 @@
+#include "gemm_kernels.h"
+
+namespace gemm {
+
+namespace {
+
+constexpr std::size_t MR = 4;
+constexpr std::size_t NR = 8;
+
+void MultiplyTile(std::size_t depth, const float* lhs, const float* rhs, float* out, std::size_t stride, bool accumulate) {
+    float acc[MR][NR] = {};
+    for (std::size_t k = 0; k < depth; ++k) {
+        for (std::size_t r = 0; r < MR; ++r) {
+            for (std::size_t c = 0; c < NR; ++c) {
+                acc[r][c] += lhs[r] * rhs[c];
+            }
+        }
+        lhs += MR;
+        rhs += NR;
+    }
+    for (std::size_t r = 0; r < MR; ++r) {
+        for (std::size_t c = 0; c < NR; ++c) {
+            out[r * stride + c] = accumulate ? out[r * stride + c] + acc[r][c] : acc[r][c];
+        }
+    }
+}
+
+}  // namespace
+
+const Kernel& ScalarKernel() {
+    static constexpr Kernel kernel{MR, NR, &MultiplyTile};
+    return kernel;
+}
+
+}  // namespace gemm
@@ -0,0 +1,51 @@
+#include "gemm_kernels.h"
+
+#include <immintrin.h>
+
+namespace gemm {
+
+namespace {
+
+// 6 rows x 2 vectors of 4 floats use 12 of the 16 xmm registers
+constexpr std::size_t MR = 6;
+constexpr std::size_t NR = 8;
+
+void MultiplyTile(std::size_t depth, const float* lhs, const float* rhs, float* out, std::size_t stride, bool accumulate) {
+    __m128 acc[MR][2];
+#pragma GCC unroll 6
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm_setzero_ps();
+        acc[r][1] = _mm_setzero_ps();
+    }
+    for (std::size_t k = 0; k < depth; ++k) {
+        const __m128 b0 = _mm_load_ps(rhs);
+        const __m128 b1 = _mm_load_ps(rhs + 4);
+#pragma GCC unroll 6
+        for (std::size_t r = 0; r < MR; ++r) {
+            const __m128 a = _mm_set1_ps(lhs[r]);
+            acc[r][0] = _mm_add_ps(acc[r][0], _mm_mul_ps(a, b0));
+            acc[r][1] = _mm_add_ps(acc[r][1], _mm_mul_ps(a, b1));
+        }
+        lhs += MR;
+        rhs += NR;
+    }
+#pragma GCC unroll 6
+    for (std::size_t r = 0; r < MR; ++r) {
+        float* row = out + r * stride;
+        if (accumulate) {
+            acc[r][0] = _mm_add_ps(acc[r][0], _mm_loadu_ps(row));
+            acc[r][1] = _mm_add_ps(acc[r][1], _mm_loadu_ps(row + 4));
+        }
+        _mm_storeu_ps(row, acc[r][0]);
+        _mm_storeu_ps(row + 4, acc[r][1]);
+    }
+}
+
+}  // namespace
+
+const Kernel& Sse42Kernel() {
+    static constexpr Kernel kernel{MR, NR, &MultiplyTile};
+    return kernel;
+}
+
+}  // namespace gemm
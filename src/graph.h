@@ -1,24 +1,45 @@
 #pragma once
 
+#include "retained_vertices.h"
 #include "utils.h"
-
-#include <SFML/Graphics/VertexArray.hpp>
+#include "world.h"
 
 #include <array>
+#include <cassert>
+#include <cstdint>
+#include <limits>
 #include <vector>
 
+// The grid covers the world bounds with one vertex per DPIXELS
+inline int GridColumns() {
+    return gWorld.bounds.width / DPIXELS + 1;
+}
+
+inline int GridRows() {
+    return gWorld.bounds.height / DPIXELS + 1;
+}
+
 int GetVertex(WindXy pos) {
-    int x = std::round(pos.x);
-    int y = std::round(pos.y);
-    return x / DPIXELS + (y / DPIXELS) * WIDTH / DPIXELS;
+    int x = std::round(pos.x - gWorld.bounds.left);
+    int y = std::round(pos.y - gWorld.bounds.top);
+    if (x < 0 || y < 0 || x / DPIXELS >= GridColumns() || y / DPIXELS >= GridRows()) {
+        return -1;
+    }
+    return x / DPIXELS + (y / DPIXELS) * GridColumns();
 }
 
 WindXy GetPos(int vertex) {
-    int x = vertex % (WIDTH / DPIXELS);
-    int y = vertex / (WIDTH / DPIXELS);
-    return WindXy(x * DPIXELS, y * DPIXELS);
+    int x = vertex % GridColumns();
+    int y = vertex / GridColumns();
+    return WindXy(gWorld.bounds.left + x * DPIXELS, gWorld.bounds.top + y * DPIXELS);
 }
 
+/*
+ * Directed edges between neighbouring grid vertices, added as cars explore.
+ * Each vertex has a bit mask of its edge directions; the ids of existing edges live in blocks
+ * of BLOCK_VERTICES vertices, allocated when a block gets its first edge, so memory follows
+ * the edges that exist rather than the size of the grid.
+ */
 class Graph {
 public:
     static inline const std::array<sf::Vector2f, 8> DIRS = {
@@ -34,51 +55,95 @@ public:
         }
     };
 
+    // 8 bytes: the vertex in 29 bits, the direction in 3
     struct Edge {
         Edge(int from, int dirInd) : from(from), dirInd(dirInd) {
         }
 
-        int from;
-        int dirInd;
-        int cost = 0;
+        std::uint32_t from : 29;
+        std::uint32_t dirInd : 3;
+        std::int32_t cost = 0;
     };
 
-    Graph(int numVertices) : adjList_(numVertices) {
-        for (auto& array : adjList_) {
-            array.fill(std::numeric_limits<std::size_t>::max());
-        }
-        edges_.reserve(numVertices * DIRS.size());
+    Graph(int numVertices)
+        : masks_(numVertices)
+        , blocks_((numVertices + BLOCK_VERTICES - 1) / BLOCK_VERTICES, NO_BLOCK)
+    {
     }
 
+    // The pointer is valid until the next AddEdge
     Edge* AddEdge(int from, int dirInd) {
-        adjList_[from][dirInd] = edges_.size();
-        return &edges_.emplace_back(from, dirInd);
+        assert(!HasEdge(from, dirInd) && edges_.size() < NO_EDGE);
+        auto& block = blocks_[from / BLOCK_VERTICES];
+        if (block == NO_BLOCK) {
+            block = ids_.size();
+            ids_.resize(ids_.size() + BLOCK_VERTICES * DIRS.size());
+        }
+        ids_[block + from % BLOCK_VERTICES * DIRS.size() + dirInd] = edges_.size();
+        masks_[from] |= 1 << dirInd;
+        auto& edge = edges_.emplace_back(from, dirInd);
+        const auto color = EdgeColor(edge.cost);
+        const sf::Vertex line[] = {
+            {GetPos(from), color},
+            {GetPos(from) + static_cast<float>(DPIXELS) * DIRS[dirInd], color},
+        };
+        lines_.Append(line, 2);
+        return &edge;
+    }
+
+    void ChangeCost(Edge* edge, int delta) {
+        edge->cost += delta;
+        const auto color = EdgeColor(edge->cost);
+        auto line = lines_.Modify(2 * (edge - edges_.data()), 2);
+        line[0].color = color;
+        line[1].color = color;
     }
 
     Edge* GetEdge(int from, int dirInd) {
-        if (adjList_[from][dirInd] == -1) {
+        if (!HasEdge(from, dirInd)) {
             return nullptr;
         }
-        return &edges_[adjList_[from][dirInd]];
+        return &edges_[ids_[blocks_[from / BLOCK_VERTICES] + from % BLOCK_VERTICES * DIRS.size() + dirInd]];
+    }
+
+    const Edge* GetEdge(int from, int dirInd) const {
+        return const_cast<Graph*>(this)->GetEdge(from, dirInd);
     }
 
     bool HasEdge(int from, int dirInd) const {
-        return adjList_[from][dirInd] != -1;
+        return masks_[from] >> dirInd & 1;
     }
 
-    void Render(sf::RenderWindow& window, float part = 0) const {
-        for (auto edge : edges_) {
-            sf::VertexArray line(sf::Lines);
-            auto color = sf::Color(255, 0, 0, 255);
-            color.r = std::max(static_cast<int>(color.r) + 10 * edge.cost, 0);
-            color.b = std::min(static_cast<int>(color.b) - 10 * edge.cost, 255);
-            line.append(sf::Vertex(GetPos(edge.from), color));
-            line.append(sf::Vertex(GetPos(edge.from) + static_cast<float>(DPIXELS) * DIRS[edge.dirInd], color));
-            window.draw(line);
-        }
+    // Bit i is set if the vertex has an edge towards DIRS[i]
+    std::uint8_t Directions(int vertex) const {
+        return masks_[vertex];
+    }
+
+    void Render(sf::RenderWindow& window, float part = 0) {
+        lines_.Draw(window);
     }
 
 private:
-    std::vector<std::array<std::size_t, DIRS.size()>> adjList_;
+    // A block holds the edge ids of this many consecutive vertices, 2 KB
+    static constexpr int BLOCK_VERTICES = 64;
+    static constexpr std::uint32_t NO_BLOCK = std::numeric_limits<std::uint32_t>::max();
+    static constexpr std::uint32_t NO_EDGE = std::numeric_limits<std::uint32_t>::max();
+
+    static sf::Color EdgeColor(int cost) {
+        auto color = sf::Color(255, 0, 0, 255);
+        color.r = std::max(static_cast<int>(color.r) + 10 * cost, 0);
+        color.b = std::min(static_cast<int>(color.b) - 10 * cost, 255);
+        return color;
+    }
+
+    static_assert(sizeof(Edge) == 8);
+
+    std::vector<std::uint8_t> masks_;
+    // Offset of the block of each BLOCK_VERTICES vertices in ids_, or NO_BLOCK
+    std::vector<std::uint32_t> blocks_;
+    // Per block, the id of the edge of every vertex and direction, valid where masks_ has the bit
+    std::vector<std::uint32_t> ids_;
     std::vector<Edge> edges_;
+    // Two vertices per edge, in the order of edges_
+    utils::RetainedVertices lines_{sf::Lines};
 };
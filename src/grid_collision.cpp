@@ -1 +1,134 @@
 #include "grid_collision.h"
+
+#include "parallel.h"
+
+namespace grid {
+
+void CellGrid::Build(const float* xs, const float* ys, std::size_t count, float cellSize, sf::FloatRect bounds) {
+    cellSize_ = cellSize;
+    left_ = bounds.left;
+    top_ = bounds.top;
+    rows_ = std::max<std::size_t>(1, std::ceil(bounds.height / cellSize));
+    cols_ = std::max<std::size_t>(1, std::ceil(bounds.width / cellSize));
+
+    cellOf_.resize(count);
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            cellOf_[i] = RowOf(ys[i]) * cols_ + ColOf(xs[i]);
+        }
+    }, 4096);
+
+    cellStart_.assign(rows_ * cols_ + 1, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        ++cellStart_[cellOf_[i] + 1];
+    }
+    for (std::size_t cell = 0; cell < rows_ * cols_; ++cell) {
+        cellStart_[cell + 1] += cellStart_[cell];
+    }
+
+    cursor_.assign(cellStart_.begin(), cellStart_.end() - 1);
+    indices_.resize(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        indices_[cursor_[cellOf_[i]]++] = i;
+    }
+}
+
+void GridCollision::Resolve(sf::FloatRect bounds) {
+    const auto count = particles_.Size();
+    xs_.resize(count);
+    ys_.resize(count);
+    radii_.resize(count);
+    utils::ParallelFor(0, count, [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            const auto center = utils::Center(particles_.shapes[i]);
+            xs_[i] = center.x;
+            ys_[i] = center.y;
+            radii_[i] = particles_.shapes[i].getRadius();
+        }
+    }, 4096);
+
+    float cellSize = particleSize_.value_or(0);
+    if (!particleSize_) {
+        for (auto radius : radii_) {
+            cellSize = std::max(cellSize, 2 * radius);
+        }
+    }
+    cells_.Build(xs_.data(), ys_.data(), count, std::max(cellSize, 1.f), bounds);
+
+    rowCollisions_.assign(cells_.Rows(), 0);
+    for (std::size_t colorRow = 0; colorRow < 2; ++colorRow) {
+        for (std::size_t colorCol = 0; colorCol < 2; ++colorCol) {
+            // Rows colorRow, colorRow + 2, ...
+            utils::ParallelFor(0, (cells_.Rows() - colorRow + 1) / 2, [&](std::size_t from, std::size_t to) {
+                for (std::size_t k = from; k < to; ++k) {
+                    for (std::size_t col = colorCol; col < cells_.Cols(); col += 2) {
+                        SweepBlock(colorRow + 2 * k, col);
+                    }
+                }
+            });
+        }
+    }
+
+    collisions_ = 0;
+    for (auto rowCount : rowCollisions_) {
+        collisions_ += rowCount;
+    }
+}
+
+void GridCollision::SweepBlock(std::size_t row, std::size_t col) {
+    const bool hasRight = col + 1 < cells_.Cols();
+    const bool hasDown = row + 1 < cells_.Rows();
+    const auto cell = cells_.Cell(row, col);
+    auto& collisions = rowCollisions_[row];
+
+    collisions += CollideCell(cell);
+    if (hasRight) {
+        collisions += CollideCells(cell, cells_.Cell(row, col + 1));
+    }
+    if (hasDown) {
+        collisions += CollideCells(cell, cells_.Cell(row + 1, col));
+    }
+    if (hasRight && hasDown) {
+        collisions += CollideCells(cell, cells_.Cell(row + 1, col + 1));
+        collisions += CollideCells(cells_.Cell(row, col + 1), cells_.Cell(row + 1, col));
+    }
+}
+
+std::size_t GridCollision::CollideCell(std::span<const std::uint32_t> cell) {
+    std::size_t collisions = 0;
+    for (std::size_t a = 0; a < cell.size(); ++a) {
+        for (std::size_t b = a + 1; b < cell.size(); ++b) {
+            collisions += Collide(cell[a], cell[b]);
+        }
+    }
+    return collisions;
+}
+
+std::size_t GridCollision::CollideCells(std::span<const std::uint32_t> first, std::span<const std::uint32_t> second) {
+    std::size_t collisions = 0;
+    for (auto i : first) {
+        for (auto j : second) {
+            collisions += Collide(i, j);
+        }
+    }
+    return collisions;
+}
+
+bool GridCollision::Collide(std::uint32_t i, std::uint32_t j) {
+    const float dx = xs_[j] - xs_[i];
+    const float dy = ys_[j] - ys_[i];
+    const float distance = radii_[i] + radii_[j];
+    if (dx * dx + dy * dy >= distance * distance) {
+        return false;
+    }
+    auto& first = particles_.velocities[i];
+    auto& second = particles_.velocities[j];
+    // Equal masses, an elastic hit exchanges the velocities
+    if ((first.x - second.x) * dx + (first.y - second.y) * dy <= 0) {
+        return false;
+    }
+    std::swap(first, second);
+    return true;
+}
+
+}  // namespace grid
@@ -4,23 +4,115 @@
 
 #include <SFML/Graphics/CircleShape.hpp>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <optional>
+#include <span>
+#include <vector>
 
 namespace grid {
 
+/*
+ * CellGrid buckets points into square cells with a counting sort.
+ * Indices of the points of one cell are contiguous, so a neighbour query
+ * reads the 3x3 block of cells around a point and nothing else.
+ * Points outside of the bounds go to the nearest border cell.
+ */
+class CellGrid {
+public:
+    void Build(const float* xs, const float* ys, std::size_t count, float cellSize, sf::FloatRect bounds);
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    // All indices, cell after cell in row-major order
+    std::span<const std::uint32_t> Indices() const {
+        return indices_;
+    }
+
+    std::span<const std::uint32_t> Cell(std::size_t row, std::size_t col) const {
+        const auto cell = row * cols_ + col;
+        return {indices_.data() + cellStart_[cell], indices_.data() + cellStart_[cell + 1]};
+    }
+
+    template <class F>
+    void ForEachNeighbor(float x, float y, F&& f) const {
+        const int row = RowOf(y);
+        const int col = ColOf(x);
+        for (int r = std::max(row - 1, 0); r <= std::min<int>(row + 1, rows_ - 1); ++r) {
+            for (int c = std::max(col - 1, 0); c <= std::min<int>(col + 1, cols_ - 1); ++c) {
+                for (auto index : Cell(r, c)) {
+                    f(index);
+                }
+            }
+        }
+    }
+
+private:
+    int RowOf(float y) const {
+        return std::clamp(static_cast<int>((y - top_) / cellSize_), 0, static_cast<int>(rows_) - 1);
+    }
+
+    int ColOf(float x) const {
+        return std::clamp(static_cast<int>((x - left_) / cellSize_), 0, static_cast<int>(cols_) - 1);
+    }
+
+    float cellSize_ = 1;
+    float left_ = 0;
+    float top_ = 0;
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::vector<std::uint32_t> cellOf_;
+    std::vector<std::uint32_t> cellStart_;
+    std::vector<std::uint32_t> cursor_;
+    std::vector<std::uint32_t> indices_;
+};
+
 /*
  * GridCollision is helpful for collision detection
  * of high density particles of almost the same size.
+ * Cells are at least a particle wide, so touching particles are in the same or adjacent cells.
+ * The cell (row, col) checks pairs inside its 2x2 block of cells (row..row+1, col..col+1).
+ * Cells are swept in 4 colours by the parity of row and col, blocks of one colour do not overlap
+ * and are processed in parallel without locks.
  */
 class GridCollision {
 public:
-    explicit GridCollision(Physics<sf::CircleShape>& particles, std::optional<float> avgParticleSize) : particles_(particles) {
-        if (!avgParticleSize) {
-        }
+    explicit GridCollision(Physics<sf::CircleShape>& particles, std::optional<float> avgParticleSize)
+        : particles_(particles)
+        , particleSize_(avgParticleSize)
+    {
+    }
+
+    // Swaps velocities of touching particles that move towards each other
+    void Resolve(sf::FloatRect bounds);
+
+    // Number of collisions found by the last Resolve
+    std::size_t Collisions() const {
+        return collisions_;
     }
 
 private:
+    void SweepBlock(std::size_t row, std::size_t col);
+    std::size_t CollideCell(std::span<const std::uint32_t> cell);
+    std::size_t CollideCells(std::span<const std::uint32_t> first, std::span<const std::uint32_t> second);
+    bool Collide(std::uint32_t i, std::uint32_t j);
+
     Physics<sf::CircleShape>& particles_;
+    std::optional<float> particleSize_;
+    std::vector<float> xs_;
+    std::vector<float> ys_;
+    std::vector<float> radii_;
+    CellGrid cells_;
+    // Counted per row of cells, a row is swept by one thread at a time
+    std::vector<std::size_t> rowCollisions_;
+    std::size_t collisions_ = 0;
 };
 
 }  // namespace grid
@@ -5,6 +5,7 @@
 #include <iostream>
 
 #include "utils.h"
+#include "world.h"
 
 inline std::vector<sf::Color> kCOLORS = {sf::Color::Cyan, sf::Color::Red, sf::Color::Blue, sf::Color::Green};
 
@@ -13,6 +14,7 @@ void Main(TGame& game, int usPerUpdate = 30000) {
     sf::ContextSettings settings;
     settings.antialiasingLevel = 16;
     sf::RenderWindow window({utils::WIDTH, utils::HEIGHT}, "TGame", sf::Style::Default, settings);
+    utils::Camera camera(window);
 
     sf::Clock clock;
     sf::Int64 lag = 0;
@@ -23,8 +25,11 @@ void Main(TGame& game, int usPerUpdate = 30000) {
             if (event.type == sf::Event::EventType::Closed) {
                 std::exit(0);
             }
+            camera.HandleInput(event, window);
             game.HandleInput(event);
         }
+        utils::gWorld.visible = camera.Rect();
+        utils::gWorld.view = camera.View();
         auto elapsed = clock.restart().asMicroseconds();
         lag += elapsed;
         utils::gStats["elapsed, mcs"] = elapsed;
@@ -38,13 +43,17 @@ void Main(TGame& game, int usPerUpdate = 30000) {
         }
 
         window.clear(utils::LIGHT_GREY);
+        camera.Apply(window);
         if (lag < 1) {
             game.Render(window, static_cast<float>(lag) / usPerUpdate);
         } else {
             game.Render(window, 0);
         }
+        utils::FlushText(window);
+        window.setView(window.getDefaultView());
         ++utils::gStats["ticks"];
         utils::DrawStats(window);
+        utils::FlushText(window);
         window.display();
     }
 }
@@ -0,0 +1,175 @@
+#pragma once
+
+#include "aligned.h"
+#include "gemm.h"
+#include "matrix_view.h"
+#include "strassen.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <initializer_list>
+#include <ostream>
+
+enum class MultType {
+    Fast,
+    Slow,
+    // Fast on all hardware threads
+    Parallel,
+    // Strassen-Winograd above the crossover on all hardware threads, Fast below it
+    Strassen,
+};
+
+// out = lhs * rhs, the reference triple loop
+inline void MultiplySlow(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out) {
+    assert(lhs.Cols() == rhs.Rows() && out.Rows() == lhs.Rows() && out.Cols() == rhs.Cols());
+    for (std::size_t i = 0; i < out.Rows(); ++i) {
+        for (std::size_t j = 0; j < out.Cols(); ++j) {
+            float sum = 0;
+            for (std::size_t k = 0; k < lhs.Cols(); ++k) {
+                sum += lhs(i, k) * rhs(k, j);
+            }
+            out(i, j) = sum;
+        }
+    }
+}
+
+template <MultType multType>
+void Multiply(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out) {
+    if constexpr (multType == MultType::Slow) {
+        MultiplySlow(lhs, rhs, out);
+    } else if constexpr (multType == MultType::Parallel) {
+        gemm::Multiply(lhs, rhs, out, {.threads = 0, .affinity = {}});
+    } else if constexpr (multType == MultType::Strassen) {
+        strassen::Multiply(lhs, rhs, out, {.crossover = strassen::Options().crossover, .parallel = true, .isa = {}});
+    } else {
+        gemm::Multiply(lhs, rhs, out);
+    }
+}
+
+/*
+ * Matrix keeps all rows in one 64-byte aligned buffer. Rows are padded to a multiple of 64 bytes,
+ * so every row starts on a cache line; the padding is zero and is never part of a view.
+ */
+template <MultType multType = MultType::Fast>
+class Matrix {
+public:
+    // Row stride granularity, in floats
+    static constexpr std::size_t ROW_ALIGNMENT = 64 / sizeof(float);
+
+    Matrix(std::initializer_list<std::initializer_list<float>> list)
+        : Matrix(list.size(), list.size() > 0 ? list.begin()->size() : 0)
+    {
+        std::size_t i = 0;
+        for (const auto& row : list) {
+            assert(row.size() == cols_);
+            std::copy(row.begin(), row.end(), data_.begin() + i++ * stride_);
+        }
+    }
+
+    Matrix(std::size_t rows, std::size_t cols, float value = 0)
+        : rows_(rows)
+        , cols_(cols)
+        , stride_((cols + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT)
+        , data_(rows * stride_)
+    {
+        for (std::size_t i = 0; i < rows_; ++i) {
+            std::fill_n(data_.begin() + i * stride_, cols_, value);
+        }
+    }
+
+    // Copies the elements of any view
+    template <class T>
+    explicit Matrix(const MatrixView<T>& view)
+        : Matrix(view.Rows(), view.Cols())
+    {
+        for (std::size_t i = 0; i < rows_; ++i) {
+            for (std::size_t j = 0; j < cols_; ++j) {
+                (*this)(i, j) = view(i, j);
+            }
+        }
+    }
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    // Distance between the starts of two rows, in floats
+    std::size_t Stride() const {
+        return stride_;
+    }
+
+    MatrixView<float> View() {
+        return {data_.data(), rows_, cols_, stride_};
+    }
+
+    MatrixView<const float> View() const {
+        return {data_.data(), rows_, cols_, stride_};
+    }
+
+    MatrixView<float> Block(std::size_t row, std::size_t col, std::size_t rows, std::size_t cols) {
+        return View().Block(row, col, rows, cols);
+    }
+
+    MatrixView<const float> Block(std::size_t row, std::size_t col, std::size_t rows, std::size_t cols) const {
+        return View().Block(row, col, rows, cols);
+    }
+
+    MatrixView<float> Transposed() {
+        return View().Transposed();
+    }
+
+    MatrixView<const float> Transposed() const {
+        return View().Transposed();
+    }
+
+    float* Row(std::size_t i) {
+        return data_.data() + i * stride_;
+    }
+
+    const float* Row(std::size_t i) const {
+        return data_.data() + i * stride_;
+    }
+
+    Matrix operator*(const Matrix& other) const {
+        assert(rows_ > 0 && cols_ > 0 && other.cols_ > 0);
+        assert(cols_ == other.rows_);
+        Matrix out(rows_, other.cols_);
+        Multiply<multType>(View(), other.View(), out.View());
+        return out;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const Matrix& m) {
+        assert(m.rows_ > 0 && m.cols_ > 0);
+        for (std::size_t i = 0; i < m.rows_; ++i) {
+            for (std::size_t j = 0; j + 1 < m.cols_; ++j) {
+                os << m(i, j) << ' ';
+            }
+            os << m(i, m.cols_ - 1) << '\n';
+        }
+        return os;
+    }
+
+    template <MultType TR>
+    bool operator==(const Matrix<TR>& rhs) const {
+        return Near(View(), rhs.View());
+    }
+
+    float& operator()(std::size_t i, std::size_t j) {
+        return data_[i * stride_ + j];
+    }
+
+    float operator()(std::size_t i, std::size_t j) const {
+        return data_[i * stride_ + j];
+    }
+
+private:
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::size_t stride_ = 0;
+    utils::AlignedVector<float> data_;
+};
@@ -0,0 +1,411 @@
+#include "matrix.h"
+#include "quantized.h"
+#include "strassen.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+/*
+ * Benchmark of gemm::Multiply over square and skinny shapes.
+ * Every shape is warmed up, timed several times and checked against a blocked reference;
+ * a table goes to stderr and the results as JSON to stdout or to --json <file>.
+ *
+ *   matrix_bench [--repeats N] [--warmup N] [--threads N] [--no-check] [--strassen] [--quantized] [--json file]
+ *
+ * --strassen also compares strassen::Multiply at several crossovers with gemm on large squares,
+ * --quantized the int8 product, the faster one, and the bf16 product, which only saves storage and is slower than
+ * gemm, with their error against the float product.
+ * MATRIX_ISA selects the kernel, see gemm::DefaultIsa().
+ */
+
+namespace {
+
+struct Shape {
+    std::size_t rows;
+    std::size_t depth;
+    std::size_t cols;
+};
+
+// Sizes around and off the multiples of the vector widths and micro-tiles
+const Shape SHAPES[] = {
+    {64, 64, 64},
+    {127, 127, 127},
+    {256, 256, 256},
+    {511, 511, 511},
+    {1024, 1024, 1024},
+    {2048, 2048, 2048},
+    {4096, 4096, 1},
+    {1, 4096, 4096},
+    {4096, 64, 4096},
+    {64, 4096, 64},
+    {1000, 1000, 17},
+    {17, 1000, 1000},
+    {3, 4093, 4093},
+};
+
+// Parallel scaling is measured on this square size
+constexpr std::size_t SCALING_SIZE = 2048;
+// Squares and crossovers of the Strassen comparison
+constexpr std::size_t STRASSEN_SIZES[] = {1024, 2048, 4096, 8192};
+constexpr std::size_t STRASSEN_CROSSOVERS[] = {512, 1024, 2048};
+// Squares of the quantized comparison
+constexpr std::size_t QUANTIZED_SIZES[] = {512, 1024, 2048, 4096};
+// Reference tiles of rows x depth x cols
+constexpr std::size_t REFERENCE_BLOCK = 64;
+
+struct Options {
+    std::size_t repeats = 5;
+    std::size_t warmup = 1;
+    std::size_t threads = 1;
+    bool check = true;
+    bool strassen = false;
+    bool quantized = false;
+    std::string json;
+};
+
+struct Result {
+    Shape shape;
+    double medianSeconds = 0;
+    double gflops = 0;
+    // A and B read once, C written once: the least traffic any implementation has
+    double bytes = 0;
+    // Largest error relative to the rounding bound of the element, fine below 1
+    double error = 0;
+};
+
+struct StrassenPoint {
+    std::size_t size;
+    std::size_t crossover;
+    std::size_t levels;
+    double speedup;
+    // max |strassen - gemm| / (max |lhs| * max |rhs| * epsilon), next to strassen::ErrorBound()
+    double error;
+    double bound;
+};
+
+struct QuantizedPoint {
+    std::size_t size;
+    const char* mode;
+    double gflops;
+    double speedup;
+    // max |out - float product| / max |float product|
+    double maxError;
+    // |out - float product| / |float product| in the Frobenius norm
+    double rmsError;
+};
+
+struct ScalingPoint {
+    std::size_t threads;
+    double gflops;
+    double efficiency;
+};
+
+Matrix<MultType::Fast> Random(std::size_t rows, std::size_t cols, std::mt19937& gen) {
+    std::uniform_real_distribution<float> dis(-1, 1);
+    Matrix<MultType::Fast> m(rows, cols);
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t j = 0; j < cols; ++j) {
+            m(i, j) = dis(gen);
+        }
+    }
+    return m;
+}
+
+/*
+ * Cache blocked multiplication in double, which also sums |lhs(i, k) * rhs(k, j)|.
+ * A float dot product of depth terms is off by at most about depth * epsilon * that sum,
+ * so the error of out(i, j) is reported relative to this bound.
+ */
+double ReferenceError(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<const float> out) {
+    const std::size_t rows = out.Rows();
+    const std::size_t cols = out.Cols();
+    const std::size_t depth = lhs.Cols();
+    std::vector<double> sum(rows * cols);
+    std::vector<double> absSum(rows * cols);
+    for (std::size_t i0 = 0; i0 < rows; i0 += REFERENCE_BLOCK) {
+        for (std::size_t k0 = 0; k0 < depth; k0 += REFERENCE_BLOCK) {
+            for (std::size_t j0 = 0; j0 < cols; j0 += REFERENCE_BLOCK) {
+                for (std::size_t i = i0; i < std::min(rows, i0 + REFERENCE_BLOCK); ++i) {
+                    for (std::size_t k = k0; k < std::min(depth, k0 + REFERENCE_BLOCK); ++k) {
+                        const double a = lhs(i, k);
+                        for (std::size_t j = j0; j < std::min(cols, j0 + REFERENCE_BLOCK); ++j) {
+                            const double product = a * rhs(k, j);
+                            sum[i * cols + j] += product;
+                            absSum[i * cols + j] += std::abs(product);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    const double epsilon = std::numeric_limits<float>::epsilon();
+    double error = 0;
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t j = 0; j < cols; ++j) {
+            const double bound = depth * epsilon * absSum[i * cols + j] + std::numeric_limits<float>::min();
+            error = std::max(error, std::abs(out(i, j) - sum[i * cols + j]) / bound);
+        }
+    }
+    return error;
+}
+
+// Median of repeats of multiply() after warmup runs, in seconds
+template <class F>
+double Time(const Options& options, F&& multiply) {
+    for (std::size_t run = 0; run < options.warmup; ++run) {
+        multiply();
+    }
+    std::vector<double> seconds;
+    for (std::size_t run = 0; run < options.repeats; ++run) {
+        const auto start = std::chrono::steady_clock::now();
+        multiply();
+        seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    std::nth_element(seconds.begin(), seconds.begin() + seconds.size() / 2, seconds.end());
+    return seconds[seconds.size() / 2];
+}
+
+double Time(const Options& options, const gemm::Options& gemmOptions, const Matrix<MultType::Fast>& lhs,
+    const Matrix<MultType::Fast>& rhs, Matrix<MultType::Fast>& out)
+{
+    return Time(options, [&]() {
+        gemm::Multiply(lhs.View(), rhs.View(), out.View(), gemmOptions);
+    });
+}
+
+float MaxAbs(MatrixView<const float> m) {
+    float result = 0;
+    for (std::size_t i = 0; i < m.Rows(); ++i) {
+        for (std::size_t j = 0; j < m.Cols(); ++j) {
+            result = std::max(result, std::abs(m(i, j)));
+        }
+    }
+    return result;
+}
+
+double Flops(const Shape& shape) {
+    return 2. * shape.rows * shape.depth * shape.cols;
+}
+
+Options ParseOptions(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--repeats" && hasValue) {
+            options.repeats = std::max(1ul, std::stoul(argv[++i]));
+        } else if (arg == "--warmup" && hasValue) {
+            options.warmup = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::stoul(argv[++i]);
+        } else if (arg == "--json" && hasValue) {
+            options.json = argv[++i];
+        } else if (arg == "--no-check") {
+            options.check = false;
+        } else if (arg == "--strassen") {
+            options.strassen = true;
+        } else if (arg == "--quantized") {
+            options.quantized = true;
+        } else {
+            std::cerr << "Usage: " << argv[0]
+                << " [--repeats N] [--warmup N] [--threads N] [--no-check] [--strassen] [--quantized] [--json file]"
+                << std::endl;
+            std::exit(1);
+        }
+    }
+    return options;
+}
+
+void WriteJson(std::ostream& os, const Options& options, const std::vector<Result>& results,
+    const std::vector<ScalingPoint>& scaling, const std::vector<StrassenPoint>& strassen,
+    const std::vector<QuantizedPoint>& quantized)
+{
+    os << "{\n";
+    os << "  \"isa\": \"" << gemm::IsaName(gemm::DefaultIsa()) << "\",\n";
+    os << "  \"threads\": " << options.threads << ",\n";
+    os << "  \"repeats\": " << options.repeats << ",\n";
+    os << "  \"results\": [\n";
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const auto& result = results[i];
+        os << "    {\"m\": " << result.shape.rows << ", \"k\": " << result.shape.depth << ", \"n\": " << result.shape.cols
+            << ", \"median_ms\": " << result.medianSeconds * 1e3 << ", \"gflops\": " << result.gflops
+            << ", \"bytes\": " << result.bytes << ", \"gbytes_per_s\": " << result.bytes / result.medianSeconds / 1e9;
+        if (options.check) {
+            os << ", \"error\": " << result.error << ", \"passed\": " << (result.error <= 1 ? "true" : "false");
+        }
+        os << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    os << "  ],\n";
+    os << "  \"scaling\": [\n";
+    for (std::size_t i = 0; i < scaling.size(); ++i) {
+        os << "    {\"threads\": " << scaling[i].threads << ", \"gflops\": " << scaling[i].gflops
+            << ", \"efficiency\": " << scaling[i].efficiency << "}" << (i + 1 < scaling.size() ? "," : "") << "\n";
+    }
+    os << "  ],\n";
+    os << "  \"strassen\": [\n";
+    for (std::size_t i = 0; i < strassen.size(); ++i) {
+        const auto& point = strassen[i];
+        os << "    {\"size\": " << point.size << ", \"crossover\": " << point.crossover << ", \"levels\": " << point.levels
+            << ", \"speedup\": " << point.speedup << ", \"error\": " << point.error << ", \"bound\": " << point.bound << "}"
+            << (i + 1 < strassen.size() ? "," : "") << "\n";
+    }
+    os << "  ],\n";
+    os << "  \"quantized\": [\n";
+    for (std::size_t i = 0; i < quantized.size(); ++i) {
+        const auto& point = quantized[i];
+        os << "    {\"size\": " << point.size << ", \"mode\": \"" << point.mode << "\", \"gflops\": " << point.gflops
+            << ", \"speedup\": " << point.speedup << ", \"max_error\": " << point.maxError << ", \"rms_error\": "
+            << point.rmsError << "}" << (i + 1 < quantized.size() ? "," : "") << "\n";
+    }
+    os << "  ]\n";
+    os << "}\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const auto options = ParseOptions(argc, argv);
+    const gemm::Options gemmOptions{.threads = options.threads, .affinity = {}, .isa = {}};
+    std::mt19937 gen(7);
+    bool passed = true;
+
+    std::vector<Result> results;
+    for (const auto& shape : SHAPES) {
+        const auto lhs = Random(shape.rows, shape.depth, gen);
+        const auto rhs = Random(shape.depth, shape.cols, gen);
+        Matrix<MultType::Fast> out(shape.rows, shape.cols);
+        Result result{.shape = shape};
+        result.medianSeconds = Time(options, gemmOptions, lhs, rhs, out);
+        result.gflops = Flops(shape) / result.medianSeconds / 1e9;
+        result.bytes = sizeof(float) * (shape.rows * shape.depth + shape.depth * shape.cols + shape.rows * shape.cols);
+        if (options.check) {
+            result.error = ReferenceError(lhs.View(), rhs.View(), out.View());
+            passed &= result.error <= 1;
+        }
+        std::cerr << shape.rows << "x" << shape.depth << "x" << shape.cols << ": " << result.medianSeconds * 1e3
+            << " ms, " << result.gflops << " GFLOP/s";
+        if (options.check) {
+            std::cerr << ", error " << result.error << (result.error <= 1 ? "" : " FAILED");
+        }
+        std::cerr << std::endl;
+        results.push_back(result);
+    }
+
+    // Pinned runs from one to all hardware threads, efficiency is the speedup over one thread divided by the threads
+    std::vector<ScalingPoint> scaling;
+    const Shape square{SCALING_SIZE, SCALING_SIZE, SCALING_SIZE};
+    const auto lhs = Random(SCALING_SIZE, SCALING_SIZE, gen);
+    Matrix<MultType::Fast> out(SCALING_SIZE, SCALING_SIZE);
+    const std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    double singleSeconds = 0;
+    for (std::size_t threads = 1; threads <= maxThreads; threads = threads == maxThreads ? threads + 1 : std::min(2 * threads, maxThreads)) {
+        gemm::Options scalingOptions{.threads = threads, .affinity = std::vector<int>(threads), .isa = {}};
+        for (std::size_t cpu = 0; cpu < threads; ++cpu) {
+            scalingOptions.affinity[cpu] = cpu;
+        }
+        const double seconds = Time(options, scalingOptions, lhs, lhs, out);
+        if (threads == 1) {
+            singleSeconds = seconds;
+        }
+        scaling.push_back({threads, Flops(square) / seconds / 1e9, singleSeconds / seconds / threads});
+        std::cerr << threads << " threads: " << scaling.back().gflops << " GFLOP/s, efficiency "
+            << scaling.back().efficiency << std::endl;
+    }
+
+    // Speedup of Strassen over gemm with the same threads, and its error measured against gemm
+    std::vector<StrassenPoint> strassen;
+    for (std::size_t size : STRASSEN_SIZES) {
+        if (!options.strassen) {
+            break;
+        }
+        const auto lhs = Random(size, size, gen);
+        const auto rhs = Random(size, size, gen);
+        Matrix<MultType::Fast> expected(size, size);
+        Matrix<MultType::Fast> out(size, size);
+        const double gemmSeconds = Time(options, gemmOptions, lhs, rhs, expected);
+        const double scale = MaxAbs(lhs.View()) * MaxAbs(rhs.View()) * std::numeric_limits<float>::epsilon();
+        for (std::size_t crossover : STRASSEN_CROSSOVERS) {
+            if (crossover > size) {
+                continue;
+            }
+            const strassen::Options strassenOptions{.crossover = crossover, .parallel = options.threads != 1, .isa = {}};
+            const double seconds = Time(options, [&]() {
+                strassen::Multiply(lhs.View(), rhs.View(), out.View(), strassenOptions);
+            });
+            double error = 0;
+            for (std::size_t i = 0; i < size; ++i) {
+                for (std::size_t j = 0; j < size; ++j) {
+                    error = std::max(error, std::abs(static_cast<double>(out(i, j)) - expected(i, j)) / scale);
+                }
+            }
+            strassen.push_back({size, crossover, strassen::Levels(size, size, size, crossover), gemmSeconds / seconds, error,
+                strassen::ErrorBound(size, size, size, crossover)});
+            std::cerr << "strassen " << size << " crossover " << crossover << " (" << strassen.back().levels
+                << " levels): " << seconds * 1e3 << " ms vs gemm " << gemmSeconds * 1e3 << " ms, speedup "
+                << strassen.back().speedup << ", error " << error << " eps (bound " << strassen.back().bound << ")" << std::endl;
+        }
+    }
+
+    // Products of the stored int8 and bf16 copies against the float product of the originals
+    std::vector<QuantizedPoint> quantized;
+    for (std::size_t size : QUANTIZED_SIZES) {
+        if (!options.quantized) {
+            break;
+        }
+        const auto lhs = Random(size, size, gen);
+        const auto rhs = Random(size, size, gen);
+        Matrix<MultType::Fast> expected(size, size);
+        Matrix<MultType::Fast> out(size, size);
+        const double gemmSeconds = Time(options, gemmOptions, lhs, rhs, expected);
+        const quantized::Options quantizedOptions{.parallel = options.threads != 1, .isa = {}};
+        const quantized::Int8Matrix lhsInt8(lhs.View(), quantized::Scales::PerRow);
+        const quantized::Int8Matrix rhsInt8(rhs.View(), quantized::Scales::PerCol);
+        const quantized::Bf16Matrix lhsBf16(lhs.View());
+        const quantized::Bf16Matrix rhsBf16(rhs.View());
+        for (const char* mode : {"int8", "bf16"}) {
+            const bool int8 = mode == std::string_view("int8");
+            const double seconds = Time(options, [&]() {
+                if (int8) {
+                    quantized::Multiply(lhsInt8, rhsInt8, out.View(), quantizedOptions);
+                } else {
+                    quantized::Multiply(lhsBf16, rhsBf16, out.View(), quantizedOptions);
+                }
+            });
+            double maxError = 0;
+            double errorSquares = 0;
+            double squares = 0;
+            for (std::size_t i = 0; i < size; ++i) {
+                for (std::size_t j = 0; j < size; ++j) {
+                    const double error = std::abs(static_cast<double>(out(i, j)) - expected(i, j));
+                    maxError = std::max(maxError, error);
+                    errorSquares += error * error;
+                    squares += static_cast<double>(expected(i, j)) * expected(i, j);
+                }
+            }
+            const Shape square{size, size, size};
+            quantized.push_back({size, mode, Flops(square) / seconds / 1e9, gemmSeconds / seconds,
+                maxError / MaxAbs(expected.View()), std::sqrt(errorSquares / squares)});
+            std::cerr << mode << " " << size << ": " << quantized.back().gflops << " GOP/s, speedup "
+                << quantized.back().speedup << ", max error " << quantized.back().maxError << ", rms error "
+                << quantized.back().rmsError << std::endl;
+        }
+    }
+
+    if (options.json.empty()) {
+        WriteJson(std::cout, options, results, scaling, strassen, quantized);
+    } else {
+        std::ofstream file(options.json);
+        WriteJson(file, options, results, scaling, strassen, quantized);
+    }
+    return passed ? 0 : 1;
+}
@@ -0,0 +1,347 @@
+#include "matrix_file.h"
+
+#include "aligned.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace {
+
+constexpr char MAGIC[8] = {'M', 'T', 'X', 'T', 'I', 'L', 'E', '1'};
+// Tiles start at a page boundary
+constexpr std::size_t DATA_OFFSET = 4096;
+// Tile rows are whole cache lines
+constexpr std::size_t TILE_ALIGNMENT = 64 / sizeof(float);
+
+struct Header {
+    char magic[8];
+    std::uint64_t rows;
+    std::uint64_t cols;
+    std::uint64_t tile;
+};
+
+std::size_t FileSize(std::size_t rows, std::size_t cols, std::size_t tile) {
+    return DATA_OFFSET + (rows + tile - 1) / tile * ((cols + tile - 1) / tile) * tile * tile * sizeof(float);
+}
+
+[[noreturn]] void ThrowErrno(const std::string& what, const std::string& path) {
+    throw std::system_error(errno, std::generic_category(), what + " " + path);
+}
+
+// Runs jobs in order on its own thread; Wait() returns once all queued jobs are done
+class IoThread {
+public:
+    IoThread()
+        : thread_([this]() { Loop(); })
+    {
+    }
+
+    ~IoThread() {
+        {
+            std::lock_guard lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        thread_.join();
+    }
+
+    void Post(std::function<void()> job) {
+        {
+            std::lock_guard lock(mutex_);
+            jobs_.push_back(std::move(job));
+        }
+        wake_.notify_all();
+    }
+
+    void Wait() {
+        std::unique_lock lock(mutex_);
+        idle_.wait(lock, [this]() { return jobs_.empty() && !busy_; });
+    }
+
+private:
+    void Loop() {
+        std::unique_lock lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+            if (jobs_.empty()) {
+                return;
+            }
+            auto job = std::move(jobs_.front());
+            jobs_.pop_front();
+            busy_ = true;
+            lock.unlock();
+            job();
+            lock.lock();
+            busy_ = false;
+            idle_.notify_all();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable idle_;
+    std::deque<std::function<void()>> jobs_;
+    bool busy_ = false;
+    bool stop_ = false;
+    std::thread thread_;
+};
+
+// Reads the tile into the page cache and maps it: a hint first, then one read per page
+void Fetch(const MatrixFile& file, std::size_t ti, std::size_t tj) {
+    file.Load(ti, tj);
+    const volatile float* data = file.Tile(ti, tj).Data();
+    const std::size_t pageFloats = static_cast<std::size_t>(sysconf(_SC_PAGESIZE)) / sizeof(float);
+    const std::size_t count = file.TileSize() * file.TileSize();
+    for (std::size_t offset = 0; offset < count; offset += pageFloats) {
+        static_cast<void>(data[offset]);
+    }
+    static_cast<void>(data[count - 1]);
+}
+
+}  // namespace
+
+MatrixFile MatrixFile::Create(const std::string& path, std::size_t rows, std::size_t cols, std::size_t tile) {
+    if (tile == 0 || tile % TILE_ALIGNMENT != 0) {
+        throw std::invalid_argument("Tile size must be a positive multiple of 16: " + std::to_string(tile));
+    }
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ThrowErrno("open", path);
+    }
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.rows = rows;
+    header.cols = cols;
+    header.tile = tile;
+    // The new space of a truncated file reads as zeros without taking disk blocks
+    if (::ftruncate(fd, static_cast<off_t>(FileSize(rows, cols, tile))) != 0
+        || ::pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header)))
+    {
+        const int error = errno;
+        ::close(fd);
+        errno = error;
+        ThrowErrno("write", path);
+    }
+    return MatrixFile(path, fd, true);
+}
+
+MatrixFile MatrixFile::Open(const std::string& path, bool writable) {
+    const int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        ThrowErrno("open", path);
+    }
+    return MatrixFile(path, fd, writable);
+}
+
+MatrixFile::MatrixFile(const std::string& path, int fd, bool writable)
+    : path_(path)
+    , fd_(fd)
+{
+    Header header{};
+    struct stat st {};
+    if (::fstat(fd_, &st) != 0 || ::pread(fd_, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+        const int error = errno;
+        Close();
+        errno = error;
+        ThrowErrno("read", path);
+    }
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.tile == 0 || header.tile % TILE_ALIGNMENT != 0
+        || static_cast<std::size_t>(st.st_size) < FileSize(header.rows, header.cols, header.tile))
+    {
+        Close();
+        throw std::runtime_error("Not a tiled matrix file: " + path);
+    }
+    rows_ = header.rows;
+    cols_ = header.cols;
+    tile_ = header.tile;
+    size_ = FileSize(rows_, cols_, tile_);
+    void* data = ::mmap(nullptr, size_, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd_, 0);
+    if (data == MAP_FAILED) {
+        const int error = errno;
+        Close();
+        errno = error;
+        ThrowErrno("mmap", path);
+    }
+    data_ = static_cast<char*>(data);
+}
+
+MatrixFile::MatrixFile(MatrixFile&& other) noexcept
+    : path_(std::move(other.path_))
+    , fd_(std::exchange(other.fd_, -1))
+    , data_(std::exchange(other.data_, nullptr))
+    , size_(std::exchange(other.size_, 0))
+    , rows_(other.rows_)
+    , cols_(other.cols_)
+    , tile_(other.tile_)
+{
+}
+
+MatrixFile& MatrixFile::operator=(MatrixFile&& other) noexcept {
+    if (this != &other) {
+        Close();
+        path_ = std::move(other.path_);
+        fd_ = std::exchange(other.fd_, -1);
+        data_ = std::exchange(other.data_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        rows_ = other.rows_;
+        cols_ = other.cols_;
+        tile_ = other.tile_;
+    }
+    return *this;
+}
+
+MatrixFile::~MatrixFile() {
+    Close();
+}
+
+void MatrixFile::Close() {
+    if (data_) {
+        ::munmap(data_, size_);
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+float* MatrixFile::TileData(std::size_t ti, std::size_t tj) const {
+    assert(ti < TileRows() && tj < TileCols());
+    return reinterpret_cast<float*>(data_ + DATA_OFFSET) + (ti * TileCols() + tj) * tile_ * tile_;
+}
+
+MatrixView<float> MatrixFile::Tile(std::size_t ti, std::size_t tj) {
+    return {TileData(ti, tj), std::min(tile_, rows_ - ti * tile_), std::min(tile_, cols_ - tj * tile_), tile_};
+}
+
+MatrixView<const float> MatrixFile::Tile(std::size_t ti, std::size_t tj) const {
+    return {TileData(ti, tj), std::min(tile_, rows_ - ti * tile_), std::min(tile_, cols_ - tj * tile_), tile_};
+}
+
+// madvise works on whole pages, so a tile that does not fill its pages shares the advice with a neighbour
+void MatrixFile::Advise(std::size_t ti, std::size_t tj, int advice) const {
+    const auto page = static_cast<std::uintptr_t>(sysconf(_SC_PAGESIZE));
+    const auto begin = reinterpret_cast<std::uintptr_t>(TileData(ti, tj));
+    const auto end = begin + tile_ * tile_ * sizeof(float);
+    const auto from = begin / page * page;
+    const auto to = std::min((end + page - 1) / page * page, reinterpret_cast<std::uintptr_t>(data_ + size_));
+    if (::madvise(reinterpret_cast<void*>(from), to - from, advice) != 0) {
+        ThrowErrno("madvise", path_);
+    }
+}
+
+void MatrixFile::Load(std::size_t ti, std::size_t tj) const {
+    Advise(ti, tj, MADV_WILLNEED);
+}
+
+void MatrixFile::Evict(std::size_t ti, std::size_t tj) const {
+    Advise(ti, tj, MADV_DONTNEED);
+}
+
+void MatrixFile::Sync() const {
+    if (::msync(data_, size_, MS_SYNC) != 0) {
+        ThrowErrno("msync", path_);
+    }
+}
+
+float MatrixFile::operator()(std::size_t i, std::size_t j) const {
+    return TileData(i / tile_, j / tile_)[i % tile_ * tile_ + j % tile_];
+}
+
+float& MatrixFile::operator()(std::size_t i, std::size_t j) {
+    return TileData(i / tile_, j / tile_)[i % tile_ * tile_ + j % tile_];
+}
+
+void MultiplyOutOfCore(const MatrixFile& lhs, const MatrixFile& rhs, MatrixFile& out, const gemm::Options& options) {
+    assert(lhs.Cols() == rhs.Rows() && out.Rows() == lhs.Rows() && out.Cols() == rhs.Cols());
+    if (lhs.TileSize() != rhs.TileSize() || lhs.TileSize() != out.TileSize()) {
+        throw std::invalid_argument("Out of core multiply needs the same tile size in every file");
+    }
+    const std::size_t tile = out.TileSize();
+    const std::size_t depthTiles = lhs.TileCols();
+    if (depthTiles == 0) {
+        for (std::size_t ti = 0; ti < out.TileRows(); ++ti) {
+            for (std::size_t tj = 0; tj < out.TileCols(); ++tj) {
+                const auto view = out.Tile(ti, tj);
+                for (std::size_t i = 0; i < view.Rows(); ++i) {
+                    std::fill_n(&view(i, 0), view.Cols(), 0.f);
+                }
+            }
+        }
+        return;
+    }
+
+    // Steps (ti, tj, tk) in order, each needs lhs tile (ti, tk) and rhs tile (tk, tj)
+    const std::size_t steps = out.TileRows() * out.TileCols() * depthTiles;
+    if (steps == 0) {
+        return;
+    }
+    const auto step = [&](std::size_t s) {
+        return std::array<std::size_t, 3>{s / depthTiles / out.TileCols(), s / depthTiles % out.TileCols(), s % depthTiles};
+    };
+    const auto fetch = [&](std::size_t s) {
+        const auto [ti, tj, tk] = step(s);
+        return [&lhs, &rhs, ti, tj, tk]() {
+            Fetch(lhs, ti, tk);
+            Fetch(rhs, tk, tj);
+        };
+    };
+
+    utils::AlignedVector<float> sum(tile * tile);
+    utils::AlignedVector<float> product(tile * tile);
+    IoThread io;
+    io.Post(fetch(0));
+    for (std::size_t s = 0; s < steps; ++s) {
+        io.Wait();
+        if (s + 1 < steps) {
+            io.Post(fetch(s + 1));
+        }
+        const auto [ti, tj, tk] = step(s);
+        const auto a = lhs.Tile(ti, tk);
+        const auto b = rhs.Tile(tk, tj);
+        const MatrixView<float> sumView(sum.data(), a.Rows(), b.Cols(), tile);
+        if (tk == 0) {
+            gemm::Multiply(a, b, sumView, options);
+        } else {
+            const MatrixView<float> productView(product.data(), a.Rows(), b.Cols(), tile);
+            gemm::Multiply(a, b, productView, options);
+            for (std::size_t i = 0; i < a.Rows(); ++i) {
+                for (std::size_t j = 0; j < b.Cols(); ++j) {
+                    sumView(i, j) += productView(i, j);
+                }
+            }
+        }
+        rhs.Evict(tk, tj);
+
+        if (tk + 1 == depthTiles) {
+            const auto c = out.Tile(ti, tj);
+            for (std::size_t i = 0; i < c.Rows(); ++i) {
+                std::copy_n(&sumView(i, 0), c.Cols(), &c(i, 0));
+            }
+            out.Evict(ti, tj);
+            if (tj + 1 == out.TileCols()) {
+                for (std::size_t k = 0; k < depthTiles; ++k) {
+                    lhs.Evict(ti, k);
+                }
+            }
+        }
+    }
+}
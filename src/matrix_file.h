@@ -0,0 +1,86 @@
+#pragma once
+
+#include "gemm.h"
+#include "matrix_view.h"
+
+#include <cstddef>
+#include <string>
+
+/*
+ * A float matrix on disk in square tiles, mapped into memory rather than read. The file is a 4 KB header
+ * (the magic "MTXTILE1", then rows, cols and the tile size as native uint64) followed by the tiles row
+ * by row, each tile x tile floats in row-major order, zero padded past the last row and column.
+ * Pages are read on first access; Load() and Evict() tell the kernel which tiles come next and which are done.
+ */
+class MatrixFile {
+public:
+    static constexpr std::size_t DEFAULT_TILE = 1024;
+
+    // Creates or truncates path with every element zero; the tile size must be a multiple of 16
+    static MatrixFile Create(const std::string& path, std::size_t rows, std::size_t cols, std::size_t tile = DEFAULT_TILE);
+
+    static MatrixFile Open(const std::string& path, bool writable = false);
+
+    MatrixFile(MatrixFile&& other) noexcept;
+    MatrixFile& operator=(MatrixFile&& other) noexcept;
+    ~MatrixFile();
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    std::size_t TileSize() const {
+        return tile_;
+    }
+
+    // Number of tiles down and across
+    std::size_t TileRows() const {
+        return (rows_ + tile_ - 1) / tile_;
+    }
+
+    std::size_t TileCols() const {
+        return (cols_ + tile_ - 1) / tile_;
+    }
+
+    // The elements of tile (ti, tj) inside the matrix
+    MatrixView<float> Tile(std::size_t ti, std::size_t tj);
+    MatrixView<const float> Tile(std::size_t ti, std::size_t tj) const;
+
+    // Starts reading the tile in the background, MADV_WILLNEED
+    void Load(std::size_t ti, std::size_t tj) const;
+
+    // Drops the pages of the tile from this mapping, MADV_DONTNEED; written data stays in the file
+    void Evict(std::size_t ti, std::size_t tj) const;
+
+    // Writes the modified pages back, msync
+    void Sync() const;
+
+    float operator()(std::size_t i, std::size_t j) const;
+    float& operator()(std::size_t i, std::size_t j);
+
+private:
+    MatrixFile(const std::string& path, int fd, bool writable);
+
+    float* TileData(std::size_t ti, std::size_t tj) const;
+    void Advise(std::size_t ti, std::size_t tj, int advice) const;
+    void Close();
+
+    std::string path_;
+    int fd_ = -1;
+    char* data_ = nullptr;
+    std::size_t size_ = 0;
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::size_t tile_ = 0;
+};
+
+/*
+ * out = lhs * rhs for files with the same tile size, holding only a few tiles in memory: one tile of lhs,
+ * one of rhs and the sum for one tile of out. An I/O thread reads the next pair of tiles while gemm::Multiply
+ * works on the current pair; rhs tiles are evicted after use and lhs tiles when their row of out is done.
+ */
+void MultiplyOutOfCore(const MatrixFile& lhs, const MatrixFile& rhs, MatrixFile& out, const gemm::Options& options = {});
@@ -0,0 +1,149 @@
+#include "matrix_file.h"
+
+#include <sys/resource.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <string_view>
+
+/*
+ * Multiplies matrices stored as tiled files, see MatrixFile, without loading them whole.
+ *
+ *   matrix_ooc random <file> <rows> <cols> [--tile N] [--seed N]
+ *   matrix_ooc multiply <lhs> <rhs> <out> [--threads N]
+ *   matrix_ooc check <lhs> <rhs> <out> [--samples N]
+ *
+ * random fills a file tile by tile with uniform values in [-1, 1), multiply writes out = lhs * rhs
+ * with MultiplyOutOfCore and check compares sampled elements of out with dot products in double.
+ */
+
+namespace {
+
+struct Options {
+    std::size_t tile = MatrixFile::DEFAULT_TILE;
+    std::size_t seed = 7;
+    std::size_t threads = 0;
+    std::size_t samples = 1000;
+};
+
+[[noreturn]] void Usage(const char* name) {
+    std::cerr << "Usage: " << name << " random <file> <rows> <cols> [--tile N] [--seed N]\n"
+        << "       " << name << " multiply <lhs> <rhs> <out> [--threads N]\n"
+        << "       " << name << " check <lhs> <rhs> <out> [--samples N]" << std::endl;
+    std::exit(1);
+}
+
+Options ParseOptions(int argc, char** argv, int from) {
+    Options options;
+    for (int i = from; i < argc; ++i) {
+        const std::string_view arg = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (arg == "--tile" && hasValue) {
+            options.tile = std::stoul(argv[++i]);
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = std::stoul(argv[++i]);
+        } else if (arg == "--threads" && hasValue) {
+            options.threads = std::stoul(argv[++i]);
+        } else if (arg == "--samples" && hasValue) {
+            options.samples = std::stoul(argv[++i]);
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    return options;
+}
+
+// Peak resident set of the process in MB
+double PeakResidentMb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.;
+}
+
+void Random(const std::string& path, std::size_t rows, std::size_t cols, const Options& options) {
+    auto file = MatrixFile::Create(path, rows, cols, options.tile);
+    std::mt19937 gen(options.seed);
+    std::uniform_real_distribution<float> dist(-1, 1);
+    for (std::size_t ti = 0; ti < file.TileRows(); ++ti) {
+        for (std::size_t tj = 0; tj < file.TileCols(); ++tj) {
+            const auto tile = file.Tile(ti, tj);
+            for (std::size_t i = 0; i < tile.Rows(); ++i) {
+                for (std::size_t j = 0; j < tile.Cols(); ++j) {
+                    tile(i, j) = dist(gen);
+                }
+            }
+            file.Evict(ti, tj);
+        }
+    }
+    file.Sync();
+}
+
+void Multiply(const std::string& lhsPath, const std::string& rhsPath, const std::string& outPath, const Options& options) {
+    const auto lhs = MatrixFile::Open(lhsPath);
+    const auto rhs = MatrixFile::Open(rhsPath);
+    if (lhs.Cols() != rhs.Rows()) {
+        std::cerr << "Cannot multiply " << lhs.Rows() << "x" << lhs.Cols() << " by " << rhs.Rows() << "x" << rhs.Cols()
+            << std::endl;
+        std::exit(1);
+    }
+    auto out = MatrixFile::Create(outPath, lhs.Rows(), rhs.Cols(), lhs.TileSize());
+    const auto start = std::chrono::steady_clock::now();
+    MultiplyOutOfCore(lhs, rhs, out, {.threads = options.threads, .affinity = {}, .isa = {}});
+    out.Sync();
+    const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start;
+    const double flops = 2. * lhs.Rows() * lhs.Cols() * rhs.Cols();
+    std::cerr << lhs.Rows() << "x" << lhs.Cols() << "x" << rhs.Cols() << " in tiles of " << lhs.TileSize() << ": "
+        << seconds.count() << " s, " << flops / seconds.count() / 1e9 << " GFLOP/s, peak resident "
+        << PeakResidentMb() << " MB" << std::endl;
+}
+
+// Largest error of sampled elements relative to sum |a| |b| of their dot products, in units of depth * epsilon
+bool Check(const std::string& lhsPath, const std::string& rhsPath, const std::string& outPath, const Options& options) {
+    const auto lhs = MatrixFile::Open(lhsPath);
+    const auto rhs = MatrixFile::Open(rhsPath);
+    const auto out = MatrixFile::Open(outPath);
+    std::mt19937 gen(options.seed);
+    std::uniform_int_distribution<std::size_t> row(0, out.Rows() - 1);
+    std::uniform_int_distribution<std::size_t> col(0, out.Cols() - 1);
+    double error = 0;
+    for (std::size_t s = 0; s < options.samples; ++s) {
+        const auto i = row(gen);
+        const auto j = col(gen);
+        double exact = 0;
+        double magnitude = 0;
+        for (std::size_t k = 0; k < lhs.Cols(); ++k) {
+            exact += static_cast<double>(lhs(i, k)) * rhs(k, j);
+            magnitude += std::abs(static_cast<double>(lhs(i, k)) * rhs(k, j));
+        }
+        const double bound = std::max<double>(lhs.Cols(), 1) * std::numeric_limits<float>::epsilon() * magnitude;
+        error = std::max(error, bound > 0 ? std::abs(out(i, j) - exact) / bound : std::abs(out(i, j) - exact));
+    }
+    std::cerr << options.samples << " samples, error " << error << (error <= 1 ? "" : " FAILED") << std::endl;
+    return error <= 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 5) {
+        Usage(argv[0]);
+    }
+    const std::string_view command = argv[1];
+    const auto options = ParseOptions(argc, argv, 5);
+    if (command == "random") {
+        Random(argv[2], std::stoul(argv[3]), std::stoul(argv[4]), options);
+    } else if (command == "multiply") {
+        Multiply(argv[2], argv[3], argv[4], options);
+    } else if (command == "check") {
+        return Check(argv[2], argv[3], argv[4], options) ? 0 : 1;
+    } else {
+        Usage(argv[0]);
+    }
+    return 0;
+}
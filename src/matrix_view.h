@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <type_traits>
+
+/*
+ * MatrixView is a non-owning window into floats: element (i, j) is at data[i * rowStride + j * colStride].
+ * Submatrices and transposes are views of the same memory, nothing is copied.
+ * T is float or const float, a mutable view converts to a const one.
+ */
+template <class T>
+class MatrixView {
+public:
+    MatrixView() = default;
+
+    MatrixView(T* data, std::size_t rows, std::size_t cols, std::size_t rowStride, std::size_t colStride = 1)
+        : data_(data)
+        , rows_(rows)
+        , cols_(cols)
+        , rowStride_(rowStride)
+        , colStride_(colStride)
+    {}
+
+    template <class U>
+    requires std::is_same_v<const U, T>
+    MatrixView(const MatrixView<U>& other)
+        : MatrixView(other.Data(), other.Rows(), other.Cols(), other.RowStride(), other.ColStride())
+    {}
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    std::size_t RowStride() const {
+        return rowStride_;
+    }
+
+    std::size_t ColStride() const {
+        return colStride_;
+    }
+
+    T* Data() const {
+        return data_;
+    }
+
+    // Elements of a row are adjacent in memory, false for a transposed view
+    bool RowMajor() const {
+        return colStride_ == 1;
+    }
+
+    T& operator()(std::size_t i, std::size_t j) const {
+        return data_[i * rowStride_ + j * colStride_];
+    }
+
+    // Rows [row, row + rows) and columns [col, col + cols)
+    MatrixView Block(std::size_t row, std::size_t col, std::size_t rows, std::size_t cols) const {
+        assert(row + rows <= rows_ && col + cols <= cols_);
+        return {data_ + row * rowStride_ + col * colStride_, rows, cols, rowStride_, colStride_};
+    }
+
+    MatrixView Transposed() const {
+        return {data_, cols_, rows_, colStride_, rowStride_};
+    }
+
+private:
+    T* data_ = nullptr;
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    std::size_t rowStride_ = 0;
+    std::size_t colStride_ = 1;
+};
+
+template <class T, class U>
+bool Near(const MatrixView<T>& lhs, const MatrixView<U>& rhs, float tolerance = 1e-4) {
+    if (lhs.Rows() != rhs.Rows() || lhs.Cols() != rhs.Cols()) {
+        return false;
+    }
+    for (std::size_t i = 0; i < lhs.Rows(); ++i) {
+        for (std::size_t j = 0; j < lhs.Cols(); ++j) {
+            if (std::abs(lhs(i, j) - rhs(i, j)) > tolerance) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
@@ -121,14 +121,19 @@ public:
         sf::RectangleShape emptyShape({CELL_SIZE - 2 * DIFF, CELL_SIZE - 2 * DIFF});
         emptyShape.setFillColor(utils::LIGHT_GREY);
 
-        for (const auto& row : grid_) {
-            for (const auto& cell : row) {
+        const auto view = utils::ViewRect(window);
+        const auto iBegin = static_cast<std::size_t>(std::max(0.f, view.top / CELL_SIZE));
+        const auto iEnd = std::min(grid_.size(), static_cast<std::size_t>(std::max(0.f, (view.top + view.height) / CELL_SIZE + 1)));
+        const auto jBegin = static_cast<std::size_t>(std::max(0.f, view.left / CELL_SIZE));
+        const auto jEnd = std::min(grid_[0].size(), static_cast<std::size_t>(std::max(0.f, (view.left + view.width) / CELL_SIZE + 1)));
+        for (std::size_t i = iBegin; i < iEnd; ++i) {
+            for (std::size_t j = jBegin; j < jEnd; ++j) {
+                const auto& cell = grid_[i][j];
                 cellShape.setPosition(cell.pos + WindXy{DIFF, DIFF});
                 window.draw(cellShape);
 
                 if (cell.content & CellContent::Flag) {
                     utils::DisplayText(
-                        window,
                         cell.pos + WindXy{CELL_SIZE / 4, 0},
                         "F",
                         sf::Color::Blue,
@@ -141,7 +146,6 @@ public:
                             window.draw(emptyShape);
                         } else {
                             utils::DisplayText(
-                                window,
                                 cell.pos + WindXy{CELL_SIZE / 4, 0},
                                 std::to_string(cell.mines),
                                 sf::Color::Black,
@@ -158,7 +162,6 @@ public:
                     window.draw(mine);
                 } else if (cell.mines > 0 && showMines_) {
                     utils::DisplayText(
-                        window,
                         cell.pos + WindXy{CELL_SIZE / 4, 0},
                         std::to_string(cell.mines),
                         sf::Color::Black,
@@ -169,7 +172,6 @@ public:
         if (state_ == State::Win) {
             showMines_ = true;
             utils::DisplayText(
-                window,
                 WindXy(window.getSize().x / 10, window.getSize().y / 10),
                 "WIN!",
                 TransparentBlack(),
@@ -177,7 +179,6 @@ public:
         } else if (state_ == State::Lost) {
             showMines_ = true;
             utils::DisplayText(
-                window,
                 WindXy(window.getSize().x / 10, window.getSize().y / 10),
                 "LOST",
                 TransparentBlack(),
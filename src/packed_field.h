@@ -0,0 +1,493 @@
+#pragma once
+
+#include "field.h"
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace utils {
+
+enum class Precision {
+    Float,
+    // IEEE binary16
+    Half,
+    // int16 with one float scale per row
+    Fixed16,
+};
+
+namespace half {
+
+inline std::uint16_t FromFloatScalar(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const std::uint32_t sign = (bits >> 16) & 0x8000;
+    const std::uint32_t abs = bits & 0x7FFFFFFF;
+    if (abs >= 0x7F800000) {
+        // Inf stays inf, NaN stays quiet NaN
+        return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+    }
+    if (abs >= 0x477FF000) {
+        // Rounds to above the largest half
+        return sign | 0x7C00;
+    }
+    if (abs < 0x38800000) {
+        // Subnormal half or zero: the float is added to 0.5, which rounds the mantissa to nearest even
+        float magnitude;
+        std::memcpy(&magnitude, &abs, sizeof(magnitude));
+        magnitude += 0.5f;
+        std::uint32_t rounded;
+        std::memcpy(&rounded, &magnitude, sizeof(rounded));
+        return sign | (rounded - 0x3F000000);
+    }
+    // Rebias the exponent and round the 13 dropped bits to nearest even
+    const std::uint32_t odd = (abs >> 13) & 1;
+    return sign | ((abs + 0xC8000FFF + odd) >> 13);
+}
+
+inline float ToFloatScalar(std::uint16_t value) {
+    const std::uint32_t sign = static_cast<std::uint32_t>(value & 0x8000) << 16;
+    const std::uint32_t exponent = (value >> 10) & 0x1F;
+    const std::uint32_t mantissa = value & 0x3FF;
+    std::uint32_t bits;
+    if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else {
+        // Zero or subnormal: mantissa * 2^-24
+        const float magnitude = std::ldexp(static_cast<float>(mantissa), -24);
+        std::memcpy(&bits, &magnitude, sizeof(bits));
+        bits |= sign;
+    }
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+__attribute__((target("avx,f16c")))
+inline void ToFloatF16c(const std::uint16_t* in, float* out, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(packed));
+    }
+    for (; i < count; ++i) {
+        out[i] = _cvtsh_ss(in[i]);
+    }
+}
+
+__attribute__((target("avx,f16c")))
+inline void FromFloatF16c(const float* in, std::uint16_t* out, std::size_t count) {
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        const __m128i packed = _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), packed);
+    }
+    for (; i < count; ++i) {
+        out[i] = _cvtss_sh(in[i], _MM_FROUND_TO_NEAREST_INT);
+    }
+}
+
+inline bool HasF16c() {
+    static const bool has = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+    return has;
+}
+
+__attribute__((target("f16c")))
+inline float ToFloatF16c(std::uint16_t value) {
+    return _cvtsh_ss(value);
+}
+
+inline float ToFloat(std::uint16_t value) {
+    return HasF16c() ? ToFloatF16c(value) : ToFloatScalar(value);
+}
+
+inline void ToFloat(const std::uint16_t* in, float* out, std::size_t count) {
+    if (HasF16c()) {
+        ToFloatF16c(in, out, count);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = ToFloatScalar(in[i]);
+    }
+}
+
+inline void FromFloat(const float* in, std::uint16_t* out, std::size_t count) {
+    if (HasF16c()) {
+        FromFloatF16c(in, out, count);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = FromFloatScalar(in[i]);
+    }
+}
+
+}  // namespace half
+
+namespace fixed16 {
+
+constexpr float MAX = 32767;
+
+inline bool HasAvx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+
+__attribute__((target("avx2")))
+inline void ToFloatAvx2(const std::int16_t* in, float* out, std::size_t count, float scale) {
+    const __m256 factor = _mm256_set1_ps(scale);
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        const __m256i low = _mm256_cvtepi16_epi32(_mm256_castsi256_si128(packed));
+        const __m256i high = _mm256_cvtepi16_epi32(_mm256_extracti128_si256(packed, 1));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(low), factor));
+        _mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(high), factor));
+    }
+    for (; i < count; ++i) {
+        out[i] = in[i] * scale;
+    }
+}
+
+// Eight values times factor rounded half away from zero like the scalar loop, so both paths store the same values
+__attribute__((target("avx2")))
+inline __m256i RoundAvx2(const float* in, __m256 factor) {
+    const __m256 scaled = _mm256_mul_ps(_mm256_loadu_ps(in), factor);
+    const __m256 half = _mm256_or_ps(_mm256_set1_ps(0.5f), _mm256_and_ps(scaled, _mm256_set1_ps(-0.f)));
+    return _mm256_cvttps_epi32(_mm256_add_ps(scaled, half));
+}
+
+__attribute__((target("avx2")))
+inline float FromFloatAvx2(const float* in, std::int16_t* out, std::size_t count) {
+    const __m256 signMask = _mm256_set1_ps(-0.f);
+    __m256 max8 = _mm256_setzero_ps();
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // Ignores NaN like std::max(max, NaN) does
+        max8 = _mm256_max_ps(_mm256_andnot_ps(signMask, _mm256_loadu_ps(in + i)), max8);
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, max8);
+    float max = *std::max_element(lanes, lanes + 8);
+    for (; i < count; ++i) {
+        max = std::max(max, std::abs(in[i]));
+    }
+    const float scale = max > 0 ? max / MAX : 1;
+    const float invScale = 1 / scale;
+
+    const __m256 factor = _mm256_set1_ps(invScale);
+    i = 0;
+    for (; i + 16 <= count; i += 16) {
+        // packs interleaves the 128-bit lanes of its operands, the permute puts them back in order
+        const __m256i packed = _mm256_packs_epi32(RoundAvx2(in + i, factor), RoundAvx2(in + i + 8, factor));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    for (; i < count; ++i) {
+        const float scaled = in[i] * invScale;
+        out[i] = static_cast<std::int16_t>(scaled + (scaled < 0 ? -0.5f : 0.5f));
+    }
+    return scale;
+}
+
+inline void ToFloat(const std::int16_t* in, float* out, std::size_t count, float scale) {
+    if (HasAvx2()) {
+        ToFloatAvx2(in, out, count, scale);
+        return;
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        out[i] = in[i] * scale;
+    }
+}
+
+// Stores values / scale rounded to int16 with the scale that maps the largest magnitude to MAX, returns the scale
+inline float FromFloat(const float* in, std::int16_t* out, std::size_t count) {
+    if (HasAvx2()) {
+        return FromFloatAvx2(in, out, count);
+    }
+    float max = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        max = std::max(max, std::abs(in[i]));
+    }
+    const float scale = max > 0 ? max / MAX : 1;
+    const float invScale = 1 / scale;
+    for (std::size_t i = 0; i < count; ++i) {
+        const float scaled = in[i] * invScale;
+        out[i] = static_cast<std::int16_t>(scaled + (scaled < 0 ? -0.5f : 0.5f));
+    }
+    return scale;
+}
+
+}  // namespace fixed16
+
+// The first count of eight values, nothing past them is written
+__attribute__((target("avx2")))
+inline void StoreFloats(float* out, __m256 values, std::size_t count) {
+    if (count >= 8) {
+        _mm256_storeu_ps(out, values);
+        return;
+    }
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    _mm256_maskstore_ps(out, _mm256_cmpgt_epi32(_mm256_set1_epi32(count), lanes), values);
+}
+
+/*
+ * PackedField keeps a 2D grid of floats as float, fp16 or 16-bit fixed point with a scale per row.
+ * Kernels compute in float. With AVX2 and F16C they convert eight values at a time in registers:
+ * Load8, Store8 and Sample8 read and write the packed rows directly, so a packed field moves half
+ * the bytes of a float one and no row is decoded to memory. Otherwise Read decodes a whole row into
+ * a per-thread float buffer, Writable and Commit encode one back, and the extra passes make packed
+ * fields slower than Float. With Float precision rows are used in place and nothing is copied.
+ */
+class PackedField {
+public:
+    PackedField() = default;
+
+    PackedField(std::size_t rows, std::size_t cols, Precision precision = Precision::Float)
+        : precision_(precision)
+        , rows_(rows)
+        , cols_(cols)
+    {
+        if (precision_ == Precision::Float) {
+            floats_ = Field<float>(rows, cols);
+        } else {
+            packed_ = Field<std::uint16_t>(rows, cols);
+            scales_.assign(rows, 1);
+        }
+    }
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    Precision GetPrecision() const {
+        return precision_;
+    }
+
+    std::size_t BytesPerCell() const {
+        return precision_ == Precision::Float ? sizeof(float) : sizeof(std::uint16_t);
+    }
+
+    // Row i as floats, decoded into buffer (Cols() floats) unless it is stored as float
+    const float* Read(std::size_t i, float* buffer) const {
+        switch (precision_) {
+        case Precision::Float:
+            return floats_.Row(i);
+        case Precision::Half:
+            half::ToFloat(packed_.Row(i), buffer, cols_);
+            return buffer;
+        case Precision::Fixed16:
+            fixed16::ToFloat(reinterpret_cast<const std::int16_t*>(packed_.Row(i)), buffer, cols_, scales_[i]);
+            return buffer;
+        }
+        return buffer;
+    }
+
+    // Where to put the new values of row i, they are stored by Commit(i, the same pointer)
+    float* Writable(std::size_t i, float* buffer) {
+        return precision_ == Precision::Float ? floats_.Row(i) : buffer;
+    }
+
+    // Like Writable, but holding the current values of row i
+    float* Modify(std::size_t i, float* buffer) {
+        if (precision_ == Precision::Float) {
+            return floats_.Row(i);
+        }
+        Read(i, buffer);
+        return buffer;
+    }
+
+    void Commit(std::size_t i, const float* values) {
+        switch (precision_) {
+        case Precision::Float:
+            if (values != floats_.Row(i)) {
+                std::copy(values, values + cols_, floats_.Row(i));
+            }
+            return;
+        case Precision::Half:
+            half::FromFloat(values, packed_.Row(i), cols_);
+            return;
+        case Precision::Fixed16:
+            scales_[i] = fixed16::FromFloat(values, reinterpret_cast<std::int16_t*>(packed_.Row(i)), cols_);
+            return;
+        }
+    }
+
+    // Whether Load8, Store8 and Sample8 can run on this CPU
+    static bool HasAvx2() {
+        return half::HasF16c() && fixed16::HasAvx2();
+    }
+
+    // The eight values of row i from column j, a multiple of 8. Columns past Cols() read the zeros of the row padding.
+    __attribute__((target("avx2,f16c")))
+    __m256 Load8(std::size_t i, std::size_t j) const {
+        switch (precision_) {
+        case Precision::Float:
+            return _mm256_load_ps(floats_.Row(i) + j);
+        case Precision::Half:
+            return _mm256_cvtph_ps(_mm_load_si128(reinterpret_cast<const __m128i*>(packed_.Row(i) + j)));
+        case Precision::Fixed16: {
+            const __m128i packed = _mm_load_si128(reinterpret_cast<const __m128i*>(packed_.Row(i) + j));
+            return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(packed)), _mm256_set1_ps(scales_[i]));
+        }
+        }
+        return _mm256_setzero_ps();
+    }
+
+    /*
+     * Float and Half rows are stored by Store8 in place. A Fixed16 row needs its largest value for the scale,
+     * so BeginStore8 decodes it into buffer, Store8 writes there and EndStore8 encodes it.
+     */
+    float* BeginStore8(std::size_t i, float* buffer) {
+        return precision_ == Precision::Fixed16 ? Modify(i, buffer) : nullptr;
+    }
+
+    // Stores eight values to row i from column j, a multiple of 8, the ones past Cols() are dropped
+    __attribute__((target("avx2,f16c")))
+    void Store8(std::size_t i, std::size_t j, __m256 values, float* row) {
+        const std::size_t count = std::min<std::size_t>(8, cols_ - j);
+        switch (precision_) {
+        case Precision::Float:
+            StoreFloats(floats_.Row(i) + j, values, count);
+            return;
+        case Precision::Half: {
+            alignas(16) std::uint16_t packed[8];
+            _mm_store_si128(reinterpret_cast<__m128i*>(packed), _mm256_cvtps_ph(values, _MM_FROUND_TO_NEAREST_INT));
+            std::copy(packed, packed + count, packed_.Row(i) + j);
+            return;
+        }
+        case Precision::Fixed16:
+            StoreFloats(row + j, values, count);
+            return;
+        }
+    }
+
+    void EndStore8(std::size_t i, const float* row) {
+        if (row) {
+            Commit(i, row);
+        }
+    }
+
+    // Sample8 indexes the grid from its first value with int32
+    bool CanSample8() const {
+        const std::size_t stride = precision_ == Precision::Float ? floats_.Stride() : packed_.Stride();
+        return rows_ >= 2 && cols_ >= 2 && rows_ * stride < (std::size_t(1) << 31);
+    }
+
+    // utils::Sample at eight positions, (x, y) in cells, the two values of each corner row gathered as one 32-bit lane
+    __attribute__((target("avx2,f16c")))
+    __m256 Sample8(__m256 x, __m256 y) const {
+        x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(cols_ - 1.f));
+        y = _mm256_min_ps(_mm256_max_ps(y, _mm256_setzero_ps()), _mm256_set1_ps(rows_ - 1.f));
+        const __m256i x0 = _mm256_min_epi32(_mm256_cvttps_epi32(x), _mm256_set1_epi32(cols_ - 2));
+        const __m256i y0 = _mm256_min_epi32(_mm256_cvttps_epi32(y), _mm256_set1_epi32(rows_ - 2));
+        const __m256 wx = _mm256_sub_ps(x, _mm256_cvtepi32_ps(x0));
+        const __m256 wy = _mm256_sub_ps(y, _mm256_cvtepi32_ps(y0));
+        const std::size_t stride = precision_ == Precision::Float ? floats_.Stride() : packed_.Stride();
+        const __m256i index = _mm256_add_epi32(_mm256_mullo_epi32(y0, _mm256_set1_epi32(stride)), x0);
+        __m256 topLeft, topRight, bottomLeft, bottomRight;
+        GatherPairs(index, y0, topLeft, topRight);
+        GatherPairs(_mm256_add_epi32(index, _mm256_set1_epi32(stride)), _mm256_add_epi32(y0, _mm256_set1_epi32(1)),
+            bottomLeft, bottomRight);
+        const __m256 one = _mm256_set1_ps(1);
+        const __m256 restX = _mm256_sub_ps(one, wx);
+        const __m256 top = _mm256_add_ps(_mm256_mul_ps(restX, topLeft), _mm256_mul_ps(wx, topRight));
+        const __m256 bottom = _mm256_add_ps(_mm256_mul_ps(restX, bottomLeft), _mm256_mul_ps(wx, bottomRight));
+        return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(one, wy), top), _mm256_mul_ps(wy, bottom));
+    }
+
+    // Single value, for random access like bilinear sampling
+    float operator()(std::size_t i, std::size_t j) const {
+        switch (precision_) {
+        case Precision::Float:
+            return floats_(i, j);
+        case Precision::Half:
+            return half::ToFloat(packed_(i, j));
+        case Precision::Fixed16:
+            return static_cast<std::int16_t>(packed_(i, j)) * scales_[i];
+        }
+        return 0;
+    }
+
+    double Sum() const {
+        std::vector<float> buffer(cols_);
+        double sum = 0;
+        for (std::size_t i = 0; i < rows_; ++i) {
+            const float* row = Read(i, buffer.data());
+            for (std::size_t j = 0; j < cols_; ++j) {
+                sum += row[j];
+            }
+        }
+        return sum;
+    }
+
+    void Convert(Precision precision) {
+        if (precision == precision_) {
+            return;
+        }
+        PackedField converted(rows_, cols_, precision);
+        std::vector<float> buffer(cols_);
+        for (std::size_t i = 0; i < rows_; ++i) {
+            converted.Commit(i, Read(i, buffer.data()));
+        }
+        swap(*this, converted);
+    }
+
+    friend void swap(PackedField& lhs, PackedField& rhs) noexcept {
+        std::swap(lhs.precision_, rhs.precision_);
+        std::swap(lhs.rows_, rhs.rows_);
+        std::swap(lhs.cols_, rhs.cols_);
+        swap(lhs.floats_, rhs.floats_);
+        swap(lhs.packed_, rhs.packed_);
+        lhs.scales_.swap(rhs.scales_);
+    }
+
+private:
+    // The values at index and index + 1 counted from the first value of the grid, in rows
+    __attribute__((target("avx2,f16c")))
+    void GatherPairs(__m256i index, __m256i rows, __m256& first, __m256& second) const {
+        switch (precision_) {
+        case Precision::Float:
+            first = _mm256_i32gather_ps(floats_.Row(0), index, sizeof(float));
+            second = _mm256_i32gather_ps(floats_.Row(0) + 1, index, sizeof(float));
+            return;
+        case Precision::Half: {
+            const __m256i pairs = _mm256_i32gather_epi32(
+                reinterpret_cast<const int*>(packed_.Row(0)), index, sizeof(std::uint16_t));
+            const __m256i halves = _mm256_packus_epi32(
+                _mm256_and_si256(pairs, _mm256_set1_epi32(0xFFFF)), _mm256_srli_epi32(pairs, 16));
+            // packus interleaves the 128-bit lanes of its operands, the permute puts the first values in the low half
+            const __m256i ordered = _mm256_permute4x64_epi64(halves, 0xD8);
+            first = _mm256_cvtph_ps(_mm256_castsi256_si128(ordered));
+            second = _mm256_cvtph_ps(_mm256_extracti128_si256(ordered, 1));
+            return;
+        }
+        case Precision::Fixed16: {
+            const __m256i pairs = _mm256_i32gather_epi32(
+                reinterpret_cast<const int*>(packed_.Row(0)), index, sizeof(std::uint16_t));
+            const __m256 scale = _mm256_i32gather_ps(scales_.data(), rows, sizeof(float));
+            first = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(pairs, 16), 16)), scale);
+            second = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srai_epi32(pairs, 16)), scale);
+            return;
+        }
+        }
+        first = second = _mm256_setzero_ps();
+    }
+
+    Precision precision_ = Precision::Float;
+    std::size_t rows_ = 0;
+    std::size_t cols_ = 0;
+    Field<float> floats_;
+    Field<std::uint16_t> packed_;
+    std::vector<float> scales_;
+};
+
+}  // namespace utils
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <latch>
+#include <mutex>
+#include <thread>
+
+namespace utils {
+
+inline std::size_t NumThreads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline boost::asio::thread_pool& ThreadPool() {
+    static boost::asio::thread_pool pool(NumThreads());
+    return pool;
+}
+
+inline thread_local bool gInParallelFor = false;
+
+/*
+ * Calls f(from, to) on disjoint chunks of [begin, end) on the shared pool and waits.
+ * A nested call from inside a chunk runs inline, so waiting never starves the pool.
+ * If chunks throw, every chunk still finishes and the first exception is rethrown to the caller.
+ */
+template <class F>
+void ParallelFor(std::size_t begin, std::size_t end, F&& f, std::size_t minChunk = 1) {
+    if (begin >= end) {
+        return;
+    }
+    auto chunks = std::min(NumThreads(), (end - begin + minChunk - 1) / minChunk);
+    if (chunks <= 1 || gInParallelFor) {
+        f(begin, end);
+        return;
+    }
+
+    const auto chunkSize = (end - begin + chunks - 1) / chunks;
+    chunks = (end - begin + chunkSize - 1) / chunkSize;
+    std::latch done(chunks - 1);
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    const auto run = [&](std::size_t from, std::size_t to) {
+        gInParallelFor = true;
+        try {
+            f(from, to);
+        } catch (...) {
+            std::lock_guard lock(errorMutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+        }
+        gInParallelFor = false;
+    };
+    for (std::size_t from = begin + chunkSize; from < end; from += chunkSize) {
+        const auto to = std::min(end, from + chunkSize);
+        boost::asio::post(ThreadPool(), [&run, &done, from, to]() {
+            run(from, to);
+            done.count_down();
+        });
+    }
+    run(begin, begin + chunkSize);
+    done.wait();
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+}  // namespace utils
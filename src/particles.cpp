@@ -1,4 +1,5 @@
 #include "particles.h"
+#include "world.h"
 
 #include <boost/asio.hpp>
 #include <SFML/Graphics/Text.hpp>
@@ -38,13 +39,17 @@ bool Particles::Add(float atx, float aty, float ax, float ay, float vx, float vy
 }
 
 void Particles::Render(sf::RenderTarget& window, float part) {
+    const auto view = ViewRect(window);
     for (std::size_t i = 0; i < physics.Size(); ++i) {
+        if (!view.intersects(physics.shapes[i])) {
+            continue;
+        }
         auto shape = sf::RectangleShape({physics.shapes[i].width, physics.shapes[i].height});
         shape.setPosition(physics.shapes[i].left, physics.shapes[i].top);
         shape.move(physics.velocities[i] * part);
         shape.setFillColor(LIGHT_GREY);
         window.draw(shape);
-//        DisplayText(window, shape.getPosition(), std::to_string(i), 20);
+//        DisplayText(shape.getPosition(), std::to_string(i), 20);
     }
     decltype(toRender) toRenderNext;
     for (auto& [shape, tick] : toRender) {
@@ -415,14 +420,7 @@ void Particles::Update(sf::RenderTarget& window, const std::vector<Physics*>& ot
     }
     std::vector<std::size_t> dead;
     for (std::size_t i = 0; i < physics.Size(); ++i) {
-        const auto& rect = physics.shapes[i];
-        const float windX = window.getSize().x;
-        const float windY = window.getSize().y;
-        if (rect.left > windX ||
-            rect.top > windY ||
-            rect.left + rect.width < -windX ||
-            rect.top + rect.height < -windY)
-        {
+        if (!gWorld.bounds.intersects(physics.shapes[i])) {
             dead.push_back(i);
         }
     }
@@ -1,3 +1,4 @@
+#include "chunks.h"
 
 struct ParticlesSimulation {
     ParticlesSimulation();
@@ -23,21 +24,24 @@ struct ParticlesSimulation {
 
     void Update(sf::RenderWindow& window) {
         if (spammingBricks) {
-            auto [x, y] = sf::Mouse::getPosition(window);
+            const auto pos = window.mapPixelToCoords(sf::Mouse::getPosition(window), gWorld.view);
             particles.Add(
-                WindXy(x, y),
+                pos,
                 {0, 0},
                 sf::Vector2f(Rand(-0.5, 0.5), Rand(-0.5, 0.5)),
                 sf::Vector2f(Rand(10, 20), Rand(10, 20))
             );
         }
 
+        streamer.Stream(particles.physics, gWorld.ActiveRegion());
+        gStats["stored bodies"] = streamer.StoredBodies();
         earthGravity.Apply(particles.physics);
         particles.Update(window, {});
 //        texture.getTexture().copyToImage().saveToFile("screenshot_" + std::to_string(tick) + ".png");
     }
 
     Particles particles;
+    ChunkStreamer<sf::FloatRect> streamer;
     GravityForce earthGravity = {
         1e11,
         {WIDTH / 2, 1'000'000},
@@ -1,3 +1,5 @@
+#pragma once
+
 #include "utils.h"
 
 #include <SFML/System/Vector2.hpp>
@@ -24,6 +26,30 @@ struct Physics {
         properties.erase(properties.begin() + index);
     }
 
+    // Removes the bodies for which pred(index) is true, keeping the order of the rest
+    template <class Pred>
+    void EraseIf(Pred&& pred) {
+        std::size_t size = 0;
+        for (std::size_t i = 0; i < Size(); ++i) {
+            if (pred(i)) {
+                continue;
+            }
+            if (size != i) {
+                shapes[size] = std::move(shapes[i]);
+                accelerations[size] = accelerations[i];
+                velocities[size] = velocities[i];
+                masses[size] = masses[i];
+                properties[size] = properties[i];
+            }
+            ++size;
+        }
+        shapes.resize(size);
+        accelerations.resize(size);
+        velocities.resize(size);
+        masses.resize(size);
+        properties.resize(size);
+    }
+
     void PushBack(
         TShape shape,
         sf::Vector2f velocity,
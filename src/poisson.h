@@ -0,0 +1,388 @@
+#pragma once
+
+#include "field.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace fluid {
+
+using utils::Field;
+
+struct SolveStats {
+    // ||b - Ax|| / ||b||
+    float residual = 0;
+    int iterations = 0;
+    double milliseconds = 0;
+};
+
+enum class SolverType {
+    Multigrid,
+    ConjugateGradient,
+};
+
+/*
+ * PoissonSolver solves  n * p(i, j) - sum of p over the n open neighbours = b(i, j)
+ * on a rectangle with solid walls (zero normal pressure gradient) around it.
+ * The solution is defined up to a constant, it is returned with zero mean.
+ * Optionally some cells are air, their pressure is fixed at zero and the solution is unique.
+ *
+ * Multigrid runs V-cycles with a parallel red-black Gauss-Seidel smoother,
+ * its cost per cycle is linear in the number of cells and the number of cycles
+ * does not grow with the grid. ConjugateGradient is Jacobi-preconditioned.
+ */
+class PoissonSolver {
+public:
+    PoissonSolver() = default;
+
+    PoissonSolver(std::size_t rows, std::size_t cols) {
+        while (true) {
+            levels_.push_back({
+                Field<float>(rows, cols),
+                Field<float>(rows, cols),
+                Field<float>(rows, cols),
+                Field<std::uint8_t>(rows, cols, 1),
+            });
+            if (rows <= COARSEST || cols <= COARSEST) {
+                break;
+            }
+            rows = (rows + 1) / 2;
+            cols = (cols + 1) / 2;
+        }
+        direction_ = Field<float>(levels_[0].x.Rows(), levels_[0].x.Cols());
+        product_ = Field<float>(levels_[0].x.Rows(), levels_[0].x.Cols());
+        preconditioned_ = Field<float>(levels_[0].x.Rows(), levels_[0].x.Cols());
+        rowSums_.resize(levels_[0].x.Rows());
+    }
+
+    // fluid(i, j) == 0 marks an air cell, without the mask every cell is fluid
+    SolveStats Solve(Field<float>& pressure, const Field<float>& rhs, const Field<std::uint8_t>* fluid = nullptr) {
+        const auto start = std::chrono::steady_clock::now();
+
+        SetFluid(fluid);
+        auto& top = levels_[0];
+        top.b = rhs;
+        top.x = pressure;
+        if (hasAir_) {
+            Mask(top.b, top.fluid);
+            Mask(top.x, top.fluid);
+        } else {
+            Add(top.b, -top.b.Sum() / (top.b.Rows() * top.b.Cols()));
+        }
+
+        if (type == SolverType::Multigrid) {
+            stats_ = SolveMultigrid();
+        } else {
+            stats_ = SolveConjugateGradient();
+        }
+
+        if (!hasAir_) {
+            Add(top.x, -top.x.Sum() / (top.x.Rows() * top.x.Cols()));
+        }
+        pressure = top.x;
+
+        stats_.milliseconds = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        return stats_;
+    }
+
+    const SolveStats& LastStats() const {
+        return stats_;
+    }
+
+    SolverType type = SolverType::Multigrid;
+    float tolerance = 1e-4;
+    int maxIterations = 100;
+
+private:
+    static constexpr std::size_t COARSEST = 4;
+    static constexpr int SMOOTHING_STEPS = 2;
+    static constexpr int COARSEST_STEPS = 50;
+
+    struct Level {
+        Field<float> x;
+        Field<float> b;
+        Field<float> r;
+        // A coarse cell is fluid only if all its fine cells are, a coarser fluid region
+        // would overcorrect near the air and the cycles diverge
+        Field<std::uint8_t> fluid;
+    };
+
+    void SetFluid(const Field<std::uint8_t>* fluid) {
+        if (!fluid && !hasAir_) {
+            return;
+        }
+        auto& top = levels_[0].fluid;
+        if (fluid) {
+            top = *fluid;
+        } else {
+            top.Fill(1);
+        }
+        hasAir_ = false;
+        for (std::size_t i = 0; i < top.Rows() && !hasAir_; ++i) {
+            hasAir_ = std::find(top.Row(i), top.Row(i) + top.Cols(), 0) != top.Row(i) + top.Cols();
+        }
+        for (std::size_t depth = 1; depth < levels_.size(); ++depth) {
+            const auto& fine = levels_[depth - 1].fluid;
+            auto& coarse = levels_[depth].fluid;
+            coarse.Fill(1);
+            for (std::size_t i = 0; i < fine.Rows(); ++i) {
+                for (std::size_t j = 0; j < fine.Cols(); ++j) {
+                    coarse(i / 2, j / 2) &= fine(i, j);
+                }
+            }
+        }
+    }
+
+    // Zeroes the air cells
+    static void Mask(Field<float>& f, const Field<std::uint8_t>& fluid) {
+        for (std::size_t i = 0; i < f.Rows(); ++i) {
+            for (std::size_t j = 0; j < f.Cols(); ++j) {
+                f(i, j) *= fluid(i, j);
+            }
+        }
+    }
+
+    static int Neighbors(const Field<float>& f, std::size_t i, std::size_t j) {
+        return (i > 0) + (i + 1 < f.Rows()) + (j > 0) + (j + 1 < f.Cols());
+    }
+
+    static float NeighborSum(const Field<float>& x, std::size_t i, std::size_t j) {
+        const auto row = x.Row(i);
+        float sum = 0;
+        if (j > 0) {
+            sum += row[j - 1];
+        }
+        if (j + 1 < x.Cols()) {
+            sum += row[j + 1];
+        }
+        if (i > 0) {
+            sum += x.Row(i - 1)[j];
+        }
+        if (i + 1 < x.Rows()) {
+            sum += x.Row(i + 1)[j];
+        }
+        return sum;
+    }
+
+    static void Add(Field<float>& f, float value) {
+        for (std::size_t i = 0; i < f.Rows(); ++i) {
+            auto row = f.Row(i);
+            for (std::size_t j = 0; j < f.Cols(); ++j) {
+                row[j] += value;
+            }
+        }
+    }
+
+    // out = b - A x, returns ||out||^2. Air cells keep x = 0, so they drop out of the neighbour sums
+    float Residual(const Field<float>& x, const Field<float>& b, const Field<std::uint8_t>& fluid, Field<float>& out) {
+        utils::ParallelFor(0, x.Rows(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                double sum = 0;
+                for (std::size_t j = 0; j < x.Cols(); ++j) {
+                    const float r = fluid(i, j)
+                        ? b(i, j) - Neighbors(x, i, j) * x(i, j) + NeighborSum(x, i, j)
+                        : 0;
+                    out(i, j) = r;
+                    sum += r * r;
+                }
+                rowSums_[i] = sum;
+            }
+        });
+        return SumRows(x.Rows());
+    }
+
+    float Dot(const Field<float>& lhs, const Field<float>& rhs) {
+        utils::ParallelFor(0, lhs.Rows(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                const auto l = lhs.Row(i);
+                const auto r = rhs.Row(i);
+                double sum = 0;
+                for (std::size_t j = 0; j < lhs.Cols(); ++j) {
+                    sum += l[j] * r[j];
+                }
+                rowSums_[i] = sum;
+            }
+        });
+        return SumRows(lhs.Rows());
+    }
+
+    float SumRows(std::size_t rows) const {
+        double sum = 0;
+        for (std::size_t i = 0; i < rows; ++i) {
+            sum += rowSums_[i];
+        }
+        return sum;
+    }
+
+    // Cells of one colour only depend on cells of the other one, so rows are updated in parallel
+    static void Smooth(Field<float>& x, const Field<float>& b, const Field<std::uint8_t>& fluid, int steps) {
+        for (int step = 0; step < steps; ++step) {
+            for (std::size_t color = 0; color < 2; ++color) {
+                utils::ParallelFor(0, x.Rows(), [&](std::size_t from, std::size_t to) {
+                    for (std::size_t i = from; i < to; ++i) {
+                        for (std::size_t j = (i + color) % 2; j < x.Cols(); j += 2) {
+                            if (!fluid(i, j)) {
+                                continue;
+                            }
+                            x(i, j) = (b(i, j) + NeighborSum(x, i, j)) / Neighbors(x, i, j);
+                        }
+                    }
+                }, 16);
+            }
+        }
+    }
+
+    // The coarse cell covers 2x2 fine cells, with the unscaled operator the residuals add up
+    static void Restrict(const Field<float>& fine, Field<float>& coarse) {
+        coarse.Fill(0);
+        for (std::size_t i = 0; i < fine.Rows(); ++i) {
+            for (std::size_t j = 0; j < fine.Cols(); ++j) {
+                coarse(i / 2, j / 2) += fine(i, j);
+            }
+        }
+    }
+
+    // Bilinear interpolation between the centers of the coarse cells
+    static void ProlongAdd(const Field<float>& coarse, const Field<std::uint8_t>& fluid, Field<float>& fine) {
+        const int coarseRows = coarse.Rows();
+        const int coarseCols = coarse.Cols();
+        utils::ParallelFor(0, fine.Rows(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                const int ci = i / 2;
+                const int ni = std::clamp(ci + (i % 2 == 0 ? -1 : 1), 0, coarseRows - 1);
+                for (std::size_t j = 0; j < fine.Cols(); ++j) {
+                    const int cj = j / 2;
+                    const int nj = std::clamp(cj + (j % 2 == 0 ? -1 : 1), 0, coarseCols - 1);
+                    fine(i, j) += fluid(i, j) * (0.5625f * coarse(ci, cj)
+                        + 0.1875f * (coarse(ni, cj) + coarse(ci, nj))
+                        + 0.0625f * coarse(ni, nj));
+                }
+            }
+        }, 16);
+    }
+
+    void VCycle(std::size_t depth) {
+        auto& level = levels_[depth];
+        if (depth + 1 == levels_.size()) {
+            Smooth(level.x, level.b, level.fluid, COARSEST_STEPS);
+            return;
+        }
+        Smooth(level.x, level.b, level.fluid, SMOOTHING_STEPS);
+        Residual(level.x, level.b, level.fluid, level.r);
+
+        auto& coarse = levels_[depth + 1];
+        Restrict(level.r, coarse.b);
+        coarse.x.Fill(0);
+        VCycle(depth + 1);
+
+        ProlongAdd(coarse.x, level.fluid, level.x);
+        Smooth(level.x, level.b, level.fluid, SMOOTHING_STEPS);
+    }
+
+    SolveStats SolveMultigrid() {
+        auto& top = levels_[0];
+        const float norm = std::sqrt(Dot(top.b, top.b));
+        SolveStats stats;
+        if (norm == 0) {
+            top.x.Fill(0);
+            return stats;
+        }
+        stats.residual = std::sqrt(Residual(top.x, top.b, top.fluid, top.r)) / norm;
+        while (stats.residual > tolerance && stats.iterations < maxIterations) {
+            VCycle(0);
+            ++stats.iterations;
+            stats.residual = std::sqrt(Residual(top.x, top.b, top.fluid, top.r)) / norm;
+        }
+        return stats;
+    }
+
+    // z = M^-1 r with the diagonal M
+    void Precondition(const Field<float>& r, Field<float>& z) {
+        const auto& fluid = levels_[0].fluid;
+        utils::ParallelFor(0, r.Rows(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                for (std::size_t j = 0; j < r.Cols(); ++j) {
+                    z(i, j) = fluid(i, j) * r(i, j) / Neighbors(r, i, j);
+                }
+            }
+        });
+    }
+
+    // out = A in
+    void Apply(const Field<float>& in, Field<float>& out) {
+        const auto& fluid = levels_[0].fluid;
+        utils::ParallelFor(0, in.Rows(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                for (std::size_t j = 0; j < in.Cols(); ++j) {
+                    out(i, j) = fluid(i, j) * (Neighbors(in, i, j) * in(i, j) - NeighborSum(in, i, j));
+                }
+            }
+        });
+    }
+
+    // y += alpha * x
+    void Axpy(float alpha, const Field<float>& x, Field<float>& y) {
+        utils::ParallelFor(0, x.Rows(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                const auto xRow = x.Row(i);
+                const auto yRow = y.Row(i);
+                for (std::size_t j = 0; j < x.Cols(); ++j) {
+                    yRow[j] += alpha * xRow[j];
+                }
+            }
+        });
+    }
+
+    SolveStats SolveConjugateGradient() {
+        auto& top = levels_[0];
+        auto& r = top.r;
+        auto& z = preconditioned_;
+        SolveStats stats;
+        const float norm = std::sqrt(Dot(top.b, top.b));
+        if (norm == 0) {
+            top.x.Fill(0);
+            return stats;
+        }
+        Residual(top.x, top.b, top.fluid, r);
+        Precondition(r, direction_);
+        float rz = Dot(r, direction_);
+        stats.residual = std::sqrt(Dot(r, r)) / norm;
+        while (stats.residual > tolerance && stats.iterations < maxIterations) {
+            Apply(direction_, product_);
+            const float alpha = rz / Dot(direction_, product_);
+            Axpy(alpha, direction_, top.x);
+            Axpy(-alpha, product_, r);
+            ++stats.iterations;
+            stats.residual = std::sqrt(Dot(r, r)) / norm;
+
+            Precondition(r, z);
+            const float rzNext = Dot(r, z);
+            const float beta = rzNext / rz;
+            rz = rzNext;
+            utils::ParallelFor(0, z.Rows(), [&](std::size_t from, std::size_t to) {
+                for (std::size_t i = from; i < to; ++i) {
+                    for (std::size_t j = 0; j < z.Cols(); ++j) {
+                        direction_(i, j) = z(i, j) + beta * direction_(i, j);
+                    }
+                }
+            });
+        }
+        return stats;
+    }
+
+    std::vector<Level> levels_;
+    // Conjugate gradient state
+    Field<float> direction_;
+    Field<float> product_;
+    Field<float> preconditioned_;
+    std::vector<double> rowSums_;
+    bool hasAir_ = false;
+    SolveStats stats_;
+};
+
+}  // namespace fluid
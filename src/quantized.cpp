@@ -0,0 +1,347 @@
+#include "quantized.h"
+
+#include "aligned.h"
+#include "parallel.h"
+#include "quantized_kernels.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace quantized {
+
+namespace {
+
+// A KC x NC block of rhs stays in L3 and a strip of it in L1, as in gemm.cpp
+constexpr std::size_t NC = 4096;
+
+// Packing and dequantization of the int8 mode, depth in groups of 4 bytes
+struct Int8Mode {
+    using Matrix = Int8Matrix;
+    using Kernel = Int8Kernel;
+    using LhsValue = std::uint8_t;
+    using RhsValue = std::int8_t;
+    using Acc = std::int32_t;
+
+    static constexpr std::size_t GROUP = 4;
+    // A KC x 32 strip of rhs is 32 KB, an MC x KC block of lhs 192 KB
+    static constexpr std::size_t KC = 1024;
+    static constexpr std::size_t MC = 192;
+
+    static LhsValue Lhs(const Kernel& kernel, const Matrix& m, std::size_t i, std::size_t k) {
+        return static_cast<LhsValue>(m.Quantized(i, k) + kernel.lhsOffset);
+    }
+
+    static LhsValue LhsPadding(const Kernel& kernel) {
+        return static_cast<LhsValue>(kernel.lhsOffset);
+    }
+
+    static RhsValue Rhs(const Matrix& m, std::size_t k, std::size_t j) {
+        return m.Quantized(k, j);
+    }
+
+    // offsets[c] = lhsOffset * sum of column c of the rhs strip, the bias that the kernel added
+    static void Offsets(const Kernel& kernel, const RhsValue* strip, std::size_t groups, Acc* offsets) {
+        std::fill_n(offsets, kernel.cols, 0);
+        if (kernel.lhsOffset == 0) {
+            return;
+        }
+        for (std::size_t g = 0; g < groups; ++g) {
+            for (std::size_t c = 0; c < kernel.cols; ++c) {
+                for (std::size_t t = 0; t < GROUP; ++t) {
+                    offsets[c] += *strip++;
+                }
+            }
+        }
+        for (std::size_t c = 0; c < kernel.cols; ++c) {
+            offsets[c] *= kernel.lhsOffset;
+        }
+    }
+
+    // count values of row i from column j on, step floats apart in out
+    static void Store(const Matrix& lhs, const Matrix& rhs, std::size_t i, std::size_t j, const Acc* tile, const Acc* offsets,
+        std::size_t count, float* out, std::size_t step, bool accumulate)
+    {
+        const float scale = lhs.Scale(i);
+        for (std::size_t c = 0; c < count; ++c) {
+            const float value = static_cast<float>(tile[c] - offsets[c]) * scale * rhs.Scale(j + c);
+            out[c * step] = accumulate ? out[c * step] + value : value;
+        }
+    }
+};
+
+// Packing of the bf16 mode, depth in pairs
+struct Bf16Mode {
+    using Matrix = Bf16Matrix;
+    using Kernel = Bf16Kernel;
+    using LhsValue = std::uint16_t;
+    using RhsValue = std::uint16_t;
+    using Acc = float;
+
+    static constexpr std::size_t GROUP = 2;
+    // A KC x 32 strip of rhs is 32 KB, an MC x KC block of lhs 144 KB.
+    // The kernel is bound by the issue rate of vdpbf16ps, larger blocks measured no faster.
+    static constexpr std::size_t KC = 512;
+    static constexpr std::size_t MC = 144;
+
+    static LhsValue Lhs(const Kernel&, const Matrix& m, std::size_t i, std::size_t k) {
+        return m.Bits(i, k);
+    }
+
+    static LhsValue LhsPadding(const Kernel&) {
+        return 0;
+    }
+
+    static RhsValue Rhs(const Matrix& m, std::size_t k, std::size_t j) {
+        return m.Bits(k, j);
+    }
+
+    static void Offsets(const Kernel& kernel, const RhsValue*, std::size_t, Acc* offsets) {
+        std::fill_n(offsets, kernel.cols, 0.f);
+    }
+
+    static void Store(const Matrix&, const Matrix&, std::size_t, std::size_t, const Acc* tile, const Acc*,
+        std::size_t count, float* out, std::size_t step, bool accumulate)
+    {
+        for (std::size_t c = 0; c < count; ++c) {
+            out[c * step] = accumulate ? out[c * step] + tile[c] : tile[c];
+        }
+    }
+};
+
+template <class T>
+T* Buffer(utils::AlignedVector<T>& buffer, std::size_t count) {
+    if (buffer.size() < count) {
+        buffer.resize(count);
+    }
+    return buffer.data();
+}
+
+/*
+ * Rows [row, row + rows) x depth [k0, k0 + depth) of lhs go to strips of kernel.rows rows; for every group of
+ * depth values a strip holds the group of each of its rows. Rows and depth past the end are padding.
+ */
+template <class Mode>
+void PackLhs(const typename Mode::Kernel& kernel, const typename Mode::Matrix& lhs, std::size_t row, std::size_t rows,
+    std::size_t k0, std::size_t depth, typename Mode::LhsValue* packed)
+{
+    const std::size_t mr = kernel.rows;
+    const auto padding = Mode::LhsPadding(kernel);
+    for (std::size_t strip = 0; strip < rows; strip += mr) {
+        for (std::size_t k = 0; k < depth; k += Mode::GROUP) {
+            for (std::size_t r = 0; r < mr; ++r) {
+                for (std::size_t t = 0; t < Mode::GROUP; ++t) {
+                    const bool inside = strip + r < rows && k + t < depth;
+                    *packed++ = inside ? Mode::Lhs(kernel, lhs, row + strip + r, k0 + k + t) : padding;
+                }
+            }
+        }
+    }
+}
+
+// Strips of kernel.cols columns, for every group the group of each column. Columns and depth past the end are zero.
+template <class Mode>
+void PackRhs(const typename Mode::Kernel& kernel, const typename Mode::Matrix& rhs, std::size_t k0, std::size_t depth,
+    std::size_t col, std::size_t cols, typename Mode::RhsValue* packed)
+{
+    const std::size_t nr = kernel.cols;
+    for (std::size_t k = 0; k < depth; k += Mode::GROUP) {
+        for (std::size_t c = 0; c < nr; ++c) {
+            for (std::size_t t = 0; t < Mode::GROUP; ++t) {
+                const bool inside = c < cols && k + t < depth;
+                *packed++ = inside ? Mode::Rhs(rhs, k0 + k + t, col + c) : 0;
+            }
+        }
+    }
+}
+
+// The loops of gemm.cpp around a kernel that writes whole tiles, which are dequantized into out
+template <class Mode>
+void MultiplyBlocked(const typename Mode::Kernel& kernel, const typename Mode::Matrix& lhs, const typename Mode::Matrix& rhs,
+    MatrixView<float> out, bool parallel)
+{
+    using Acc = typename Mode::Acc;
+    const std::size_t rows = out.Rows();
+    const std::size_t cols = out.Cols();
+    const std::size_t depth = lhs.Cols();
+    const std::size_t mr = kernel.rows;
+    const std::size_t nr = kernel.cols;
+    if (depth == 0) {
+        for (std::size_t i = 0; i < rows; ++i) {
+            for (std::size_t j = 0; j < cols; ++j) {
+                out(i, j) = 0;
+            }
+        }
+        return;
+    }
+
+    const auto run = [parallel](std::size_t count, const auto& f) {
+        if (parallel) {
+            utils::ParallelFor(0, count, [&f](std::size_t from, std::size_t to) {
+                for (std::size_t i = from; i < to; ++i) {
+                    f(i);
+                }
+            });
+        } else {
+            for (std::size_t i = 0; i < count; ++i) {
+                f(i);
+            }
+        }
+    };
+
+    thread_local utils::AlignedVector<typename Mode::RhsValue> rhsBuffer;
+    thread_local std::vector<Acc> offsetBuffer;
+    for (std::size_t col0 = 0; col0 < cols; col0 += NC) {
+        const std::size_t blockCols = std::min(NC, cols - col0);
+        const std::size_t strips = (blockCols + nr - 1) / nr;
+        for (std::size_t k0 = 0; k0 < depth; k0 += Mode::KC) {
+            const std::size_t blockDepth = std::min(Mode::KC, depth - k0);
+            const std::size_t groups = (blockDepth + Mode::GROUP - 1) / Mode::GROUP;
+            const std::size_t stripSize = groups * Mode::GROUP * nr;
+            auto* packedRhs = Buffer(rhsBuffer, strips * stripSize);
+            offsetBuffer.resize(strips * nr);
+            Acc* offsets = offsetBuffer.data();
+            run(strips, [&](std::size_t strip) {
+                const std::size_t col = strip * nr;
+                PackRhs<Mode>(kernel, rhs, k0, blockDepth, col0 + col, std::min(nr, blockCols - col), packedRhs + strip * stripSize);
+                Mode::Offsets(kernel, packedRhs + strip * stripSize, groups, offsets + col);
+            });
+
+            run((rows + Mode::MC - 1) / Mode::MC, [&](std::size_t block) {
+                thread_local utils::AlignedVector<typename Mode::LhsValue> lhsBuffer;
+                const std::size_t row0 = block * Mode::MC;
+                const std::size_t blockRows = std::min(Mode::MC, rows - row0);
+                auto* packedLhs = Buffer(lhsBuffer, (blockRows + mr - 1) / mr * mr * groups * Mode::GROUP);
+                PackLhs<Mode>(kernel, lhs, row0, blockRows, k0, blockDepth, packedLhs);
+                alignas(64) Acc tile[MAX_TILE];
+                for (std::size_t col = 0; col < blockCols; col += nr) {
+                    const std::size_t tileCols = std::min(nr, blockCols - col);
+                    for (std::size_t row = 0; row < blockRows; row += mr) {
+                        const std::size_t tileRows = std::min(mr, blockRows - row);
+                        kernel.multiply(groups, packedLhs + row * groups * Mode::GROUP, packedRhs + col / nr * stripSize, tile);
+                        for (std::size_t r = 0; r < tileRows; ++r) {
+                            const std::size_t i = row0 + row + r;
+                            Mode::Store(lhs, rhs, i, col0 + col, tile + r * nr, offsets + col, tileCols, &out(i, col0 + col),
+                                out.ColStride(), k0 > 0);
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+bool HasVnni() {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vnni");
+}
+
+bool HasBf16() {
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bf16");
+}
+
+gemm::Isa GetIsa(const Options& options) {
+    const gemm::Isa isa = options.isa.value_or(gemm::DefaultIsa());
+    if (!gemm::Supported(isa)) {
+        throw std::invalid_argument(std::string("This cpu does not support ") + gemm::IsaName(isa));
+    }
+    return isa;
+}
+
+const Int8Kernel& GetInt8Kernel(gemm::Isa isa) {
+    switch (isa) {
+    case gemm::Isa::Avx512:
+        return HasVnni() ? Avx512Int8Kernel() : Avx2Int8Kernel();
+    case gemm::Isa::Avx2:
+        return Avx2Int8Kernel();
+    case gemm::Isa::Scalar:
+    case gemm::Isa::Sse42:
+        break;
+    }
+    return ScalarInt8Kernel();
+}
+
+const Bf16Kernel& GetBf16Kernel(gemm::Isa isa) {
+    switch (isa) {
+    case gemm::Isa::Avx512:
+        return HasBf16() ? Avx512Bf16Kernel() : Avx2Bf16Kernel();
+    case gemm::Isa::Avx2:
+        return Avx2Bf16Kernel();
+    case gemm::Isa::Scalar:
+    case gemm::Isa::Sse42:
+        break;
+    }
+    return ScalarBf16Kernel();
+}
+
+}  // namespace
+
+Int8Matrix::Int8Matrix(MatrixView<const float> m, Scales scales)
+    : rows_(m.Rows())
+    , cols_(m.Cols())
+    , scalesKind_(scales)
+    , data_(rows_ * cols_)
+    , scales_(scales == Scales::PerRow ? rows_ : cols_, 0.f)
+{
+    const bool perRow = scales == Scales::PerRow;
+    for (std::size_t i = 0; i < rows_; ++i) {
+        for (std::size_t j = 0; j < cols_; ++j) {
+            float& scale = scales_[perRow ? i : j];
+            scale = std::max(scale, std::abs(m(i, j)));
+        }
+    }
+    for (float& scale : scales_) {
+        scale = scale > 0 ? scale / 127 : 1;
+    }
+    for (std::size_t i = 0; i < rows_; ++i) {
+        for (std::size_t j = 0; j < cols_; ++j) {
+            const float q = std::round(m(i, j) / scales_[perRow ? i : j]);
+            data_[i * cols_ + j] = static_cast<std::int8_t>(std::clamp(q, -127.f, 127.f));
+        }
+    }
+}
+
+Bf16Matrix::Bf16Matrix(MatrixView<const float> m)
+    : rows_(m.Rows())
+    , cols_(m.Cols())
+    , data_(rows_ * cols_)
+{
+    for (std::size_t i = 0; i < rows_; ++i) {
+        for (std::size_t j = 0; j < cols_; ++j) {
+            const float value = m(i, j);
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            if (std::isnan(value)) {
+                // Keep it a quiet NaN, rounding could carry into the exponent
+                bits |= 0x00400000;
+            } else {
+                bits += 0x7fff + ((bits >> 16) & 1);
+            }
+            data_[i * cols_ + j] = static_cast<std::uint16_t>(bits >> 16);
+        }
+    }
+}
+
+float Bf16Matrix::operator()(std::size_t i, std::size_t j) const {
+    const std::uint32_t bits = static_cast<std::uint32_t>(Bits(i, j)) << 16;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void Multiply(const Int8Matrix& lhs, const Int8Matrix& rhs, MatrixView<float> out, const Options& options) {
+    assert(lhs.Cols() == rhs.Rows() && out.Rows() == lhs.Rows() && out.Cols() == rhs.Cols());
+    if (lhs.ScalesKind() != Scales::PerRow || rhs.ScalesKind() != Scales::PerCol) {
+        throw std::invalid_argument("Int8 multiply needs lhs scaled per row and rhs per column");
+    }
+    MultiplyBlocked<Int8Mode>(GetInt8Kernel(GetIsa(options)), lhs, rhs, out, options.parallel);
+}
+
+void Multiply(const Bf16Matrix& lhs, const Bf16Matrix& rhs, MatrixView<float> out, const Options& options) {
+    assert(lhs.Cols() == rhs.Rows() && out.Rows() == lhs.Rows() && out.Cols() == rhs.Cols());
+    MultiplyBlocked<Bf16Mode>(GetBf16Kernel(GetIsa(options)), lhs, rhs, out, options.parallel);
+}
+
+}  // namespace quantized
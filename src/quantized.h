@@ -0,0 +1,112 @@
+#pragma once
+
+#include "gemm.h"
+#include "matrix_view.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace quantized {
+
+enum class Scales {
+    PerRow,
+    PerCol,
+};
+
+/*
+ * Symmetric 8-bit copy of a float matrix: value(i, j) = scale * q(i, j), q in [-127, 127],
+ * with one scale per row or per column that maps its largest magnitude to 127.
+ * A quarter of the float size; the rounding error of an element is at most half its scale.
+ */
+class Int8Matrix {
+public:
+    Int8Matrix(MatrixView<const float> m, Scales scales);
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    Scales ScalesKind() const {
+        return scalesKind_;
+    }
+
+    // Scale of row or column index
+    float Scale(std::size_t index) const {
+        return scales_[index];
+    }
+
+    std::int8_t Quantized(std::size_t i, std::size_t j) const {
+        return data_[i * cols_ + j];
+    }
+
+    float operator()(std::size_t i, std::size_t j) const {
+        return Quantized(i, j) * Scale(scalesKind_ == Scales::PerRow ? i : j);
+    }
+
+private:
+    std::size_t rows_;
+    std::size_t cols_;
+    Scales scalesKind_;
+    std::vector<std::int8_t> data_;
+    std::vector<float> scales_;
+};
+
+/*
+ * bfloat16 copy of a float matrix: the upper 16 bits of every float, rounded to nearest even.
+ * Half the float size with the full exponent range and 8 significant bits.
+ * A storage format, not a faster product: see Multiply below.
+ */
+class Bf16Matrix {
+public:
+    explicit Bf16Matrix(MatrixView<const float> m);
+
+    std::size_t Rows() const {
+        return rows_;
+    }
+
+    std::size_t Cols() const {
+        return cols_;
+    }
+
+    std::uint16_t Bits(std::size_t i, std::size_t j) const {
+        return data_[i * cols_ + j];
+    }
+
+    float operator()(std::size_t i, std::size_t j) const;
+
+private:
+    std::size_t rows_;
+    std::size_t cols_;
+    std::vector<std::uint16_t> data_;
+};
+
+struct Options {
+    // Splits the rows of out over the shared thread pool
+    bool parallel = false;
+    // Forces the kernels of an instruction set, otherwise gemm::DefaultIsa() is used.
+    // AVX-512 needs VNNI for int8 and BF16 for bf16, without them the AVX2 kernel runs.
+    std::optional<gemm::Isa> isa;
+};
+
+/*
+ * out = lhs * rhs, summed exactly in int32 and scaled to float: lhs needs Scales::PerRow and rhs Scales::PerCol,
+ * otherwise std::invalid_argument is thrown.
+ */
+void Multiply(const Int8Matrix& lhs, const Int8Matrix& rhs, MatrixView<float> out, const Options& options = {});
+
+/*
+ * out = lhs * rhs, products of bf16 values summed in float.
+ * Saves memory only: it runs at about 0.6x of gemm::Multiply on the floats, because vdpbf16ps issues at a third
+ * of the rate of vfmadd on AVX-512 cores and the AVX2 kernel widens every value to float first.
+ * Packing and blocking are not the limit, the AVX-512 kernel alone on data in L1 is no faster.
+ * Use Int8Matrix for speed.
+ */
+void Multiply(const Bf16Matrix& lhs, const Bf16Matrix& rhs, MatrixView<float> out, const Options& options = {});
+
+}  // namespace quantized
@@ -0,0 +1,98 @@
+#include "quantized_kernels.h"
+
+#include <immintrin.h>
+
+#include <cstring>
+
+namespace quantized {
+
+namespace {
+
+// 4 rows x 2 vectors of 8 columns leave room for the rhs vectors and the temporaries in 16 ymm registers
+constexpr std::size_t MR = 4;
+constexpr std::size_t NR = 16;
+
+std::int32_t Load32(const void* data) {
+    std::int32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+void MultiplyInt8Tile(std::size_t groups, const std::uint8_t* lhs, const std::int8_t* rhs, std::int32_t* out) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc[MR][2];
+#pragma GCC unroll 4
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm256_setzero_si256();
+        acc[r][1] = _mm256_setzero_si256();
+    }
+    for (std::size_t g = 0; g < groups; ++g) {
+        const __m256i b0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rhs));
+        const __m256i b1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rhs + 32));
+#pragma GCC unroll 4
+        for (std::size_t r = 0; r < MR; ++r) {
+            const __m256i a = _mm256_set1_epi32(Load32(lhs + r * 4));
+            const __m256i absA = _mm256_abs_epi8(a);
+            // |a| * (b with the sign of a) is at most 2 * 128 * 127 per pair, within int16
+            const __m256i p0 = _mm256_maddubs_epi16(absA, _mm256_sign_epi8(b0, a));
+            const __m256i p1 = _mm256_maddubs_epi16(absA, _mm256_sign_epi8(b1, a));
+            acc[r][0] = _mm256_add_epi32(acc[r][0], _mm256_madd_epi16(p0, ones));
+            acc[r][1] = _mm256_add_epi32(acc[r][1], _mm256_madd_epi16(p1, ones));
+        }
+        lhs += MR * 4;
+        rhs += NR * 4;
+    }
+#pragma GCC unroll 4
+    for (std::size_t r = 0; r < MR; ++r) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r * NR), acc[r][0]);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + r * NR + 8), acc[r][1]);
+    }
+}
+
+// A bf16 pair in 32 bits: the low half is the first value, the high half the second
+void MultiplyBf16Tile(std::size_t pairs, const std::uint16_t* lhs, const std::uint16_t* rhs, float* out) {
+    const __m256i high = _mm256_set1_epi32(static_cast<std::int32_t>(0xffff0000));
+    __m256 acc[MR][2];
+#pragma GCC unroll 4
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm256_setzero_ps();
+        acc[r][1] = _mm256_setzero_ps();
+    }
+    for (std::size_t p = 0; p < pairs; ++p) {
+        const __m256i b0 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rhs));
+        const __m256i b1 = _mm256_load_si256(reinterpret_cast<const __m256i*>(rhs + 16));
+        const __m256 even0 = _mm256_castsi256_ps(_mm256_slli_epi32(b0, 16));
+        const __m256 odd0 = _mm256_castsi256_ps(_mm256_and_si256(b0, high));
+        const __m256 even1 = _mm256_castsi256_ps(_mm256_slli_epi32(b1, 16));
+        const __m256 odd1 = _mm256_castsi256_ps(_mm256_and_si256(b1, high));
+#pragma GCC unroll 4
+        for (std::size_t r = 0; r < MR; ++r) {
+            const __m256i a = _mm256_set1_epi32(Load32(lhs + r * 2));
+            const __m256 aEven = _mm256_castsi256_ps(_mm256_slli_epi32(a, 16));
+            const __m256 aOdd = _mm256_castsi256_ps(_mm256_and_si256(a, high));
+            acc[r][0] = _mm256_fmadd_ps(aOdd, odd0, _mm256_fmadd_ps(aEven, even0, acc[r][0]));
+            acc[r][1] = _mm256_fmadd_ps(aOdd, odd1, _mm256_fmadd_ps(aEven, even1, acc[r][1]));
+        }
+        lhs += MR * 2;
+        rhs += NR * 2;
+    }
+#pragma GCC unroll 4
+    for (std::size_t r = 0; r < MR; ++r) {
+        _mm256_storeu_ps(out + r * NR, acc[r][0]);
+        _mm256_storeu_ps(out + r * NR + 8, acc[r][1]);
+    }
+}
+
+}  // namespace
+
+const Int8Kernel& Avx2Int8Kernel() {
+    static constexpr Int8Kernel kernel{MR, NR, 0, &MultiplyInt8Tile};
+    return kernel;
+}
+
+const Bf16Kernel& Avx2Bf16Kernel() {
+    static constexpr Bf16Kernel kernel{MR, NR, &MultiplyBf16Tile};
+    return kernel;
+}
+
+}  // namespace quantized
@@ -0,0 +1,87 @@
+#include "quantized_kernels.h"
+
+#include <immintrin.h>
+
+#include <cstring>
+
+namespace quantized {
+
+namespace {
+
+// 12 rows x 2 vectors of 16 columns use 24 of the 32 zmm registers
+constexpr std::size_t MR = 12;
+constexpr std::size_t NR = 32;
+// Bias that makes int8 lhs values unsigned for vpdpbusd
+constexpr std::int32_t LHS_OFFSET = 128;
+
+std::int32_t Load32(const void* data) {
+    std::int32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+void MultiplyInt8Tile(std::size_t groups, const std::uint8_t* lhs, const std::int8_t* rhs, std::int32_t* out) {
+    __m512i acc[MR][2];
+#pragma GCC unroll 12
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm512_setzero_si512();
+        acc[r][1] = _mm512_setzero_si512();
+    }
+    for (std::size_t g = 0; g < groups; ++g) {
+        const __m512i b0 = _mm512_load_si512(rhs);
+        const __m512i b1 = _mm512_load_si512(rhs + 64);
+#pragma GCC unroll 12
+        for (std::size_t r = 0; r < MR; ++r) {
+            const __m512i a = _mm512_set1_epi32(Load32(lhs + r * 4));
+            acc[r][0] = _mm512_dpbusd_epi32(acc[r][0], a, b0);
+            acc[r][1] = _mm512_dpbusd_epi32(acc[r][1], a, b1);
+        }
+        lhs += MR * 4;
+        rhs += NR * 4;
+    }
+#pragma GCC unroll 12
+    for (std::size_t r = 0; r < MR; ++r) {
+        _mm512_storeu_si512(out + r * NR, acc[r][0]);
+        _mm512_storeu_si512(out + r * NR + 16, acc[r][1]);
+    }
+}
+
+void MultiplyBf16Tile(std::size_t pairs, const std::uint16_t* lhs, const std::uint16_t* rhs, float* out) {
+    __m512 acc[MR][2];
+#pragma GCC unroll 12
+    for (std::size_t r = 0; r < MR; ++r) {
+        acc[r][0] = _mm512_setzero_ps();
+        acc[r][1] = _mm512_setzero_ps();
+    }
+    for (std::size_t p = 0; p < pairs; ++p) {
+        const auto b0 = reinterpret_cast<__m512bh>(_mm512_load_si512(rhs));
+        const auto b1 = reinterpret_cast<__m512bh>(_mm512_load_si512(rhs + 32));
+#pragma GCC unroll 12
+        for (std::size_t r = 0; r < MR; ++r) {
+            const auto a = reinterpret_cast<__m512bh>(_mm512_set1_epi32(Load32(lhs + r * 2)));
+            acc[r][0] = _mm512_dpbf16_ps(acc[r][0], a, b0);
+            acc[r][1] = _mm512_dpbf16_ps(acc[r][1], a, b1);
+        }
+        lhs += MR * 2;
+        rhs += NR * 2;
+    }
+#pragma GCC unroll 12
+    for (std::size_t r = 0; r < MR; ++r) {
+        _mm512_storeu_ps(out + r * NR, acc[r][0]);
+        _mm512_storeu_ps(out + r * NR + 16, acc[r][1]);
+    }
+}
+
+}  // namespace
+
+const Int8Kernel& Avx512Int8Kernel() {
+    static constexpr Int8Kernel kernel{MR, NR, LHS_OFFSET, &MultiplyInt8Tile};
+    return kernel;
+}
+
+const Bf16Kernel& Avx512Bf16Kernel() {
+    static constexpr Bf16Kernel kernel{MR, NR, &MultiplyBf16Tile};
+    return kernel;
+}
+
+}  // namespace quantized
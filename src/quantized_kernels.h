@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Micro-kernels of quantized::Multiply, one file per instruction set like the ones of gemm (see gemm_kernels.h).
+ * Depth is packed in groups: 4 int8 or 2 bf16 values of a row of lhs, or of a column of rhs, share 32 bits,
+ * which is what vpmaddubsw + vpmaddwd, vpdpbusd and vdpbf16ps consume per lane.
+ */
+namespace quantized {
+
+/*
+ * out[rows x cols] = lhs strip * rhs strip over groups of 4 depth values, written contiguously.
+ * lhs bytes hold q + lhsOffset, the caller subtracts lhsOffset * (column sums of rhs) afterwards.
+ */
+using Int8KernelFunction = void (*)(std::size_t groups, const std::uint8_t* lhs, const std::int8_t* rhs, std::int32_t* out);
+
+struct Int8Kernel {
+    std::size_t rows;
+    std::size_t cols;
+    std::int32_t lhsOffset;
+    Int8KernelFunction multiply;
+};
+
+// out[rows x cols] = lhs strip * rhs strip over pairs of bf16 depth values, summed in float and written contiguously
+using Bf16KernelFunction = void (*)(std::size_t pairs, const std::uint16_t* lhs, const std::uint16_t* rhs, float* out);
+
+struct Bf16Kernel {
+    std::size_t rows;
+    std::size_t cols;
+    Bf16KernelFunction multiply;
+};
+
+// Largest rows * cols of the kernels
+constexpr std::size_t MAX_TILE = 12 * 32;
+
+const Int8Kernel& ScalarInt8Kernel();
+const Bf16Kernel& ScalarBf16Kernel();
+// vpmaddubsw on |lhs| and rhs with the sign of lhs, so that no pair of products saturates
+const Int8Kernel& Avx2Int8Kernel();
+const Bf16Kernel& Avx2Bf16Kernel();
+// AVX512-VNNI vpdpbusd, lhs biased to unsigned
+const Int8Kernel& Avx512Int8Kernel();
+// AVX512-BF16 vdpbf16ps
+const Bf16Kernel& Avx512Bf16Kernel();
+
+}  // namespace quantized
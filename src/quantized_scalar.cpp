@@ -0,0 +1,62 @@
+#include "quantized_kernels.h"
+
+#include <cstring>
+
+namespace quantized {
+
+namespace {
+
+constexpr std::size_t MR = 4;
+constexpr std::size_t NR = 8;
+
+void MultiplyInt8Tile(std::size_t groups, const std::uint8_t* lhs, const std::int8_t* rhs, std::int32_t* out) {
+    std::int32_t acc[MR][NR] = {};
+    for (std::size_t g = 0; g < groups; ++g) {
+        for (std::size_t r = 0; r < MR; ++r) {
+            for (std::size_t c = 0; c < NR; ++c) {
+                for (std::size_t t = 0; t < 4; ++t) {
+                    acc[r][c] += static_cast<std::int8_t>(lhs[r * 4 + t]) * rhs[c * 4 + t];
+                }
+            }
+        }
+        lhs += MR * 4;
+        rhs += NR * 4;
+    }
+    std::memcpy(out, acc, sizeof(acc));
+}
+
+float Bf16ToFloat(std::uint16_t value) {
+    const std::uint32_t bits = static_cast<std::uint32_t>(value) << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+void MultiplyBf16Tile(std::size_t pairs, const std::uint16_t* lhs, const std::uint16_t* rhs, float* out) {
+    float acc[MR][NR] = {};
+    for (std::size_t p = 0; p < pairs; ++p) {
+        for (std::size_t r = 0; r < MR; ++r) {
+            for (std::size_t c = 0; c < NR; ++c) {
+                acc[r][c] += Bf16ToFloat(lhs[r * 2]) * Bf16ToFloat(rhs[c * 2])
+                    + Bf16ToFloat(lhs[r * 2 + 1]) * Bf16ToFloat(rhs[c * 2 + 1]);
+            }
+        }
+        lhs += MR * 2;
+        rhs += NR * 2;
+    }
+    std::memcpy(out, acc, sizeof(acc));
+}
+
+}  // namespace
+
+const Int8Kernel& ScalarInt8Kernel() {
+    static constexpr Int8Kernel kernel{MR, NR, 0, &MultiplyInt8Tile};
+    return kernel;
+}
+
+const Bf16Kernel& ScalarBf16Kernel() {
+    static constexpr Bf16Kernel kernel{MR, NR, &MultiplyBf16Tile};
+    return kernel;
+}
+
+}  // namespace quantized
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/Graphics/VertexBuffer.hpp>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace utils {
+
+/*
+ * RetainedVertices keeps a mesh on the GPU between frames.
+ * Only the ranges touched since the previous draw are uploaded again.
+ */
+class RetainedVertices {
+public:
+    explicit RetainedVertices(sf::PrimitiveType type)
+        : type_(type)
+        , buffer_(type, sf::VertexBuffer::Dynamic)
+    {}
+
+    std::size_t Size() const {
+        return vertices_.size();
+    }
+
+    std::size_t Append(const sf::Vertex* vertices, std::size_t count) {
+        const auto first = vertices_.size();
+        vertices_.insert(vertices_.end(), vertices, vertices + count);
+        MarkDirty(first, count);
+        return first;
+    }
+
+    sf::Vertex* Modify(std::size_t first, std::size_t count) {
+        MarkDirty(first, count);
+        return vertices_.data() + first;
+    }
+
+    void Draw(sf::RenderTarget& target, const sf::RenderStates& states = sf::RenderStates::Default) {
+        if (vertices_.empty()) {
+            return;
+        }
+        if (!sf::VertexBuffer::isAvailable()) {
+            dirty_.clear();
+            target.draw(vertices_.data(), vertices_.size(), type_, states);
+            return;
+        }
+        Upload();
+        target.draw(buffer_, 0, vertices_.size(), states);
+    }
+
+private:
+    static constexpr std::size_t MAX_DIRTY_RANGES = 64;
+
+    void MarkDirty(std::size_t first, std::size_t count) {
+        if (!dirty_.empty() && dirty_.back().second == first) {
+            dirty_.back().second += count;
+            return;
+        }
+        if (dirty_.size() == MAX_DIRTY_RANGES) {
+            MergeDirty();
+            if (dirty_.size() == MAX_DIRTY_RANGES) {
+                dirty_ = {{dirty_.front().first, dirty_.back().second}};
+            }
+        }
+        dirty_.emplace_back(first, first + count);
+    }
+
+    void MergeDirty() {
+        std::sort(dirty_.begin(), dirty_.end());
+        std::size_t size = 0;
+        for (const auto& range : dirty_) {
+            if (size > 0 && range.first <= dirty_[size - 1].second) {
+                dirty_[size - 1].second = std::max(dirty_[size - 1].second, range.second);
+            } else {
+                dirty_[size++] = range;
+            }
+        }
+        dirty_.resize(size);
+    }
+
+    void Upload() {
+        if (buffer_.getVertexCount() < vertices_.size()) {
+            // Grow geometrically, a reallocated buffer loses its contents.
+            buffer_.create(std::max(vertices_.capacity(), 2 * buffer_.getVertexCount()));
+            dirty_ = {{0, vertices_.size()}};
+        }
+        MergeDirty();
+        for (const auto& [begin, end] : dirty_) {
+            buffer_.update(vertices_.data() + begin, end - begin, begin);
+        }
+        dirty_.clear();
+    }
+
+    sf::PrimitiveType type_;
+    sf::VertexBuffer buffer_;
+    std::vector<sf::Vertex> vertices_;
+    std::vector<std::pair<std::size_t, std::size_t>> dirty_;
+};
+
+}  // namespace utils
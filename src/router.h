@@ -0,0 +1,195 @@
+#pragma once
+
+#include "graph.h"
+#include "utils.h"
+#include "world.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <numbers>
+#include <queue>
+#include <utility>
+#include <vector>
+
+/*
+ * Routes from every vertex to one target over the Graph edges: distances of a reverse Dijkstra
+ * and the first direction of each route. Edges are only added and their weights only drop,
+ * so an update relaxes the changed edge and spreads the decrease upstream instead of recomputing.
+ */
+class FlowField {
+public:
+    static constexpr std::uint8_t NONE = 0xff;
+    static constexpr int UNREACHABLE = std::numeric_limits<int>::max();
+
+    FlowField(const Graph& graph, int target)
+        : target_(target)
+        , dist_(GridColumns() * GridRows(), UNREACHABLE)
+        , next_(dist_.size(), NONE)
+        , heading_(dist_.size())
+    {
+        const auto to = GetPos(target);
+        for (std::size_t vertex = 0; vertex < dist_.size(); ++vertex) {
+            const auto dir = to - GetPos(vertex);
+            const auto angle = std::atan2(dir.y, dir.x) / (2 * std::numbers::pi_v<float>);
+            heading_[vertex] = static_cast<int>(std::round(angle * SECTORS) + SECTORS) % SECTORS;
+        }
+        dist_[target] = 0;
+        queue_.emplace(0, target);
+        Spread(graph);
+    }
+
+    // Weight of an edge for routing: every TRAVELS_PER_STEP cars make it one cheaper, down to 1
+    static int Weight(int cost) {
+        return std::max(1, BASE_WEIGHT + cost / TRAVELS_PER_STEP);
+    }
+
+    int Target() const {
+        return target_;
+    }
+
+    // First direction of the cheapest route from vertex, NONE without a route
+    std::uint8_t Next(int vertex) const {
+        return next_[vertex];
+    }
+
+    int Distance(int vertex) const {
+        return dist_[vertex];
+    }
+
+    // Directions from vertex by their cosine to the direction of the target, nearest first
+    const std::array<std::uint8_t, Graph::DIRS.size()>& Heading(int vertex) const {
+        return HEADINGS[heading_[vertex]];
+    }
+
+    // The edge was added or its weight dropped; a weight that grew needs a new field
+    void Relax(const Graph& graph, int from, int dirInd) {
+        const int to = Neighbour(from, dirInd);
+        if (to < 0 || dist_[to] == UNREACHABLE) {
+            return;
+        }
+        const int dist = dist_[to] + Weight(graph.GetEdge(from, dirInd)->cost);
+        assert(next_[from] != dirInd || dist <= dist_[from]);
+        Update(from, dirInd, dist);
+        Spread(graph);
+    }
+
+private:
+    static constexpr int BASE_WEIGHT = 16;
+    static constexpr int TRAVELS_PER_STEP = 16;
+    // Directions to the target are rounded to one of this many
+    static constexpr int SECTORS = 64;
+
+    using Directions = std::array<std::uint8_t, Graph::DIRS.size()>;
+
+    static inline const std::array<Directions, SECTORS> HEADINGS = []() {
+        std::array<Directions, SECTORS> headings;
+        for (int sector = 0; sector < SECTORS; ++sector) {
+            const float angle = 2 * std::numbers::pi_v<float> * sector / SECTORS;
+            const sf::Vector2f dir(std::cos(angle), std::sin(angle));
+            auto& heading = headings[sector];
+            for (std::size_t dirInd = 0; dirInd < heading.size(); ++dirInd) {
+                heading[dirInd] = dirInd;
+            }
+            std::stable_sort(heading.begin(), heading.end(), [&](int lhs, int rhs) {
+                return Cos(Graph::DIRS[lhs], dir) > Cos(Graph::DIRS[rhs], dir);
+            });
+        }
+        return headings;
+    }();
+
+    // Vertex one step from vertex towards DIRS[dirInd], -1 off the grid
+    static int Neighbour(int vertex, int dirInd) {
+        const int x = vertex % GridColumns() + static_cast<int>(Graph::DIRS[dirInd].x);
+        const int y = vertex / GridColumns() + static_cast<int>(Graph::DIRS[dirInd].y);
+        if (x < 0 || y < 0 || x >= GridColumns() || y >= GridRows()) {
+            return -1;
+        }
+        return x + y * GridColumns();
+    }
+
+    void Update(int vertex, int dirInd, int dist) {
+        if (dist < dist_[vertex]) {
+            dist_[vertex] = dist;
+            next_[vertex] = dirInd;
+            queue_.emplace(dist, vertex);
+        }
+    }
+
+    // Dijkstra from the queued vertices along reversed edges; DIRS[(i + 4) % 8] is opposite to DIRS[i]
+    void Spread(const Graph& graph) {
+        while (!queue_.empty()) {
+            const auto [dist, vertex] = queue_.top();
+            queue_.pop();
+            if (dist != dist_[vertex]) {
+                continue;
+            }
+            for (std::size_t dirInd = 0; dirInd < Graph::DIRS.size(); ++dirInd) {
+                const int from = Neighbour(vertex, (dirInd + Graph::DIRS.size() / 2) % Graph::DIRS.size());
+                if (from >= 0 && graph.HasEdge(from, dirInd)) {
+                    Update(from, dirInd, dist + Weight(graph.GetEdge(from, dirInd)->cost));
+                }
+            }
+        }
+    }
+
+    int target_;
+    std::vector<int> dist_;
+    std::vector<std::uint8_t> next_;
+    // Index into HEADINGS per vertex
+    std::vector<std::uint8_t> heading_;
+    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>, std::greater<>> queue_;
+};
+
+/*
+ * Flow fields of the targets cars head to, built on first use and kept current by changing the graph
+ * through AddEdge() and Travel(), so a car picks its direction with one lookup however many share a target.
+ */
+class Router {
+public:
+    explicit Router(Graph& graph)
+        : graph_(graph)
+    {
+    }
+
+    // The reference is valid until the next new target
+    const FlowField& Field(WindXy target) {
+        const auto& bounds = gWorld.bounds;
+        target.x = std::clamp(target.x, bounds.left, bounds.left + bounds.width);
+        target.y = std::clamp(target.y, bounds.top, bounds.top + bounds.height);
+        const int vertex = GetVertex(target);
+        for (const auto& field : fields_) {
+            if (field.Target() == vertex) {
+                return field;
+            }
+        }
+        return fields_.emplace_back(graph_, vertex);
+    }
+
+    void AddEdge(int from, int dirInd) {
+        graph_.AddEdge(from, dirInd);
+        for (auto& field : fields_) {
+            field.Relax(graph_, from, dirInd);
+        }
+    }
+
+    // A car takes the edge, which makes it cheaper
+    void Travel(int from, int dirInd) {
+        auto* edge = graph_.GetEdge(from, dirInd);
+        const int weight = FlowField::Weight(edge->cost);
+        graph_.ChangeCost(edge, -1);
+        if (FlowField::Weight(edge->cost) != weight) {
+            for (auto& field : fields_) {
+                field.Relax(graph_, from, dirInd);
+            }
+        }
+    }
+
+private:
+    Graph& graph_;
+    std::vector<FlowField> fields_;
+};
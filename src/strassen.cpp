@@ -0,0 +1,341 @@
+#include "strassen.h"
+
+#include "aligned.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <type_traits>
+#include <vector>
+
+namespace strassen {
+
+namespace {
+
+// Workspace rows start on a cache line
+constexpr std::size_t ROW_ALIGNMENT = 64 / sizeof(float);
+// Rows of an addition pass given to one pool task
+constexpr std::size_t ROWS_PER_TASK = 16;
+
+std::size_t Stride(std::size_t cols) {
+    return (cols + ROW_ALIGNMENT - 1) / ROW_ALIGNMENT * ROW_ALIGNMENT;
+}
+
+bool Splits(std::size_t rows, std::size_t depth, std::size_t cols, std::size_t crossover) {
+    return std::min({rows, depth, cols}) >= std::max<std::size_t>(crossover, 2);
+}
+
+// Floats taken by the temporaries of one level: S1..S4, T1..T4 and the products P1, P6 and P7
+std::size_t LevelSize(std::size_t rows, std::size_t depth, std::size_t cols) {
+    return 4 * (rows / 2) * Stride(depth / 2) + 4 * (depth / 2) * Stride(cols / 2) + 3 * (rows / 2) * Stride(cols / 2);
+}
+
+// Children of a parallel level get a workspace each, the children of a serial level take turns on one
+std::size_t WorkspaceSize(std::size_t rows, std::size_t depth, std::size_t cols, std::size_t crossover, std::size_t parallelLevels) {
+    if (!Splits(rows, depth, cols, crossover)) {
+        return 0;
+    }
+    const std::size_t child = WorkspaceSize(rows / 2, depth / 2, cols / 2, crossover, parallelLevels > 0 ? parallelLevels - 1 : 0);
+    return LevelSize(rows, depth, cols) + (parallelLevels > 0 ? 7 : 1) * child;
+}
+
+void Gemm(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out, const Options& options) {
+    gemm::Multiply(lhs, rhs, out, {.threads = 1, .affinity = {}, .isa = options.isa});
+}
+
+struct Product {
+    MatrixView<const float> lhs;
+    MatrixView<const float> rhs;
+    MatrixView<float> out;
+    float* workspace;
+};
+
+/*
+ * One level of the recursion on the even part of the product:
+ *   S1 = A21 + A22, S2 = S1 - A11, S3 = A11 - A21, S4 = A12 - S2
+ *   T1 = B12 - B11, T2 = B22 - T1, T3 = B22 - B12, T4 = T2 - B21
+ *   P1 = A11 B11, P2 = A12 B21, P3 = S4 B22, P4 = A22 T4, P5 = S1 T1, P6 = S2 T2, P7 = S3 T3
+ *   C11 = P1 + P2, C12 = P1 + P6 + P5 + P3, C21 = P1 + P6 + P7 - P4, C22 = P1 + P6 + P7 + P5
+ * P2..P5 are written straight into the quadrants of C, so Finish() combines everything in one pass.
+ */
+class Level {
+public:
+    Level(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out, float* workspace, bool parallel)
+        : lhs_(lhs)
+        , rhs_(rhs)
+        , out_(out)
+        , parallel_(parallel)
+        , rows_(out.Rows() / 2)
+        , depth_(lhs.Cols() / 2)
+        , cols_(out.Cols() / 2)
+    {
+        for (auto& s : s_) {
+            s = Take(workspace, rows_, depth_);
+        }
+        for (auto& t : t_) {
+            t = Take(workspace, depth_, cols_);
+        }
+        for (auto& p : p_) {
+            p = Take(workspace, rows_, cols_);
+        }
+        childWorkspace_ = workspace;
+    }
+
+    void Prepare() const {
+        ForRows(rows_, [this](std::size_t i) {
+            WithStride(lhs_.ColStride(), [&](auto step) {
+                PrepareLhs(depth_, step, &lhs_(i, 0), &lhs_(i, depth_), &lhs_(i + rows_, 0), &lhs_(i + rows_, depth_),
+                    &s_[0](i, 0), &s_[1](i, 0), &s_[2](i, 0), &s_[3](i, 0));
+            });
+        });
+        ForRows(depth_, [this](std::size_t i) {
+            WithStride(rhs_.ColStride(), [&](auto step) {
+                PrepareRhs(cols_, step, &rhs_(i, 0), &rhs_(i, cols_), &rhs_(i + depth_, 0), &rhs_(i + depth_, cols_),
+                    &t_[0](i, 0), &t_[1](i, 0), &t_[2](i, 0), &t_[3](i, 0));
+            });
+        });
+    }
+
+    // Children take childSize floats of workspace each, 0 shares one workspace
+    std::array<Product, 7> Products(std::size_t childSize) const {
+        const auto a = [this](std::size_t i, std::size_t j) {
+            return lhs_.Block(i * rows_, j * depth_, rows_, depth_);
+        };
+        const auto b = [this](std::size_t i, std::size_t j) {
+            return rhs_.Block(i * depth_, j * cols_, depth_, cols_);
+        };
+        const auto c = [this](std::size_t i, std::size_t j) {
+            return out_.Block(i * rows_, j * cols_, rows_, cols_);
+        };
+        const auto w = [this, childSize](std::size_t i) {
+            return childWorkspace_ + i * childSize;
+        };
+        return {{
+            {a(0, 0), b(0, 0), p_[0], w(0)},
+            {a(0, 1), b(1, 0), c(0, 0), w(1)},
+            {s_[3], b(1, 1), c(0, 1), w(2)},
+            {a(1, 1), t_[3], c(1, 0), w(3)},
+            {s_[0], t_[0], c(1, 1), w(4)},
+            {s_[1], t_[1], p_[1], w(5)},
+            {s_[2], t_[2], p_[2], w(6)},
+        }};
+    }
+
+    // Combines the products and adds the peeled row, column and depth
+    void Finish(const Options& options) const {
+        ForRows(rows_, [this](std::size_t i) {
+            WithStride(out_.ColStride(), [&](auto step) {
+                Combine(cols_, step, &p_[0](i, 0), &p_[1](i, 0), &p_[2](i, 0),
+                    &out_(i, 0), &out_(i, cols_), &out_(i + rows_, 0), &out_(i + rows_, cols_));
+            });
+        });
+
+        const std::size_t rows = out_.Rows();
+        const std::size_t depth = lhs_.Cols();
+        const std::size_t cols = out_.Cols();
+        if (depth % 2 == 1) {
+            ForRows(2 * rows_, [this, depth](std::size_t i) {
+                const float a = lhs_(i, depth - 1);
+                for (std::size_t j = 0; j < 2 * cols_; ++j) {
+                    out_(i, j) += a * rhs_(depth - 1, j);
+                }
+            });
+        }
+        if (cols % 2 == 1) {
+            Gemm(lhs_.Block(0, 0, 2 * rows_, depth), rhs_.Block(0, cols - 1, depth, 1), out_.Block(0, cols - 1, 2 * rows_, 1), options);
+        }
+        if (rows % 2 == 1) {
+            Gemm(lhs_.Block(rows - 1, 0, 1, depth), rhs_, out_.Block(rows - 1, 0, 1, cols), options);
+        }
+    }
+
+private:
+    // Calls f with the column stride, as a constant when it is 1 so that the loops vectorize
+    template <class F>
+    static void WithStride(std::size_t step, F&& f) {
+        if (step == 1) {
+            f(std::integral_constant<std::size_t, 1>());
+        } else {
+            f(step);
+        }
+    }
+
+    template <class Step>
+    static void PrepareLhs(std::size_t cols, Step step, const float* a11, const float* a12, const float* a21, const float* a22,
+        float* __restrict s1, float* __restrict s2, float* __restrict s3, float* __restrict s4)
+    {
+        for (std::size_t j = 0; j < cols; ++j) {
+            s1[j] = a21[j * step] + a22[j * step];
+            s2[j] = s1[j] - a11[j * step];
+            s3[j] = a11[j * step] - a21[j * step];
+            s4[j] = a12[j * step] - s2[j];
+        }
+    }
+
+    template <class Step>
+    static void PrepareRhs(std::size_t cols, Step step, const float* b11, const float* b12, const float* b21, const float* b22,
+        float* __restrict t1, float* __restrict t2, float* __restrict t3, float* __restrict t4)
+    {
+        for (std::size_t j = 0; j < cols; ++j) {
+            t1[j] = b12[j * step] - b11[j * step];
+            t2[j] = b22[j * step] - t1[j];
+            t3[j] = b22[j * step] - b12[j * step];
+            t4[j] = t2[j] - b21[j * step];
+        }
+    }
+
+    // C11 holds P2, C12 P3, C21 P4 and C22 P5 on entry
+    template <class Step>
+    static void Combine(std::size_t cols, Step step, const float* p1, const float* p6, const float* p7,
+        float* __restrict c11, float* __restrict c12, float* __restrict c21, float* __restrict c22)
+    {
+        for (std::size_t j = 0; j < cols; ++j) {
+            const float u2 = p1[j] + p6[j];
+            const float u3 = u2 + p7[j];
+            const float p5 = c22[j * step];
+            c11[j * step] += p1[j];
+            c12[j * step] += u2 + p5;
+            c21[j * step] = u3 - c21[j * step];
+            c22[j * step] = u3 + p5;
+        }
+    }
+
+    static MatrixView<float> Take(float*& workspace, std::size_t rows, std::size_t cols) {
+        const MatrixView<float> view(workspace, rows, cols, Stride(cols));
+        workspace += rows * Stride(cols);
+        return view;
+    }
+
+    template <class F>
+    void ForRows(std::size_t rows, F&& f) const {
+        const auto run = [&f](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                f(i);
+            }
+        };
+        if (parallel_) {
+            utils::ParallelFor(0, rows, run, ROWS_PER_TASK);
+        } else {
+            run(0, rows);
+        }
+    }
+
+    MatrixView<const float> lhs_;
+    MatrixView<const float> rhs_;
+    MatrixView<float> out_;
+    bool parallel_;
+    // Quadrant sizes
+    std::size_t rows_;
+    std::size_t depth_;
+    std::size_t cols_;
+    std::array<MatrixView<float>, 4> s_;
+    std::array<MatrixView<float>, 4> t_;
+    // P1, P6 and P7
+    std::array<MatrixView<float>, 3> p_;
+    float* childWorkspace_;
+};
+
+void MultiplySerial(const Product& product, const Options& options) {
+    const std::size_t rows = product.out.Rows();
+    const std::size_t depth = product.lhs.Cols();
+    const std::size_t cols = product.out.Cols();
+    if (!Splits(rows, depth, cols, options.crossover)) {
+        Gemm(product.lhs, product.rhs, product.out, options);
+        return;
+    }
+    const Level level(product.lhs, product.rhs, product.out, product.workspace, false);
+    level.Prepare();
+    for (const auto& child : level.Products(0)) {
+        MultiplySerial(child, options);
+    }
+    level.Finish(options);
+}
+
+/*
+ * Unrolls the first levels into independent leaf products. Their Prepare() runs right away,
+ * their Finish() is queued after the ones of their children.
+ */
+void Expand(const Product& product, std::size_t levels, const Options& options, std::vector<Product>& leaves,
+    std::vector<std::function<void()>>& finish)
+{
+    const std::size_t rows = product.out.Rows();
+    const std::size_t depth = product.lhs.Cols();
+    const std::size_t cols = product.out.Cols();
+    if (levels == 0 || !Splits(rows, depth, cols, options.crossover)) {
+        leaves.push_back(product);
+        return;
+    }
+    const Level level(product.lhs, product.rhs, product.out, product.workspace, true);
+    level.Prepare();
+    const std::size_t childSize = WorkspaceSize(rows / 2, depth / 2, cols / 2, options.crossover, levels - 1);
+    for (const auto& child : level.Products(childSize)) {
+        Expand(child, levels - 1, options, leaves, finish);
+    }
+    finish.push_back([level, &options]() {
+        level.Finish(options);
+    });
+}
+
+}  // namespace
+
+void Multiply(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out, const Options& options) {
+    assert(lhs.Cols() == rhs.Rows() && out.Rows() == lhs.Rows() && out.Cols() == rhs.Cols());
+    const std::size_t rows = out.Rows();
+    const std::size_t depth = lhs.Cols();
+    const std::size_t cols = out.Cols();
+    if (!Splits(rows, depth, cols, options.crossover)) {
+        Gemm(lhs, rhs, out, options);
+        return;
+    }
+
+    // Enough levels to give every thread a leaf, 7^levels >= threads
+    std::size_t parallelLevels = 0;
+    if (options.parallel) {
+        for (std::size_t leaves = 1; leaves < utils::NumThreads(); leaves *= 7) {
+            ++parallelLevels;
+        }
+    }
+    thread_local utils::AlignedVector<float> buffer;
+    const std::size_t size = WorkspaceSize(rows, depth, cols, options.crossover, parallelLevels);
+    if (buffer.size() < size) {
+        buffer.resize(size);
+    }
+
+    const Product product{lhs, rhs, out, buffer.data()};
+    if (parallelLevels == 0) {
+        MultiplySerial(product, options);
+        return;
+    }
+    std::vector<Product> leaves;
+    std::vector<std::function<void()>> finish;
+    Expand(product, parallelLevels, options, leaves, finish);
+    utils::ParallelFor(0, leaves.size(), [&](std::size_t from, std::size_t to) {
+        for (std::size_t i = from; i < to; ++i) {
+            MultiplySerial(leaves[i], options);
+        }
+    });
+    for (const auto& f : finish) {
+        f();
+    }
+}
+
+std::size_t Levels(std::size_t rows, std::size_t depth, std::size_t cols, std::size_t crossover) {
+    std::size_t levels = 0;
+    for (; Splits(rows, depth, cols, crossover); ++levels) {
+        rows /= 2;
+        depth /= 2;
+        cols /= 2;
+    }
+    return levels;
+}
+
+double ErrorBound(std::size_t rows, std::size_t depth, std::size_t cols, std::size_t crossover) {
+    const std::size_t levels = Levels(rows, depth, cols, crossover);
+    const double leafDepth = static_cast<double>(depth >> levels);
+    return std::pow(18., static_cast<double>(levels)) * (leafDepth * leafDepth + 6 * leafDepth) - 6. * static_cast<double>(depth);
+}
+
+}  // namespace strassen
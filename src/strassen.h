@@ -0,0 +1,39 @@
+#pragma once
+
+#include "gemm.h"
+#include "matrix_view.h"
+
+#include <cstddef>
+#include <optional>
+
+namespace strassen {
+
+struct Options {
+    // Products with every dimension at least this large are split in quadrants, smaller ones go to gemm::Multiply
+    std::size_t crossover = 2048;
+    // Runs the products of the top levels on the shared thread pool
+    bool parallel = false;
+    // Forces a gemm kernel, otherwise gemm::DefaultIsa() is used
+    std::optional<gemm::Isa> isa;
+};
+
+/*
+ * out = lhs * rhs by the Winograd variant of Strassen's algorithm: 7 half sized products and 15 additions
+ * per level instead of 8 products. The recursion stops at options.crossover, an odd row, column or depth is
+ * peeled off and added by gemm. All temporaries live in one workspace allocated up front and reused.
+ * With options.parallel the sub-products of the first levels, enough to keep every hardware thread busy,
+ * are independent tasks on utils::ThreadPool().
+ */
+void Multiply(MatrixView<const float> lhs, MatrixView<const float> rhs, MatrixView<float> out, const Options& options = {});
+
+// Number of times Multiply halves a product of this shape
+std::size_t Levels(std::size_t rows, std::size_t depth, std::size_t cols, std::size_t crossover);
+
+/*
+ * Bound on max |out - lhs * rhs| / (max |lhs| * max |rhs| * epsilon), after Higham, "Accuracy and Stability
+ * of Numerical Algorithms", 23.2.2: 18^l * (d^2 + 6d) - 6 * depth, where d is the depth of the gemm leaves.
+ * The classic product has depth^2, so every level costs up to 4.5 times more error.
+ */
+double ErrorBound(std::size_t rows, std::size_t depth, std::size_t cols, std::size_t crossover);
+
+}  // namespace strassen
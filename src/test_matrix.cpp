@@ -0,0 +1,261 @@
+#include "fixed_matrix.h"
+#include "matrix.h"
+#include "matrix_file.h"
+#include "quantized.h"
+#include "strassen.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <filesystem>
+#include <limits>
+#include <random>
+#include <string>
+
+namespace {
+
+Matrix<MultType::Slow> Random(std::size_t rows, std::size_t cols, std::mt19937& gen) {
+    std::uniform_real_distribution<float> dis(-1, 1);
+    Matrix<MultType::Slow> m(rows, cols);
+    for (std::size_t i = 0; i < rows; ++i) {
+        for (std::size_t j = 0; j < cols; ++j) {
+            m(i, j) = dis(gen);
+        }
+    }
+    return m;
+}
+
+float MaxAbs(MatrixView<const float> m) {
+    float result = 0;
+    for (std::size_t i = 0; i < m.Rows(); ++i) {
+        for (std::size_t j = 0; j < m.Cols(); ++j) {
+            result = std::max(result, std::abs(m(i, j)));
+        }
+    }
+    return result;
+}
+
+class IsaTest : public testing::TestWithParam<gemm::Isa> {};
+
+}  // namespace
+
+// Shapes cover partial micro-tiles, several depth blocks and more columns than one rhs block
+TEST_P(IsaTest, MatchesSlow) {
+    if (!gemm::Supported(GetParam())) {
+        GTEST_SKIP() << gemm::IsaName(GetParam()) << " is not supported";
+    }
+    std::mt19937 gen(7);
+    const std::size_t shapes[][3] = {{1, 1, 1}, {13, 7, 29}, {12, 32, 64}, {145, 300, 70}, {37, 513, 5}, {3, 20, 4100}};
+    for (const auto& [rows, depth, cols] : shapes) {
+        const auto lhs = Random(rows, depth, gen);
+        const auto rhs = Random(depth, cols, gen);
+        const auto expected = lhs * rhs;
+        for (std::size_t threads : {1, 3}) {
+            Matrix<MultType::Slow> out(rows, cols);
+            gemm::Multiply(lhs.View(), rhs.View(), out.View(), {.threads = threads, .affinity = {}, .isa = GetParam()});
+            EXPECT_TRUE(Near(out.View(), expected.View(), 1e-3)) << rows << "x" << depth << "x" << cols;
+
+            // The same product through transposed views of transposed copies
+            const Matrix<MultType::Slow> lhsT(lhs.Transposed());
+            const Matrix<MultType::Slow> rhsT(rhs.Transposed());
+            Matrix<MultType::Slow> outT(cols, rows);
+            gemm::Multiply(
+                lhsT.Transposed(), rhsT.Transposed(), outT.Transposed(), {.threads = threads, .affinity = {}, .isa = GetParam()});
+            EXPECT_TRUE(Near(outT.Transposed(), expected.View(), 1e-3)) << rows << "x" << depth << "x" << cols;
+        }
+    }
+}
+
+// The int8 and bf16 products against the same products of the stored values in double
+TEST_P(IsaTest, QuantizedMatchesExact) {
+    if (!gemm::Supported(GetParam())) {
+        GTEST_SKIP() << gemm::IsaName(GetParam()) << " is not supported";
+    }
+    std::mt19937 gen(7);
+    // More depth than one block of either mode, more rows than one lhs block
+    const std::size_t shapes[][3] = {{1, 1, 1}, {13, 7, 29}, {37, 1100, 45}, {200, 33, 70}};
+    for (const auto& [rows, depth, cols] : shapes) {
+        const auto lhs = Random(rows, depth, gen);
+        const auto rhs = Random(depth, cols, gen);
+        const quantized::Int8Matrix lhsInt8(lhs.View(), quantized::Scales::PerRow);
+        const quantized::Int8Matrix rhsInt8(rhs.View(), quantized::Scales::PerCol);
+        const quantized::Bf16Matrix lhsBf16(lhs.View());
+        const quantized::Bf16Matrix rhsBf16(rhs.View());
+        Matrix<MultType::Slow> expectedInt8(rows, cols);
+        Matrix<MultType::Slow> expectedBf16(rows, cols);
+        for (std::size_t i = 0; i < rows; ++i) {
+            for (std::size_t j = 0; j < cols; ++j) {
+                double int8 = 0;
+                double bf16 = 0;
+                for (std::size_t k = 0; k < depth; ++k) {
+                    int8 += lhsInt8.Quantized(i, k) * rhsInt8.Quantized(k, j);
+                    bf16 += static_cast<double>(lhsBf16(i, k)) * rhsBf16(k, j);
+                }
+                expectedInt8(i, j) = static_cast<float>(int8 * lhsInt8.Scale(i) * rhsInt8.Scale(j));
+                expectedBf16(i, j) = static_cast<float>(bf16);
+            }
+        }
+        for (bool parallel : {false, true}) {
+            const quantized::Options options{.parallel = parallel, .isa = GetParam()};
+            Matrix<MultType::Slow> out(rows, cols);
+            quantized::Multiply(lhsInt8, rhsInt8, out.View(), options);
+            EXPECT_TRUE(Near(out.View(), expectedInt8.View(), 1e-4)) << rows << "x" << depth << "x" << cols;
+            quantized::Multiply(lhsBf16, rhsBf16, out.View(), options);
+            EXPECT_TRUE(Near(out.View(), expectedBf16.View(), 1e-4)) << rows << "x" << depth << "x" << cols;
+        }
+    }
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Gemm,
+    IsaTest,
+    testing::Values(gemm::Isa::Scalar, gemm::Isa::Sse42, gemm::Isa::Avx2, gemm::Isa::Avx512),
+    [](const testing::TestParamInfo<gemm::Isa>& info) {
+        std::string name = gemm::IsaName(info.param);
+        std::erase(name, '.');
+        return name;
+    });
+
+// A small crossover gives several levels, odd sizes peel at each of them
+TEST(Strassen, WithinErrorBound) {
+    std::mt19937 gen(7);
+    const std::size_t shapes[][3] = {{1, 1, 1}, {64, 64, 64}, {67, 45, 83}, {130, 257, 99}, {200, 31, 300}};
+    for (const auto& [rows, depth, cols] : shapes) {
+        const auto lhs = Random(rows, depth, gen);
+        const auto rhs = Random(depth, cols, gen);
+        const auto expected = lhs * rhs;
+        for (bool parallel : {false, true}) {
+            const strassen::Options options{.crossover = 16, .parallel = parallel, .isa = {}};
+            Matrix<MultType::Slow> out(rows, cols);
+            strassen::Multiply(lhs.View(), rhs.View(), out.View(), options);
+            // The reference itself may be off by depth^2 epsilon
+            const double bound = (strassen::ErrorBound(rows, depth, cols, options.crossover) + depth * depth)
+                * std::numeric_limits<float>::epsilon() * MaxAbs(lhs.View()) * MaxAbs(rhs.View());
+            EXPECT_TRUE(Near(out.View(), expected.View(), bound)) << rows << "x" << depth << "x" << cols;
+        }
+    }
+    EXPECT_EQ(strassen::Levels(130, 257, 99, 16), 3);
+    EXPECT_EQ(strassen::Levels(15, 257, 99, 16), 0);
+}
+
+TEST(FixedMatrix, MatchesSlow) {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dis(-1, 1);
+    FixedMatrix<3, 5> lhs;
+    FixedMatrix<5, 2> rhs;
+    for (std::size_t i = 0; i < 5; ++i) {
+        for (std::size_t j = 0; j < 3; ++j) {
+            lhs(j, i) = dis(gen);
+        }
+        for (std::size_t j = 0; j < 2; ++j) {
+            rhs(i, j) = dis(gen);
+        }
+    }
+    Matrix<MultType::Slow> expected(3, 2);
+    MultiplySlow(lhs.View(), rhs.View(), expected.View());
+    EXPECT_TRUE(Near((lhs * rhs).View(), expected.View()));
+    EXPECT_EQ((lhs * FixedMatrix<5, 5>::Identity()), lhs);
+    EXPECT_EQ((lhs * rhs).Transposed(), rhs.Transposed() * lhs.Transposed());
+}
+
+// 37 matrices leave a partial block, 6 columns a partial group of accumulators
+TEST(MatrixBatch, MatchesFixed) {
+    std::mt19937 gen(7);
+    std::uniform_real_distribution<float> dis(-1, 1);
+    const std::size_t size = 37;
+    MatrixBatch<3, 4> lhs(size);
+    MatrixBatch<4, 6> rhs(size);
+    MatrixBatch<3, 6> out(size);
+    for (std::size_t b = 0; b < size; ++b) {
+        for (std::size_t k = 0; k < 4; ++k) {
+            for (std::size_t i = 0; i < 3; ++i) {
+                lhs(b, i, k) = dis(gen);
+            }
+            for (std::size_t j = 0; j < 6; ++j) {
+                rhs(b, k, j) = dis(gen);
+            }
+        }
+    }
+    Multiply(lhs, rhs, out);
+    for (std::size_t b = 0; b < size; ++b) {
+        EXPECT_EQ(out.Get(b), lhs.Get(b) * rhs.Get(b)) << b;
+    }
+}
+
+TEST(Quantized, RoundsToStorage) {
+    const Matrix<MultType::Slow> m{{1, -0.5f, 0.25f}, {-3, 0, 1.00390625f}};
+    const quantized::Int8Matrix perRow(m.View(), quantized::Scales::PerRow);
+    EXPECT_EQ(perRow.Quantized(0, 0), 127);
+    EXPECT_EQ(perRow.Quantized(0, 1), -64);
+    EXPECT_EQ(perRow.Quantized(1, 0), -127);
+    EXPECT_EQ(perRow.Quantized(1, 1), 0);
+    EXPECT_FLOAT_EQ(perRow(1, 0), -3);
+    const quantized::Int8Matrix perCol(m.View(), quantized::Scales::PerCol);
+    EXPECT_FLOAT_EQ(perCol.Scale(0), 3.f / 127);
+    const quantized::Int8Matrix wrongRhs(m.Transposed(), quantized::Scales::PerRow);
+    EXPECT_THROW(quantized::Multiply(perRow, wrongRhs, Matrix<MultType::Slow>(2, 2).View()), std::invalid_argument);
+
+    // 1 + 2^-8 is halfway between two bf16 values and rounds to the even one
+    const quantized::Bf16Matrix bf16(m.View());
+    EXPECT_EQ(bf16(0, 1), -0.5f);
+    EXPECT_EQ(bf16(1, 2), 1.f);
+}
+
+// Tiles of 16 leave partial tiles on every edge and several tiles along the depth
+TEST(MatrixFile, OutOfCoreMatchesSlow) {
+    const auto dir = std::filesystem::temp_directory_path();
+    const auto lhsPath = (dir / "test_matrix_lhs.bin").string();
+    const auto rhsPath = (dir / "test_matrix_rhs.bin").string();
+    const auto outPath = (dir / "test_matrix_out.bin").string();
+    std::mt19937 gen(11);
+    const auto lhs = Random(37, 50, gen);
+    const auto rhs = Random(50, 29, gen);
+    {
+        auto lhsFile = MatrixFile::Create(lhsPath, 37, 50, 16);
+        auto rhsFile = MatrixFile::Create(rhsPath, 50, 29, 16);
+        for (std::size_t k = 0; k < 50; ++k) {
+            for (std::size_t i = 0; i < 37; ++i) {
+                lhsFile(i, k) = lhs(i, k);
+            }
+            for (std::size_t j = 0; j < 29; ++j) {
+                rhsFile(k, j) = rhs(k, j);
+            }
+        }
+        auto outFile = MatrixFile::Create(outPath, 37, 29, 16);
+        MultiplyOutOfCore(lhsFile, rhsFile, outFile);
+        outFile.Sync();
+    }
+
+    const auto out = MatrixFile::Open(outPath);
+    ASSERT_EQ(out.Rows(), 37u);
+    ASSERT_EQ(out.Cols(), 29u);
+    ASSERT_EQ(out.TileSize(), 16u);
+    const auto expected = lhs * rhs;
+    for (std::size_t i = 0; i < 37; ++i) {
+        for (std::size_t j = 0; j < 29; ++j) {
+            EXPECT_NEAR(out(i, j), expected(i, j), 1e-4) << i << " " << j;
+        }
+    }
+
+    // An empty out has no steps, with or without depth
+    for (const auto [rows, depth, cols] : {std::array<std::size_t, 3>{0, 32, 16}, {32, 32, 0}, {0, 0, 0}}) {
+        const auto lhsFile = MatrixFile::Create(lhsPath, rows, depth, 16);
+        const auto rhsFile = MatrixFile::Create(rhsPath, depth, cols, 16);
+        auto outFile = MatrixFile::Create(outPath, rows, cols, 16);
+        MultiplyOutOfCore(lhsFile, rhsFile, outFile);
+        EXPECT_EQ(outFile.Rows(), rows);
+        EXPECT_EQ(outFile.Cols(), cols);
+    }
+    EXPECT_THROW(MatrixFile::Create(outPath, 4, 4, 10), std::invalid_argument);
+    EXPECT_THROW(MatrixFile::Open(outPath + ".missing"), std::system_error);
+    std::filesystem::remove(lhsPath);
+    std::filesystem::remove(rhsPath);
+    std::filesystem::remove(outPath);
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,98 @@
+#include "utils.h"
+
+// graph.h uses the names of utils unqualified
+using namespace utils;
+
+#include "router.h"
+
+#include <gtest/gtest.h>
+
+#include <iterator>
+#include <random>
+
+namespace {
+
+// Every vertex with a route steps along an existing edge to a vertex one weight closer
+void ExpectConsistent(const Graph& graph, const FlowField& field) {
+    for (int vertex = 0; vertex < GridColumns() * GridRows(); ++vertex) {
+        const auto next = field.Next(vertex);
+        if (vertex == field.Target() || field.Distance(vertex) == FlowField::UNREACHABLE) {
+            EXPECT_EQ(next, FlowField::NONE) << vertex;
+            continue;
+        }
+        ASSERT_NE(next, FlowField::NONE) << vertex;
+        const auto* edge = graph.GetEdge(vertex, next);
+        ASSERT_NE(edge, nullptr) << vertex;
+        const int to = GetVertex(GetPos(vertex) + Graph::DIRS[next] * static_cast<float>(DPIXELS));
+        EXPECT_EQ(field.Distance(vertex), field.Distance(to) + FlowField::Weight(edge->cost)) << vertex;
+    }
+}
+
+}  // namespace
+
+/*
+ * Router only adds edges and lowers weights, so the fields it updates in place must match fresh ones.
+ * Random edges are added while cars follow the fields, which drives the weights of busy routes down.
+ */
+TEST(FlowField, IncrementalMatchesRebuilt) {
+    gWorld.bounds = {0, 0, 200, 100};
+    const int vertices = GridColumns() * GridRows();
+    Graph graph(vertices);
+    Router router(graph);
+    const WindXy targets[] = {{200, 100}, {0, 0}, {100, 50}};
+    for (const auto& target : targets) {
+        EXPECT_EQ(router.Field(target).Next(0), FlowField::NONE);
+    }
+
+    const auto neighbour = [](int vertex, int dirInd) {
+        return GetVertex(GetPos(vertex) + Graph::DIRS[dirInd] * static_cast<float>(DPIXELS));
+    };
+    std::mt19937 gen(3);
+    int drops = 0;
+    for (int step = 0; step < 200000; ++step) {
+        const int vertex = gen() % vertices;
+        if (step % 4 == 0) {
+            const int dirInd = gen() % Graph::DIRS.size();
+            if (neighbour(vertex, dirInd) >= 0 && !graph.HasEdge(vertex, dirInd)) {
+                router.AddEdge(vertex, dirInd);
+            }
+        } else {
+            // A car drives from vertex to a target
+            const auto& field = router.Field(targets[gen() % std::size(targets)]);
+            for (int from = vertex; field.Next(from) != FlowField::NONE;) {
+                const auto dirInd = field.Next(from);
+                const int weight = FlowField::Weight(graph.GetEdge(from, dirInd)->cost);
+                router.Travel(from, dirInd);
+                drops += FlowField::Weight(graph.GetEdge(from, dirInd)->cost) != weight;
+                from = neighbour(from, dirInd);
+            }
+        }
+        if (step % 20000 != 19999) {
+            continue;
+        }
+        for (const auto& target : targets) {
+            const auto& field = router.Field(target);
+            const FlowField rebuilt(graph, field.Target());
+            for (int u = 0; u < vertices; ++u) {
+                ASSERT_EQ(field.Distance(u), rebuilt.Distance(u)) << "step " << step << " vertex " << u;
+            }
+            ExpectConsistent(graph, field);
+        }
+    }
+    // Weights did drop, down to the floor on the busiest edges
+    EXPECT_GT(drops, 1000);
+}
+
+TEST(FlowField, HeadingStartsTowardsTarget) {
+    gWorld.bounds = {0, 0, 600, 400};
+    Graph graph(GridColumns() * GridRows());
+    const FlowField field(graph, GetVertex({590, 390}));
+    // DIRS[4] is (1, 1), DIRS[0] is (-1, -1)
+    EXPECT_EQ(field.Heading(0).front(), 4);
+    EXPECT_EQ(field.Heading(0).back(), 0);
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <SFML/Graphics/Font.hpp>
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/Text.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <vector>
+
+namespace utils {
+
+/*
+ * TextBatch lays out every (string, size, style) once and collects the glyph quads
+ * of a frame into one vertex array per glyph atlas. SFML keeps a separate atlas
+ * texture for every character size, so a frame costs one draw call per size used.
+ */
+class TextBatch {
+public:
+    explicit TextBatch(const sf::Font& font) : font_(font) {}
+
+    void Add(
+        sf::Vector2f position,
+        std::string_view str,
+        sf::Color color,
+        unsigned size,
+        sf::Uint32 style = sf::Text::Regular)
+    {
+        auto it = cache_.find(std::tie(str, size, style));
+        if (it == cache_.end()) {
+            if (cache_.size() >= MAX_CACHED) {
+                cache_.clear();
+            }
+            it = cache_.emplace(Key(str, size, style), std::vector<sf::Vertex>()).first;
+            Shape(str, size, style, it->second);
+        }
+        Add(position, it->second, color, size);
+    }
+
+    // Appends glyphs which were shaped by the caller, e.g. to keep them between frames
+    void Add(
+        sf::Vector2f position,
+        const std::vector<sf::Vertex>& glyphs,
+        sf::Color color,
+        unsigned size)
+    {
+        auto& page = pages_[size];
+        for (auto vertex : glyphs) {
+            vertex.position += position;
+            vertex.color = color;
+            page.push_back(vertex);
+        }
+    }
+
+    void Shape(std::string_view str, unsigned size, sf::Uint32 style, std::vector<sf::Vertex>& out) const {
+        out.clear();
+        const bool bold = style & sf::Text::Bold;
+        const float whitespace = font_.getGlyph(U' ', size, bold).advance;
+        const float lineSpacing = font_.getLineSpacing(size);
+
+        float x = 0;
+        float y = size;
+        sf::Uint32 prev = 0;
+        for (unsigned char c : str) {
+            x += font_.getKerning(prev, c, size);
+            prev = c;
+            if (c == ' ') {
+                x += whitespace;
+                continue;
+            }
+            if (c == '\t') {
+                x += 4 * whitespace;
+                continue;
+            }
+            if (c == '\n') {
+                x = 0;
+                y += lineSpacing;
+                continue;
+            }
+
+            const auto& glyph = font_.getGlyph(c, size, bold);
+            const float left = x + glyph.bounds.left;
+            const float top = y + glyph.bounds.top;
+            const float right = left + glyph.bounds.width;
+            const float bottom = top + glyph.bounds.height;
+            const float u1 = glyph.textureRect.left;
+            const float v1 = glyph.textureRect.top;
+            const float u2 = u1 + glyph.textureRect.width;
+            const float v2 = v1 + glyph.textureRect.height;
+
+            out.emplace_back(sf::Vector2f(left, top), sf::Vector2f(u1, v1));
+            out.emplace_back(sf::Vector2f(right, top), sf::Vector2f(u2, v1));
+            out.emplace_back(sf::Vector2f(left, bottom), sf::Vector2f(u1, v2));
+            out.emplace_back(sf::Vector2f(left, bottom), sf::Vector2f(u1, v2));
+            out.emplace_back(sf::Vector2f(right, top), sf::Vector2f(u2, v1));
+            out.emplace_back(sf::Vector2f(right, bottom), sf::Vector2f(u2, v2));
+
+            x += glyph.advance;
+        }
+    }
+
+    // Draws everything added since the previous call
+    void Draw(sf::RenderTarget& target) {
+        for (auto& [size, page] : pages_) {
+            if (!page.empty()) {
+                target.draw(page.data(), page.size(), sf::Triangles, &font_.getTexture(size));
+                page.clear();
+            }
+        }
+    }
+
+private:
+    static constexpr std::size_t MAX_CACHED = 4096;
+
+    using Key = std::tuple<std::string, unsigned, sf::Uint32>;
+
+    const sf::Font& font_;
+    std::map<Key, std::vector<sf::Vertex>, std::less<>> cache_;
+    std::map<unsigned, std::vector<sf::Vertex>> pages_;
+};
+
+}  // namespace utils
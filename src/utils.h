@@ -1,5 +1,7 @@
 #pragma once
 
+#include "text_batch.h"
+
 #include <SFML/Graphics/Font.hpp>
 #include <SFML/Graphics/RenderWindow.hpp>
 #include <SFML/Graphics/CircleShape.hpp>
@@ -7,6 +9,7 @@
 #include <SFML/System/Vector2.hpp>
 
 #include <complex>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <numbers>
@@ -65,6 +68,8 @@ static auto PURISA_FONT_INIT = []() {
     return 0;
 }();
 
+inline TextBatch gTextBatch(PURISA_FONT);
+
 static constexpr int WIDTH = 1600;
 static constexpr int HEIGHT = 1600;
 
@@ -175,35 +180,42 @@ RandVec(T from = std::numeric_limits<T>::lowest(), T to = std::numeric_limits<T>
 
 inline std::map<std::string, double, std::less<>> gStats;
 
+struct StatLine {
+    double value = 0;
+    std::vector<sf::Vertex> glyphs;
+};
+
+// Shaped "name: value" lines, re-laid out only when the value changes
+inline std::map<std::string, StatLine, std::less<>> gStatLines;
+
 inline void DrawStats(sf::RenderWindow& window) {
+    static constexpr unsigned SIZE = 20;
     int height = 10;
     for (const auto& [name, value] : gStats) {
-        sf::Text text(
-            name + ": " + std::to_string(value),
-            PURISA_FONT,
-            20
-        );
-        text.setFillColor(sf::Color::Black);
-        text.setPosition(WIDTH - 300, height);
+        auto [it, inserted] = gStatLines.try_emplace(name);
+        auto& line = it->second;
+        if (inserted || line.value != value) {
+            line.value = value;
+            gTextBatch.Shape(name + ": " + std::to_string(value), SIZE, sf::Text::Regular, line.glyphs);
+        }
+        gTextBatch.Add(WindXy(WIDTH - 300, height), line.glyphs, sf::Color::Black, SIZE);
         height += 40;
-        window.draw(text);
     }
 }
 
-void
+// Queues the text, it is drawn into the target given to the next FlushText
+inline void
 DisplayText(
-    sf::RenderTarget& window,
     WindXy position,
     const std::string& str,
     sf::Color color = sf::Color::Black,
     uint size = 10)
 {
-    sf::Text text(str, PURISA_FONT);
-    text.setCharacterSize(size);
-    text.setStyle(sf::Text::Bold);
-    text.setFillColor(color);
-    text.setPosition(position);
-    window.draw(text);
+    gTextBatch.Add(position, str, color, size, sf::Text::Bold);
+}
+
+inline void FlushText(sf::RenderTarget& window) {
+    gTextBatch.Draw(window);
 }
 
 }  // namespace utils
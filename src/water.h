@@ -1,49 +1,112 @@
 #pragma once
 
+#include "field.h"
+#include "packed_field.h"
+#include "poisson.h"
 #include "utils.h"
+#include "world.h"
 
 #include <SFML/Graphics/RectangleShape.hpp>
 #include <SFML/Graphics/RenderWindow.hpp>
 
+#include <chrono>
+
 template <class T, class U>
 inline auto To(const sf::Vector2<U>& other) {
     return sf::Vector2<T>(other.x, other.y);
 }
 
 struct WaterBottle {
-    WaterBottle() {
-        auto& left = borders_.emplace_back(WindXy(50, 500));
+    /*
+     * Storage of the density and of the velocity fields can be chosen separately.
+     * A scale above 1 makes the bottle that many times wider and taller than the window, for runs on fields
+     * larger than the caches.
+     */
+    explicit WaterBottle(
+        utils::Precision densityPrecision = utils::Precision::Float,
+        utils::Precision velocityPrecision = utils::Precision::Float,
+        int scale = 1)
+    {
+        const int width = 1000 * scale;
+        const int height = 500 * scale;
+        // The references below must survive the following emplace_backs
+        borders_.reserve(4);
+        auto& left = borders_.emplace_back(WindXy(50, height));
         left.setPosition(WindXy(200, 200));
-        auto& bot = borders_.emplace_back(WindXy(1100, 50));
-        bot.setPosition(WindXy(200, 700));
-        auto& top = borders_.emplace_back(WindXy(1100, 50));
+        auto& bot = borders_.emplace_back(WindXy(width + 100, 50));
+        bot.setPosition(WindXy(200, 200 + height));
+        auto& top = borders_.emplace_back(WindXy(width + 100, 50));
         top.setPosition(WindXy(200, 150));
-        auto& right = borders_.emplace_back(WindXy(50, 500));
-        right.setPosition(WindXy(1250, 200));
+        auto& right = borders_.emplace_back(WindXy(50, height));
+        right.setPosition(WindXy(250 + width, 200));
         for (auto& border : borders_) {
             border.setFillColor(GREY);
         }
 
         int ySize = (right.getPosition().x - left.getPosition().x - left.getSize().x) / ds_;
         int xSize = (bot.getPosition().y - right.getPosition().y) / ds_;
-        density_.resize(xSize);
-        for (auto& row : density_) {
-            row.resize(ySize);
-            std::generate(row.begin(), row.end(), []() {
+        density_ = PackedField(xSize, ySize, densityPrecision);
+        densityNext_ = PackedField(xSize, ySize, densityPrecision);
+        velocityX_ = PackedField(xSize, ySize, velocityPrecision);
+        velocityY_ = PackedField(xSize, ySize, velocityPrecision);
+        velocityXNext_ = PackedField(xSize, ySize, velocityPrecision);
+        velocityYNext_ = PackedField(xSize, ySize, velocityPrecision);
+        // A drop of noisy density in the upper half, the rest of the bottle is empty
+        const float dropRow = xSize / 3.f;
+        const float dropCol = ySize / 2.f;
+        const float dropRadius = std::min(xSize, ySize) / 4.f;
+        std::vector<float> buffer(ySize);
+        for (int i = 0; i < xSize; ++i) {
+            float* row = density_.Writable(i, buffer.data());
+            for (int j = 0; j < ySize; ++j) {
                 std::uniform_real_distribution dis;
-                return dis(gen);
-            });
-            initialDensitySum_ += std::reduce(row.begin(), row.end());
+                row[j] = std::hypot(i - dropRow, j - dropCol) < dropRadius ? dis(gen) : 0.f;
+            }
+            density_.Commit(i, row);
+            densityNext_.Commit(i, row);
         }
-        velocity_ = {static_cast<std::size_t>(xSize), std::vector<sf::Vector2f>(ySize)};
-//        pressure_ = {static_cast<std::size_t>(xSize), std::vector<float>(ySize)};
-        RecalcPressure();
+        initialDensitySum_ = density_.Sum();
+
+        tileRows_ = (xSize + TILE - 1) / TILE;
+        tileCols_ = (ySize + TILE - 1) / TILE;
+        tileActive_.assign(tileRows_ * tileCols_, 1);
+        tileWet_.assign(tileRows_ * tileCols_, 0);
+        tileMass_.assign(tileRows_ * tileCols_, 0);
+        rowTiles_.resize(tileRows_);
+        for (std::size_t tileRow = 0; tileRow < tileRows_; ++tileRow) {
+            activeTileRows_.push_back(tileRow);
+            for (std::size_t tileCol = 0; tileCol < tileCols_; ++tileCol) {
+                rowTiles_[tileRow].push_back(tileCol);
+            }
+        }
+        UpdateTiles();
     }
 
     void HandleInput(const sf::Event& event) {
         if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Space) {
             canUpdate_ = true;
         }
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::P) {
+            solver_.type = solver_.type == fluid::SolverType::Multigrid
+                ? fluid::SolverType::ConjugateGradient
+                : fluid::SolverType::Multigrid;
+        }
+        // Cycles the storage of all fields: float, fp16, fixed point
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::H) {
+            const auto precision = static_cast<utils::Precision>((static_cast<int>(density_.GetPrecision()) + 1) % 3);
+            for (auto* field : {&density_, &densityNext_, &velocityX_, &velocityY_, &velocityXNext_, &velocityYNext_}) {
+                field->Convert(precision);
+            }
+        }
+        // Sparse or dense simulation
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::T) {
+            SetSparse(!sparse_);
+        }
+    }
+
+    void SetSparse(bool sparse) {
+        sparse_ = sparse;
+        UpdateTiles();
     }
 
     void Update(sf::RenderWindow& window) {
@@ -51,153 +114,665 @@ struct WaterBottle {
             return;
         }
 //        canUpdate_ = false;
+        ApplyForces();
+        RecalcPressure();
         RecalcVelocities();
 
-        // move and calc intersections
-        std::vector<std::vector<float>> masses(
-            velocity_.size(),
-            std::vector<float>(velocity_[0].size()));
-        for (int i = 0; i < velocity_.size(); ++i) {
-            for (int j = 0; j < velocity_[0].size(); ++j) {
-                auto cell = sf::FloatRect(
-                    origin_.x + ds_ * j,
-                    origin_.y + ds_ * i,
-                    ds_,
-                    ds_);
-                Move(cell, velocity_[i][j]);
-//                if (std::abs(velocity_[i][j]) > 100) {
-//                    std::cerr << "WTF!!" << std::endl;
-//                }
-                static constexpr std::array<std::pair<int, int>, 4> NEIGHBORS = {{
-                    {0, 0},
-                    {0, 1},
-                    {1, 0},
-                    {1, 1},
-                }};
-
-                int yIndTarget = (cell.left - origin_.x) / ds_;
-                yIndTarget = std::min((int)velocity_[0].size() - 1, std::max(yIndTarget, 0));
-                int xIndTarget = (cell.top - origin_.y) / ds_;
-                xIndTarget = std::min((int)velocity_.size() - 1, std::max(xIndTarget, 0));
-                for (auto [dx, dy] : NEIGHBORS) {
-                    auto neighbor = sf::FloatRect(
-                        origin_.x + ds_ * (yIndTarget + dy),
-                        origin_.y + ds_ * (xIndTarget + dx),
-                        ds_,
-                        ds_);
-                    sf::FloatRect intersection;
-                    cell.intersects(neighbor, intersection);
-                    const auto area = intersection.width * intersection.height;
-                    int x = std::min(xIndTarget + dx, (int)velocity_.size() - 1);
-                    int y = std::min(yIndTarget + dy, (int)velocity_[0].size() - 1);
-                    masses[x][y] += area * density_[i][j];
-                }
-            }
-        }
-        // calc densities
-        for (int i = 0; i < velocity_.size(); ++i) {
-            for (int j = 0; j < velocity_[0].size(); ++j) {
-                density_[i][j] = masses[i][j] / ds_ / ds_;
-            }
-        }
-
+        const auto start = std::chrono::steady_clock::now();
+        Advect();
+        gStats["advect, ms"] = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        gStats["bytes per cell"] = density_.BytesPerCell() + 2 * velocityX_.BytesPerCell();
+        UpdateTiles();
         CheckSameMass();
+        gStats["active tiles"] = activeTiles_;
 
-        RecalcPressure();
+        const auto& stats = solver_.LastStats();
+        gStats["pressure residual"] = stats.residual;
+        gStats["pressure iterations"] = stats.iterations;
+        gStats["pressure solve, ms"] = stats.milliseconds;
+    }
+
+    // The current fields, to compare runs with different storage
+    const PackedField& Density() const {
+        return density_;
+    }
+
+    const PackedField& VelocityX() const {
+        return velocityX_;
+    }
+
+    const PackedField& VelocityY() const {
+        return velocityY_;
     }
 
     void Render(sf::RenderWindow& window, float part) const {
         for (const auto& border : borders_) {
             window.draw(border);
         }
-        for (int i = 0; i < density_.size(); ++i) {
-            for (int j = 0; j < density_[0].size(); ++j) {
+        const auto view = ViewRect(window);
+        const int iBegin = std::max(0, static_cast<int>((view.top - origin_.y) / ds_));
+        const int iEnd = std::min<int>(density_.Rows(), (view.top + view.height - origin_.y) / ds_ + 1);
+        const int jBegin = std::max(0, static_cast<int>((view.left - origin_.x) / ds_));
+        const int jEnd = std::min<int>(density_.Cols(), (view.left + view.width - origin_.x) / ds_ + 1);
+        ForActiveCells(iBegin, iEnd, jBegin, jEnd, [&](std::size_t i, std::size_t j) {
+            if (density_(i, j) > EMPTY) {
                 const auto x = origin_.x + j * ds_;
                 const auto y = origin_.y + i * ds_;
                 auto rect = sf::RectangleShape(WindXy(ds_, ds_));
                 rect.setPosition(WindXy(x, y));
                 const sf::Color cyan = {0, 255, 255, 150};
                 auto color = cyan;
-                color.b = std::min(static_cast<float>(cyan.b), cyan.b / 2 * density_[i][j]);
-                color.g = std::min(static_cast<float>(cyan.g), cyan.g / 2 * density_[i][j]);
+                color.b = std::min(static_cast<float>(cyan.b), cyan.b / 2 * density_(i, j));
+                color.g = std::min(static_cast<float>(cyan.g), cyan.g / 2 * density_(i, j));
                 rect.setFillColor(color);
                 window.draw(rect);
             }
-        }
+        });
     }
 
 private:
-    void CheckSameMass() {
-        float densitySum = 0;
-        for (const auto& row : density_) {
-            densitySum += std::reduce(row.begin(), row.end());
+    static float FaceVelocity(float lhs, float rhs, float invDs) {
+        return std::clamp((lhs + rhs) / 2 * invDs, -MAX_COURANT, MAX_COURANT);
+    }
+
+    // Mass crossing a face per update, taken from the upwind cell
+    static float Flux(float velocity, float from, float to) {
+        return velocity > 0 ? velocity * from : velocity * to;
+    }
+
+    __attribute__((target("avx2")))
+    static __m256 FaceVelocityAvx2(__m256 lhs, __m256 rhs, __m256 invDs) {
+        const __m256 velocity = _mm256_mul_ps(_mm256_div_ps(_mm256_add_ps(lhs, rhs), _mm256_set1_ps(2)), invDs);
+        return _mm256_max_ps(_mm256_min_ps(velocity, _mm256_set1_ps(MAX_COURANT)), _mm256_set1_ps(-MAX_COURANT));
+    }
+
+    __attribute__((target("avx2")))
+    static __m256 FluxAvx2(__m256 velocity, __m256 from, __m256 to) {
+        const __m256 positive = _mm256_cmp_ps(velocity, _mm256_setzero_ps(), _CMP_GT_OQ);
+        return _mm256_blendv_ps(_mm256_mul_ps(velocity, to), _mm256_mul_ps(velocity, from), positive);
+    }
+
+    // Column indices of the lanes of the tile row starting at j
+    __attribute__((target("avx2")))
+    static __m256 ColumnsAvx2(std::size_t j) {
+        return _mm256_add_ps(_mm256_set1_ps(j), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    }
+
+    // The values of the next column in every lane, next holds the eight columns after values
+    __attribute__((target("avx2")))
+    static __m256 NextColumnAvx2(__m256 values, __m256 next) {
+        // alignr shifts within the 128-bit lanes, so each lane is paired with the one after it
+        const __m256i after = _mm256_castps_si256(_mm256_permute2f128_ps(values, next, 0x21));
+        return _mm256_castsi256_ps(_mm256_alignr_epi8(after, _mm256_castps_si256(values), 4));
+    }
+
+    // The values of the previous column in every lane, previous holds the eight columns before values
+    __attribute__((target("avx2")))
+    static __m256 PreviousColumnAvx2(__m256 values, __m256 previous) {
+        const __m256i before = _mm256_castps_si256(_mm256_permute2f128_ps(previous, values, 0x21));
+        return _mm256_castsi256_ps(_mm256_alignr_epi8(_mm256_castps_si256(values), before, 12));
+    }
+
+    // All lanes but the first, or all of them
+    __attribute__((target("avx2")))
+    static __m256 FirstLaneMaskAvx2(bool first) {
+        return _mm256_castsi256_ps(_mm256_setr_epi32(first ? -1 : 0, -1, -1, -1, -1, -1, -1, -1));
+    }
+
+    // All lanes but the last, or all of them
+    __attribute__((target("avx2")))
+    static __m256 LastLaneMaskAvx2(bool last) {
+        return _mm256_castsi256_ps(_mm256_setr_epi32(-1, -1, -1, -1, -1, -1, -1, last ? -1 : 0));
+    }
+
+    // Per thread buffer for decoded rows, kernels split it into rows themselves
+    static float* Scratch(std::size_t count) {
+        thread_local std::vector<float> scratch;
+        scratch.resize(std::max(scratch.size(), count));
+        return scratch.data();
+    }
+
+    bool Active(std::size_t i, std::size_t j) const {
+        return tileActive_[i / TILE * tileCols_ + j / TILE];
+    }
+
+    // f(i, tiles, scratch) for every row crossing an active tile, tiles are the active tile columns of the row
+    template <class F>
+    void ForActiveRows(std::size_t buffers, F&& f) {
+        const std::size_t rows = density_.Rows();
+        utils::ParallelFor(0, activeTileRows_.size(), [&](std::size_t from, std::size_t to) {
+            float* scratch = Scratch(buffers * density_.Cols());
+            for (std::size_t k = from; k < to; ++k) {
+                const auto tileRow = activeTileRows_[k];
+                for (std::size_t i = tileRow * TILE; i < std::min(rows, (tileRow + 1) * TILE); ++i) {
+                    f(i, rowTiles_[tileRow], scratch);
+                }
+            }
+        });
+    }
+
+    // f(j) for the columns of the given tiles
+    template <class F>
+    void ForTileColumns(const std::vector<std::uint32_t>& tiles, F&& f) const {
+        const std::size_t cols = density_.Cols();
+        for (auto tile : tiles) {
+            for (std::size_t j = tile * TILE; j < std::min(cols, (tile + 1) * TILE); ++j) {
+                f(j);
+            }
         }
-        auto diff = initialDensitySum_ - densitySum;
-        if (diff > 1e-2 * std::max(std::abs(initialDensitySum_), std::abs(densitySum))) {
-            std::cerr << initialDensitySum_ << " != " << densitySum << std::endl;
-//            throw std::runtime_error("Densities are not the same!");
+    }
+
+    // f(i, j) for the active cells inside [iBegin, iEnd) x [jBegin, jEnd)
+    template <class F>
+    void ForActiveCells(int iBegin, int iEnd, int jBegin, int jEnd, F&& f) const {
+        for (auto tileRow : activeTileRows_) {
+            const int rowBegin = std::max<int>(iBegin, tileRow * TILE);
+            const int rowEnd = std::min<int>(iEnd, (tileRow + 1) * TILE);
+            for (auto tile : rowTiles_[tileRow]) {
+                const int colBegin = std::max<int>(jBegin, tile * TILE);
+                const int colEnd = std::min<int>(jEnd, (tile + 1) * TILE);
+                for (int i = rowBegin; i < rowEnd; ++i) {
+                    for (int j = colBegin; j < colEnd; ++j) {
+                        f(i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    /*
+     * A tile is wet if it holds density. Wet tiles and their 8 neighbours, the halo,
+     * are simulated in the next update, the other tiles are frozen and still.
+     * Frozen mass is tracked separately, so the mass check only reads active tiles.
+     * The non sparse mode keeps all tiles active.
+     */
+    void UpdateTiles() {
+        const std::size_t rows = density_.Rows();
+        const std::size_t cols = density_.Cols();
+        std::fill(tileWet_.begin(), tileWet_.end(), 0);
+        std::fill(tileMass_.begin(), tileMass_.end(), 0);
+        utils::ParallelFor(0, activeTileRows_.size(), [&](std::size_t from, std::size_t to) {
+            float* scratch = Scratch(cols);
+            for (std::size_t k = from; k < to; ++k) {
+                const auto tileRow = activeTileRows_[k];
+                for (std::size_t i = tileRow * TILE; i < std::min(rows, (tileRow + 1) * TILE); ++i) {
+                    const float* density = density_.Read(i, scratch);
+                    for (auto tile : rowTiles_[tileRow]) {
+                        const auto index = tileRow * tileCols_ + tile;
+                        for (std::size_t j = tile * TILE; j < std::min(cols, (tile + 1) * TILE); ++j) {
+                            tileMass_[index] += density[j];
+                            tileWet_[index] |= density[j] > EMPTY;
+                        }
+                    }
+                }
+            }
+        });
+
+        activeMass_ = 0;
+        for (std::size_t tileRow = 0; tileRow < tileRows_; ++tileRow) {
+            for (std::size_t tileCol = 0; tileCol < tileCols_; ++tileCol) {
+                const auto index = tileRow * tileCols_ + tileCol;
+                bool active = !sparse_;
+                for (std::size_t r = tileRow > 0 ? tileRow - 1 : 0; r <= std::min(tileRow + 1, tileRows_ - 1); ++r) {
+                    for (std::size_t c = tileCol > 0 ? tileCol - 1 : 0; c <= std::min(tileCol + 1, tileCols_ - 1); ++c) {
+                        active |= tileWet_[r * tileCols_ + c];
+                    }
+                }
+                if (active && !tileActive_[index]) {
+                    frozenMass_ -= TileMass(tileRow, tileCol);
+                } else if (!active && tileActive_[index]) {
+                    Freeze(tileRow, tileCol);
+                    frozenMass_ += tileMass_[index];
+                }
+                if (tileActive_[index] && active) {
+                    activeMass_ += tileMass_[index];
+                } else if (active) {
+                    activeMass_ += TileMass(tileRow, tileCol);
+                }
+                tileActive_[index] = active;
+            }
         }
-        diff /= density_.size() * density_[0].size();
-        for (int i = 0; i < velocity_.size(); ++i) {
-            for (int j = 0; j < velocity_[0].size(); ++j) {
-                density_[i][j] += diff;
+
+        activeTiles_ = 0;
+        activeTileRows_.clear();
+        for (std::size_t tileRow = 0; tileRow < tileRows_; ++tileRow) {
+            rowTiles_[tileRow].clear();
+            for (std::size_t tileCol = 0; tileCol < tileCols_; ++tileCol) {
+                if (tileActive_[tileRow * tileCols_ + tileCol]) {
+                    rowTiles_[tileRow].push_back(tileCol);
+                }
+            }
+            if (!rowTiles_[tileRow].empty()) {
+                activeTileRows_.push_back(tileRow);
+                activeTiles_ += rowTiles_[tileRow].size();
             }
         }
+        UpdateSolveBox();
     }
 
-    void RecalcVelocities() {
-////        if (static_cast<int>(gStats["ticks"]) % 128 == 0) {
-////            std::cerr << gStats["ticks"] << std::endl;
-////        }
-//        // By Ox:
-//        for (int i = 0; i < velocity_.size(); ++i) {
-//            for (int j = 0; j < velocity_[0].size(); ++j) {
-//                float pressure = 0;
-//                if (j > 0) {
-//                    pressure += pressure_[i][j - 1];
-//                }
-//                if (j + 1 < velocity_[0].size()) {
-//                    pressure -= pressure_[i][j + 1];
-//                }
-//                float xAcc = pressure / density_[i][j] / ds_;
-//                velocity_[i][j] += sf::Vector2f{xAcc, 0};
-//            }
-//        }
-//        // By Oy:
-//        for (int i = 0; i < velocity_.size(); ++i) {
-//            for (int j = 0; j < velocity_[0].size(); ++j) {
-//                float pressure = 0;
-//                if (i > 0) {
-//                    pressure += pressure_[i - 1][j];
-//                }
-//                if (i + 1 < velocity_.size()) {
-//                    pressure -= pressure_[i + 1][j];
-//                }
-//                float yAcc = pressure / density_[i][j] / ds_;
-//                velocity_[i][j] += sf::Vector2f{0, yAcc};
-//            }
-//        }
+    /*
+     * The pressure is solved on the tile aligned bounding box of the active tiles with walls around it.
+     * Frozen cells inside the box are still fluid, the pressure outside is zero and only seeds a grown box.
+     * The solver is rebuilt only when the box changes.
+     */
+    void UpdateSolveBox() {
+        if (activeTileRows_.empty()) {
+            return;
+        }
+        std::size_t colBegin = tileCols_;
+        std::size_t colEnd = 0;
+        for (auto tileRow : activeTileRows_) {
+            colBegin = std::min<std::size_t>(colBegin, rowTiles_[tileRow].front());
+            colEnd = std::max<std::size_t>(colEnd, rowTiles_[tileRow].back() + 1);
+        }
+        const std::size_t row = activeTileRows_.front() * TILE;
+        const std::size_t col = colBegin * TILE;
+        const std::size_t rows = std::min(density_.Rows(), (activeTileRows_.back() + 1) * TILE) - row;
+        const std::size_t cols = std::min(density_.Cols(), colEnd * TILE) - col;
+        if (row != boxRow_ || col != boxCol_ || rows != pressure_.Rows() || cols != pressure_.Cols()) {
+            // The old pressure is a good initial guess for the new box
+            Field<float> pressure(rows, cols);
+            for (std::size_t i = 0; i < rows; ++i) {
+                for (std::size_t j = 0; j < cols; ++j) {
+                    pressure(i, j) = Pressure(row + i, col + j);
+                }
+            }
+            boxRow_ = row;
+            boxCol_ = col;
+            pressure_ = std::move(pressure);
+            divergence_ = Field<float>(rows, cols);
+            const auto type = solver_.type;
+            solver_ = fluid::PoissonSolver(rows, cols);
+            solver_.type = type;
+        }
+    }
+
+    float Pressure(std::size_t i, std::size_t j) const {
+        const std::size_t row = i - boxRow_;
+        const std::size_t col = j - boxCol_;
+        return row < pressure_.Rows() && col < pressure_.Cols() ? pressure_(row, col) : 0;
     }
 
+    double TileMass(std::size_t tileRow, std::size_t tileCol) const {
+        double mass = 0;
+        for (std::size_t i = tileRow * TILE; i < std::min(density_.Rows(), (tileRow + 1) * TILE); ++i) {
+            for (std::size_t j = tileCol * TILE; j < std::min(density_.Cols(), (tileCol + 1) * TILE); ++j) {
+                mass += density_(i, j);
+            }
+        }
+        return mass;
+    }
+
+    // Stops the fluid of a tile and makes both buffers agree, so the tile stays as it is while frozen
+    void Freeze(std::size_t tileRow, std::size_t tileCol) {
+        const std::size_t cols = density_.Cols();
+        std::vector<float> buffer(2 * cols);
+        for (std::size_t i = tileRow * TILE; i < std::min(density_.Rows(), (tileRow + 1) * TILE); ++i) {
+            const float* density = density_.Read(i, buffer.data());
+            float* next = densityNext_.Modify(i, buffer.data() + cols);
+            std::copy(density + tileCol * TILE, density + std::min(cols, (tileCol + 1) * TILE), next + tileCol * TILE);
+            densityNext_.Commit(i, next);
+            for (auto* field : {&velocityX_, &velocityY_, &velocityXNext_, &velocityYNext_}) {
+                float* row = field->Modify(i, buffer.data());
+                std::fill(row + tileCol * TILE, row + std::min(cols, (tileCol + 1) * TILE), 0.f);
+                field->Commit(i, row);
+            }
+        }
+    }
+
+    // Density first, then velocities, both moved by the velocities of the last update
+    void Advect() {
+        AdvectDensity();
+        swap(density_, densityNext_);
+        AdvectVelocities();
+        swap(velocityX_, velocityXNext_);
+        swap(velocityY_, velocityYNext_);
+    }
+
+    /*
+     * Finite volume advection: every face moves the same mass out of one cell and into the other,
+     * so the total is conserved exactly. Each output cell only reads its neighbourhood,
+     * so bands of rows are computed independently.
+     * Faces towards frozen cells are closed, the mass stays in the active tiles.
+     */
+    void AdvectDensity() {
+        if (PackedField::HasAvx2()) {
+            ForActiveRows(1, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+                AdvectDensityRowAvx2(i, tiles, scratch);
+            });
+            return;
+        }
+        const std::size_t rows = density_.Rows();
+        const std::size_t cols = density_.Cols();
+        const float invDs = 1.f / ds_;
+        ForActiveRows(8, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+            const std::size_t up = i > 0 ? i - 1 : i;
+            const std::size_t down = i + 1 < rows ? i + 1 : i;
+            const float* density = density_.Read(i, scratch);
+            const float* densityUp = density_.Read(up, scratch + cols);
+            const float* densityDown = density_.Read(down, scratch + 2 * cols);
+            const float* vx = velocityX_.Read(i, scratch + 3 * cols);
+            const float* vy = velocityY_.Read(i, scratch + 4 * cols);
+            const float* vyUp = velocityY_.Read(up, scratch + 5 * cols);
+            const float* vyDown = velocityY_.Read(down, scratch + 6 * cols);
+            float* next = densityNext_.Modify(i, scratch + 7 * cols);
+            ForTileColumns(tiles, [&](std::size_t j) {
+                const float east = j + 1 < cols && Active(i, j + 1)
+                    ? Flux(FaceVelocity(vx[j], vx[j + 1], invDs), density[j], density[j + 1])
+                    : 0;
+                const float west = j > 0 && Active(i, j - 1)
+                    ? Flux(FaceVelocity(vx[j - 1], vx[j], invDs), density[j - 1], density[j])
+                    : 0;
+                const float south = i + 1 < rows && Active(i + 1, j)
+                    ? Flux(FaceVelocity(vy[j], vyDown[j], invDs), density[j], densityDown[j])
+                    : 0;
+                const float north = i > 0 && Active(i - 1, j)
+                    ? Flux(FaceVelocity(vyUp[j], vy[j], invDs), densityUp[j], density[j])
+                    : 0;
+                next[j] = density[j] - east + west - south + north;
+            });
+            densityNext_.Commit(i, next);
+        });
+    }
+
+    // AdvectDensity on row i, each row of a tile converted and computed in registers
+    __attribute__((target("avx2,f16c")))
+    void AdvectDensityRowAvx2(std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+        const std::size_t rows = density_.Rows();
+        const std::size_t cols = density_.Cols();
+        const __m256 invDs = _mm256_set1_ps(1.f / ds_);
+        const __m256 lastColumn = _mm256_set1_ps(cols - 1.f);
+        const __m256 zero = _mm256_setzero_ps();
+        float* next = densityNext_.BeginStore8(i, scratch);
+        for (auto tile : tiles) {
+            const std::size_t j = tile * TILE;
+            const __m256 density = density_.Load8(i, j);
+            const __m256 vx = velocityX_.Load8(i, j);
+            // Inside the tile every face is open, at its sides the neighbouring tile decides
+            const bool eastTile = j + TILE < cols && Active(i, j + TILE);
+            const bool westTile = j > 0 && Active(i, j - 1);
+            const __m256 eastOpen = _mm256_and_ps(
+                _mm256_cmp_ps(ColumnsAvx2(j), lastColumn, _CMP_LT_OQ), LastLaneMaskAvx2(eastTile));
+            const __m256 east = _mm256_and_ps(eastOpen, FluxAvx2(
+                FaceVelocityAvx2(vx, NextColumnAvx2(vx, eastTile ? velocityX_.Load8(i, j + TILE) : zero), invDs),
+                density, NextColumnAvx2(density, eastTile ? density_.Load8(i, j + TILE) : zero)));
+            const __m256 west = _mm256_and_ps(FirstLaneMaskAvx2(westTile), FluxAvx2(
+                FaceVelocityAvx2(PreviousColumnAvx2(vx, westTile ? velocityX_.Load8(i, j - TILE) : zero), vx, invDs),
+                PreviousColumnAvx2(density, westTile ? density_.Load8(i, j - TILE) : zero), density));
+            __m256 south = _mm256_setzero_ps();
+            __m256 north = _mm256_setzero_ps();
+            if (i + 1 < rows && Active(i + 1, j)) {
+                south = FluxAvx2(FaceVelocityAvx2(velocityY_.Load8(i, j), velocityY_.Load8(i + 1, j), invDs),
+                    density, density_.Load8(i + 1, j));
+            }
+            if (i > 0 && Active(i - 1, j)) {
+                north = FluxAvx2(FaceVelocityAvx2(velocityY_.Load8(i - 1, j), velocityY_.Load8(i, j), invDs),
+                    density_.Load8(i - 1, j), density);
+            }
+            const __m256 value = _mm256_add_ps(_mm256_sub_ps(
+                _mm256_add_ps(_mm256_sub_ps(density, east), west), south), north);
+            densityNext_.Store8(i, j, value, next);
+        }
+        densityNext_.EndStore8(i, next);
+    }
+
+    // Semi-Lagrangian: every cell takes the velocity found where its fluid was one update ago
+    void AdvectVelocities() {
+        if (PackedField::HasAvx2() && velocityX_.CanSample8()) {
+            ForActiveRows(2, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+                AdvectVelocitiesRowAvx2(i, tiles, scratch);
+            });
+            return;
+        }
+        const std::size_t cols = velocityX_.Cols();
+        const float invDs = 1.f / ds_;
+        ForActiveRows(4, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+            const float* vx = velocityX_.Read(i, scratch);
+            const float* vy = velocityY_.Read(i, scratch + cols);
+            float* nextX = velocityXNext_.Modify(i, scratch + 2 * cols);
+            float* nextY = velocityYNext_.Modify(i, scratch + 3 * cols);
+            ForTileColumns(tiles, [&](std::size_t j) {
+                const float x = j - vx[j] * invDs;
+                const float y = i - vy[j] * invDs;
+                nextX[j] = utils::Sample(velocityX_, x, y);
+                nextY[j] = utils::Sample(velocityY_, x, y);
+            });
+            velocityXNext_.Commit(i, nextX);
+            velocityYNext_.Commit(i, nextY);
+        });
+    }
+
+    // AdvectVelocities on row i, both corner values of a row are gathered in one 32-bit lane
+    __attribute__((target("avx2,f16c")))
+    void AdvectVelocitiesRowAvx2(std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+        const __m256 invDs = _mm256_set1_ps(1.f / ds_);
+        const __m256 row = _mm256_set1_ps(i);
+        float* nextX = velocityXNext_.BeginStore8(i, scratch);
+        float* nextY = velocityYNext_.BeginStore8(i, scratch + velocityX_.Cols());
+        for (auto tile : tiles) {
+            const std::size_t j = tile * TILE;
+            const __m256 x = _mm256_sub_ps(ColumnsAvx2(j), _mm256_mul_ps(velocityX_.Load8(i, j), invDs));
+            const __m256 y = _mm256_sub_ps(row, _mm256_mul_ps(velocityY_.Load8(i, j), invDs));
+            velocityXNext_.Store8(i, j, velocityX_.Sample8(x, y), nextX);
+            velocityYNext_.Store8(i, j, velocityY_.Sample8(x, y), nextY);
+        }
+        velocityXNext_.EndStore8(i, nextX);
+        velocityYNext_.EndStore8(i, nextY);
+    }
+
+    void CheckSameMass() {
+        const double densitySum = activeMass_ + frozenMass_;
+        gStats["mass drift"] = (densitySum - initialDensitySum_) / initialDensitySum_;
+    }
+
+    // Heavier cells sink, empty ones feel nothing
+    void ApplyForces() {
+        if (PackedField::HasAvx2()) {
+            ForActiveRows(1, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+                ApplyForcesRowAvx2(i, tiles, scratch);
+            });
+            return;
+        }
+        const std::size_t cols = density_.Cols();
+        ForActiveRows(2, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+            const float* density = density_.Read(i, scratch);
+            float* vy = velocityY_.Modify(i, scratch + cols);
+            ForTileColumns(tiles, [&](std::size_t j) {
+                vy[j] += BUOYANCY * GRAVITY_CONST * density[j];
+            });
+            velocityY_.Commit(i, vy);
+        });
+    }
+
+    __attribute__((target("avx2,f16c")))
+    void ApplyForcesRowAvx2(std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+        const __m256 force = _mm256_set1_ps(BUOYANCY * GRAVITY_CONST);
+        float* vy = velocityY_.BeginStore8(i, scratch);
+        for (auto tile : tiles) {
+            const std::size_t j = tile * TILE;
+            const __m256 value = _mm256_add_ps(velocityY_.Load8(i, j), _mm256_mul_ps(force, density_.Load8(i, j)));
+            velocityY_.Store8(i, j, value, vy);
+        }
+        velocityY_.EndStore8(i, vy);
+    }
+
+    /*
+     * Face velocities are averages of the neighbouring cells, walls let nothing through.
+     * Frozen cells do not move, their divergence stays zero.
+     * The edges of the solve box are walls, as they are for the solver and the velocity update.
+     */
     void RecalcPressure() {
-//        for (int j = 0; j < pressure_[0].size(); ++j) {
-//            pressure_[0][j] = density_[0][j] * GRAVITY_CONST * ds_;
-//        }
-//        for (int i = 1; i < pressure_.size(); ++i) {
-//            for (int j = 0; j < pressure_[0].size(); ++j) {
-//                pressure_[i][j] = pressure_[i - 1][j] + density_[i][j] * GRAVITY_CONST * ds_;
-//            }
-//        }
+        Divergence();
+        if (!activeTileRows_.empty()) {
+            solver_.Solve(pressure_, divergence_);
+        }
+    }
+
+    void Divergence() {
+        divergence_.Fill(0);
+        if (PackedField::HasAvx2()) {
+            ForActiveRows(0, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float*) {
+                DivergenceRowAvx2(i, tiles);
+            });
+            return;
+        }
+        const std::size_t rows = density_.Rows();
+        const std::size_t cols = density_.Cols();
+        const std::size_t boxRowEnd = boxRow_ + pressure_.Rows();
+        const std::size_t boxColEnd = boxCol_ + pressure_.Cols();
+        ForActiveRows(4, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+            const float* vx = velocityX_.Read(i, scratch);
+            const float* vy = velocityY_.Read(i, scratch + cols);
+            const float* vyUp = velocityY_.Read(i > 0 ? i - 1 : i, scratch + 2 * cols);
+            const float* vyDown = velocityY_.Read(i + 1 < rows ? i + 1 : i, scratch + 3 * cols);
+            ForTileColumns(tiles, [&](std::size_t j) {
+                const float right = j + 1 < boxColEnd ? (vx[j] + vx[j + 1]) / 2 : 0;
+                const float left = j > boxCol_ ? (vx[j - 1] + vx[j]) / 2 : 0;
+                const float down = i + 1 < boxRowEnd ? (vy[j] + vyDown[j]) / 2 : 0;
+                const float up = i > boxRow_ ? (vyUp[j] + vy[j]) / 2 : 0;
+                // A p = -ds^2 * div(v) / dt with dt = 1 update
+                divergence_(i - boxRow_, j - boxCol_) = -ds_ * (right - left + down - up);
+            });
+        });
+    }
+
+    __attribute__((target("avx2,f16c")))
+    void DivergenceRowAvx2(std::size_t i, const std::vector<std::uint32_t>& tiles) {
+        const std::size_t boxRowEnd = boxRow_ + pressure_.Rows();
+        const std::size_t boxColEnd = boxCol_ + pressure_.Cols();
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 two = _mm256_set1_ps(2);
+        const __m256 rightEdge = _mm256_set1_ps(boxColEnd - 1.f);
+        const __m256 leftEdge = _mm256_set1_ps(boxCol_);
+        float* divergence = divergence_.Row(i - boxRow_);
+        for (auto tile : tiles) {
+            const std::size_t j = tile * TILE;
+            const __m256 columns = ColumnsAvx2(j);
+            const __m256 vx = velocityX_.Load8(i, j);
+            const __m256 vy = velocityY_.Load8(i, j);
+            const __m256 vxEast = NextColumnAvx2(vx, j + TILE < boxColEnd ? velocityX_.Load8(i, j + TILE) : zero);
+            const __m256 vxWest = PreviousColumnAvx2(vx, j > boxCol_ ? velocityX_.Load8(i, j - TILE) : zero);
+            const __m256 right = _mm256_and_ps(_mm256_cmp_ps(columns, rightEdge, _CMP_LT_OQ),
+                _mm256_div_ps(_mm256_add_ps(vx, vxEast), two));
+            const __m256 left = _mm256_and_ps(_mm256_cmp_ps(columns, leftEdge, _CMP_GT_OQ),
+                _mm256_div_ps(_mm256_add_ps(vxWest, vx), two));
+            const __m256 down = i + 1 < boxRowEnd
+                ? _mm256_div_ps(_mm256_add_ps(vy, velocityY_.Load8(i + 1, j)), two)
+                : zero;
+            const __m256 up = i > boxRow_
+                ? _mm256_div_ps(_mm256_add_ps(velocityY_.Load8(i - 1, j), vy), two)
+                : zero;
+            const __m256 sum = _mm256_sub_ps(_mm256_add_ps(_mm256_sub_ps(right, left), down), up);
+            StoreFloats(divergence + j - boxCol_, _mm256_mul_ps(_mm256_set1_ps(-ds_), sum), density_.Cols() - j);
+        }
+    }
+
+    // v -= grad(p) * dt, the gradient through a wall, the edge of the grid or of the solve box, is zero
+    void RecalcVelocities() {
+        if (PackedField::HasAvx2()) {
+            ForActiveRows(2, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+                RecalcVelocitiesRowAvx2(i, tiles, scratch);
+            });
+            return;
+        }
+        const std::size_t cols = density_.Cols();
+        const std::size_t boxRowEnd = boxRow_ + pressure_.Rows();
+        const std::size_t boxColEnd = boxCol_ + pressure_.Cols();
+        ForActiveRows(2, [&](std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+            float* vx = velocityX_.Modify(i, scratch);
+            float* vy = velocityY_.Modify(i, scratch + cols);
+            ForTileColumns(tiles, [&](std::size_t j) {
+                const float pressure = Pressure(i, j);
+                const float right = j + 1 < boxColEnd ? Pressure(i, j + 1) - pressure : 0;
+                const float left = j > boxCol_ ? pressure - Pressure(i, j - 1) : 0;
+                const float down = i + 1 < boxRowEnd ? Pressure(i + 1, j) - pressure : 0;
+                const float up = i > boxRow_ ? pressure - Pressure(i - 1, j) : 0;
+                vx[j] -= (left + right) / (2 * ds_);
+                vy[j] -= (up + down) / (2 * ds_);
+            });
+            velocityX_.Commit(i, vx);
+            velocityY_.Commit(i, vy);
+        });
     }
 
+    // The rows of the active tiles lie in the solve box, so their pressure is read from it directly
+    __attribute__((target("avx2,f16c")))
+    void RecalcVelocitiesRowAvx2(std::size_t i, const std::vector<std::uint32_t>& tiles, float* scratch) {
+        const std::size_t boxRowEnd = boxRow_ + pressure_.Rows();
+        const std::size_t boxColEnd = boxCol_ + pressure_.Cols();
+        const __m256 rightEdge = _mm256_set1_ps(boxColEnd - 1.f);
+        const __m256 leftEdge = _mm256_set1_ps(boxCol_);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 twoDs = _mm256_set1_ps(2 * ds_);
+        const float* pressure = pressure_.Row(i - boxRow_);
+        const float* pressureDown = i + 1 < boxRowEnd ? pressure + pressure_.Stride() : nullptr;
+        const float* pressureUp = i > boxRow_ ? pressure - pressure_.Stride() : nullptr;
+        float* vxRow = velocityX_.BeginStore8(i, scratch);
+        float* vyRow = velocityY_.BeginStore8(i, scratch + velocityX_.Cols());
+        for (auto tile : tiles) {
+            const std::size_t j = tile * TILE;
+            const __m256 columns = ColumnsAvx2(j);
+            const __m256 p = _mm256_load_ps(pressure + j - boxCol_);
+            const __m256 pEast = NextColumnAvx2(p,
+                j + TILE < boxColEnd ? _mm256_load_ps(pressure + j + TILE - boxCol_) : zero);
+            const __m256 pWest = PreviousColumnAvx2(p,
+                j > boxCol_ ? _mm256_load_ps(pressure + j - TILE - boxCol_) : zero);
+            const __m256 right = _mm256_and_ps(_mm256_cmp_ps(columns, rightEdge, _CMP_LT_OQ), _mm256_sub_ps(pEast, p));
+            const __m256 left = _mm256_and_ps(_mm256_cmp_ps(columns, leftEdge, _CMP_GT_OQ), _mm256_sub_ps(p, pWest));
+            const __m256 down = pressureDown ? _mm256_sub_ps(_mm256_load_ps(pressureDown + j - boxCol_), p) : zero;
+            const __m256 up = pressureUp ? _mm256_sub_ps(p, _mm256_load_ps(pressureUp + j - boxCol_)) : zero;
+            const __m256 vx = _mm256_sub_ps(velocityX_.Load8(i, j), _mm256_div_ps(_mm256_add_ps(left, right), twoDs));
+            const __m256 vy = _mm256_sub_ps(velocityY_.Load8(i, j), _mm256_div_ps(_mm256_add_ps(up, down), twoDs));
+            velocityX_.Store8(i, j, vx, vxRow);
+            velocityY_.Store8(i, j, vy, vyRow);
+        }
+        velocityX_.EndStore8(i, vxRow);
+        velocityY_.EndStore8(i, vyRow);
+    }
+
+    static constexpr float BUOYANCY = 0.1;
+    static constexpr std::size_t TILE = 8;
+    // The *Avx2 kernels compute a row of a tile as one vector
+    static_assert(TILE == 8);
+    // Below this a cell counts as empty and still
+    static constexpr float EMPTY = 1e-4;
+    // At most this part of a cell crosses one face per update, which keeps densities non-negative
+    static constexpr float MAX_COURANT = 0.25;
+
     const int ds_ = 10;
     const sf::Vector2i origin_ = {250, 200};
 
     std::vector<sf::RectangleShape> borders_;
-    std::vector<std::vector<sf::Vector2f>> velocity_;
-    std::vector<std::vector<float>> density_;
-//    std::vector<std::vector<float>> pressure_;
+    // Advection writes the *Next_ fields, then the buffers are swapped
+    PackedField velocityX_;
+    PackedField velocityY_;
+    PackedField velocityXNext_;
+    PackedField velocityYNext_;
+    PackedField density_;
+    PackedField densityNext_;
     float initialDensitySum_ = 0;
 
+    // Tiles of TILE x TILE cells, row-major
+    std::size_t tileRows_ = 0;
+    std::size_t tileCols_ = 0;
+    std::vector<std::uint8_t> tileActive_;
+    std::vector<std::uint8_t> tileWet_;
+    std::vector<double> tileMass_;
+    // Active tile columns of every tile row and the tile rows having any
+    std::vector<std::vector<std::uint32_t>> rowTiles_;
+    std::vector<std::uint32_t> activeTileRows_;
+    std::size_t activeTiles_ = 0;
+    double activeMass_ = 0;
+    double frozenMass_ = 0;
+    bool sparse_ = true;
+
+    // Pressure solve box, its top left cell is (boxRow_, boxCol_)
+    std::size_t boxRow_ = 0;
+    std::size_t boxCol_ = 0;
+    Field<float> pressure_;
+    Field<float> divergence_;
+    fluid::PoissonSolver solver_;
+
     bool canUpdate_ = true;
 };
@@ -1,10 +1,25 @@
+#include "flip.h"
+#include "fluid.h"
 #include "grid_collision.h"
+#include "parallel.h"
 
 #include "main.h"
+#include "world.h"
+
+#include <chrono>
 
 class WaterSimulation {
 public:
+    enum class Mode {
+        Collisions,
+        Fluid,
+        Flip,
+    };
+
     WaterSimulation(std::size_t count) {
+        DamBreak(fluid_.particles);
+        DamBreak(flip_.particles);
+
         for (std::size_t i = 0; i < count; ++i) {
             sf::CircleShape shape(SIZE / 2);
             const std::size_t dist = (4 * SIZE);
@@ -16,75 +31,121 @@ public:
     }
 
     void HandleInput(const sf::Event& event) {
+        if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::F) {
+            switch (mode_) {
+            case Mode::Fluid:
+                mode_ = Mode::Flip;
+                break;
+            case Mode::Flip:
+                mode_ = Mode::Collisions;
+                break;
+            case Mode::Collisions:
+                mode_ = Mode::Fluid;
+                break;
+            }
+        }
     }
 
     void Update(sf::RenderWindow& window) {
-        struct Cell {
-            struct Drop {
-                sf::CircleShape shape;
-                sf::Vector2f* velocity;
-            };
-            std::vector<Drop> drops;
-//            std::vector<std::size_t> ids;
-        };
-//        const std::size_t cellSide = std::sqrt(WIDTH * HEIGHT / particles_.Size());
-        const std::size_t cellSide = 30;
-        std::vector<std::vector<Cell>> grid(HEIGHT / cellSide, std::vector<Cell>(WIDTH / cellSide));
-        for (std::size_t i = 0; i < particles_.Size(); ++i) {
-            auto [x, y] = particles_.shapes[i].getPosition();
-            if (x < 0 || y < 0) {
-                continue;
-            }
-            const std::size_t xInd = x / cellSide;
-            const std::size_t yInd = y / cellSide;
-            if (yInd < grid.size() && xInd < grid[0].size()) {
-                grid[xInd][yInd].drops.push_back({particles_.shapes[i], &particles_.velocities[i]});
-//                grid[xInd][yInd].ids.push_back(i);
-            }
+        if (mode_ == Mode::Fluid) {
+            const auto start = std::chrono::steady_clock::now();
+            fluid_.Step();
+            gStats["fluid step, ms"] = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            gStats["fluid truncated neighbours"] = fluid_.TruncatedNeighbors();
+            return;
+        }
+        if (mode_ == Mode::Flip) {
+            const auto start = std::chrono::steady_clock::now();
+            flip_.Step();
+            gStats["flip step, ms"] = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            gStats["pressure iterations"] = flip_.LastStats().iterations;
+            gStats["pressure solve, ms"] = flip_.LastStats().milliseconds;
+            return;
         }
 
-        for (std::size_t row = 0; row < grid.size(); ++row) {
-            for (std::size_t col = 0; col < grid[0].size(); ++col) {
-
-                for (std::size_t i = 0; i < grid[row][col].drops.size(); ++i) {
-                    for (std::size_t j = i + 1; j < grid[row][col].drops.size(); ++j) {
-                        auto& first = grid[row][col].drops[i];
-                        auto& second = grid[row][col].drops[j];
-
-                        auto v = *first.velocity - *second.velocity;
-                        auto cross = std::abs(CrossProduct(v, Center(second.shape) - Center(first.shape)));
-                        auto h = cross / std::abs(v);
+        const auto start = std::chrono::steady_clock::now();
+        grid_.Resolve(sf::FloatRect(0, 0, WIDTH, HEIGHT));
+        gStats["collision sweep, ms"] = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - start).count();
+        gStats["collisions"] = grid_.Collisions();
 
-                        if (h < 2 * first.shape.getRadius()) {
-                            // collision hit, simply swap velocities
-                            std::swap(*first.velocity, *second.velocity);
-                        }
-                    }
+        utils::ParallelFor(0, particles_.Size(), [&](std::size_t from, std::size_t to) {
+            for (std::size_t i = from; i < to; ++i) {
+                particles_.velocities[i].y += GRAVITY_CONST;
+                if (particles_.shapes[i].getPosition().y > HEIGHT - 2 * particles_.shapes[i].getRadius()) {
+                    particles_.velocities[i].y = -2 * particles_.velocities[i].y / 3;
                 }
-
-            }
-        }
-
-        for (std::size_t i = 0; i < particles_.Size(); ++i) {
-            particles_.velocities[i].y += GRAVITY_CONST;
-            if (particles_.shapes[i].getPosition().y > HEIGHT - 2 * particles_.shapes[0].getRadius()) {
-                particles_.velocities[i].y = -2 * particles_.velocities[i].y / 3;
+                particles_.shapes[i].move(particles_.velocities[i]);
             }
-            particles_.shapes[i].move(particles_.velocities[i]);
-        }
+        }, 4096);
     }
 
     void Render(sf::RenderWindow& window, float part) {
+        const auto view = ViewRect(window);
+        if (mode_ == Mode::Fluid) {
+            RenderFluid(window, view, fluid_.particles);
+            return;
+        }
+        if (mode_ == Mode::Flip) {
+            RenderFluid(window, view, flip_.particles);
+            return;
+        }
         for (const auto& shape : particles_.shapes) {
-            window.draw(shape);
+            if (view.contains(Center(shape))) {
+                window.draw(shape);
+            }
         }
     }
 
 private:
     static constexpr inline float SIZE = 20;
+    static constexpr inline float FLUID_SPACING = 5;
+    static constexpr inline std::size_t FLUID_PARTICLES = 6000;
+    // Two particles per cell side
+    static constexpr inline float FLIP_CELL = 2 * FLUID_SPACING;
+
+    // A block of fluid at the left wall
+    static void DamBreak(fluid::ParticleArrays& particles) {
+        const std::size_t inRow = std::sqrt(FLUID_PARTICLES);
+        for (std::size_t i = 0; i < FLUID_PARTICLES; ++i) {
+            particles.PushBack(
+                FLUID_SPACING * (i % inRow + 1),
+                HEIGHT - FLUID_SPACING * (i / inRow + 1),
+                0,
+                0);
+        }
+    }
+
+    // One quad per particle, drawn in a single call
+    void RenderFluid(sf::RenderWindow& window, const sf::FloatRect& view, const fluid::ParticleArrays& particles) {
+        const float half = FLUID_SPACING / 2;
+        fluidVertices_.clear();
+        for (std::size_t i = 0; i < particles.Size(); ++i) {
+            const sf::Vector2f center(particles.x[i], particles.y[i]);
+            if (!view.contains(center)) {
+                continue;
+            }
+            // Faster particles are lighter
+            const auto speed = std::min(std::hypot(particles.vx[i], particles.vy[i]) * 40.f, 255.f);
+            const sf::Color color(speed, 0x60 + speed * 0x9F / 255, 0xFF);
+            fluidVertices_.emplace_back(center + sf::Vector2f(-half, -half), color);
+            fluidVertices_.emplace_back(center + sf::Vector2f(half, -half), color);
+            fluidVertices_.emplace_back(center + sf::Vector2f(half, half), color);
+            fluidVertices_.emplace_back(center + sf::Vector2f(-half, half), color);
+        }
+        window.draw(fluidVertices_.data(), fluidVertices_.size(), sf::Quads);
+    }
+
+    Mode mode_ = Mode::Fluid;
 
     Physics<sf::CircleShape> particles_;
     grid::GridCollision grid_{particles_, SIZE};
+
+    fluid::ParticleFluid fluid_{FLUID_SPACING, sf::FloatRect(0, 0, WIDTH, HEIGHT)};
+    fluid::FlipSolver flip_{FLIP_CELL, sf::FloatRect(0, 0, WIDTH, HEIGHT)};
+    std::vector<sf::Vertex> fluidVertices_;
 };
 
 int main() {
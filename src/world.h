@@ -0,0 +1,107 @@
+#pragma once
+
+#include "utils.h"
+
+#include <SFML/Graphics/RenderTarget.hpp>
+#include <SFML/Graphics/View.hpp>
+#include <SFML/Window/Event.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace utils {
+
+struct World {
+    sf::FloatRect ActiveRegion() const {
+        return {
+            visible.left - activeMargin,
+            visible.top - activeMargin,
+            visible.width + 2 * activeMargin,
+            visible.height + 2 * activeMargin,
+        };
+    }
+
+    // Bodies leaving the bounds are despawned
+    sf::FloatRect bounds = {0, 0, WIDTH, HEIGHT};
+    // Part of the world the camera looks at, updated by Main every frame
+    sf::FloatRect visible = {0, 0, WIDTH, HEIGHT};
+    // The camera view, maps window pixels to world coordinates
+    sf::View view = sf::View(visible);
+    // Chunks farther than the margin from the visible part are not simulated
+    float activeMargin = 400;
+    float chunkSize = 400;
+};
+
+inline World gWorld;
+
+inline sf::FloatRect ViewRect(const sf::RenderTarget& target) {
+    const auto& view = target.getView();
+    return {view.getCenter() - view.getSize() / 2.f, view.getSize()};
+}
+
+class Camera {
+public:
+    explicit Camera(const sf::RenderTarget& target) : view_(target.getDefaultView()) {
+    }
+
+    // Pans with arrows, zooms with the wheel, maps mouse clicks to world coordinates
+    void HandleInput(sf::Event& event, const sf::RenderTarget& target) {
+        if (event.type == sf::Event::KeyPressed) {
+            const float step = PAN_STEP * view_.getSize().x / target.getSize().x;
+            switch (event.key.code) {
+            case sf::Keyboard::Left:
+                view_.move({-step, 0});
+                break;
+            case sf::Keyboard::Right:
+                view_.move({step, 0});
+                break;
+            case sf::Keyboard::Up:
+                view_.move({0, -step});
+                break;
+            case sf::Keyboard::Down:
+                view_.move({0, step});
+                break;
+            default:
+                break;
+            }
+            Clamp();
+        } else if (event.type == sf::Event::MouseWheelScrolled) {
+            view_.zoom(std::pow(ZOOM_STEP, -event.mouseWheelScroll.delta));
+            Clamp();
+        } else if (event.type == sf::Event::MouseButtonPressed
+            || event.type == sf::Event::MouseButtonReleased)
+        {
+            const auto pos = target.mapPixelToCoords({event.mouseButton.x, event.mouseButton.y}, view_);
+            event.mouseButton.x = std::lround(pos.x);
+            event.mouseButton.y = std::lround(pos.y);
+        }
+    }
+
+    void Apply(sf::RenderTarget& target) const {
+        target.setView(view_);
+    }
+
+    sf::FloatRect Rect() const {
+        return {view_.getCenter() - view_.getSize() / 2.f, view_.getSize()};
+    }
+
+    const sf::View& View() const {
+        return view_;
+    }
+
+private:
+    static constexpr float PAN_STEP = 50;
+    static constexpr float ZOOM_STEP = 1.1;
+
+    void Clamp() {
+        const auto& bounds = gWorld.bounds;
+        auto center = view_.getCenter();
+        center.x = std::clamp(center.x, bounds.left, bounds.left + bounds.width);
+        center.y = std::clamp(center.y, bounds.top, bounds.top + bounds.height);
+        view_.setCenter(center);
+    }
+
+    sf::View view_;
+};
+
+}  // namespace utils